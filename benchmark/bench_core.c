@@ -0,0 +1,518 @@
+/*
+ * Copyright (c) 2009, NSF Cloud and Autonomic Computing Center, Rutgers University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, this list of conditions and
+ * the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ * the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * - Neither the name of the NSF Cloud and Autonomic Computing Center, Rutgers University, nor the names of its
+ * contributors may be used to endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+  Single node micro-benchmarks of the core data structures: the SFC
+  mapping  of bounding boxes,  the DHT and  local storage indexes, the
+  region copy and the DIMES buffer allocator.
+
+  Usage: bench_core [-d ndim] [-n domain size] [-b blocks per dim]
+                    [-v versions] [-s servers] [-e element size]
+                    [-i iterations] [-t seconds per benchmark]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "debug.h"
+#include "bbox.h"
+#include "ss_data.h"
+#ifdef DS_HAVE_DIMES
+#include "dimes_data.h"
+#endif
+
+struct bench_conf {
+        int             ndim;
+        uint64_t        dim_size;
+        int             num_blocks;     /* per dimension */
+        int             num_versions;
+        int             num_servers;
+        size_t          size_elem;
+        int             num_iter;
+        double          max_time;
+};
+
+static struct bench_conf conf = {
+        .ndim = 3,
+        .dim_size = 256,
+        .num_blocks = 8,
+        .num_versions = 4,
+        .num_servers = 4,
+        .size_elem = sizeof(double),
+        .num_iter = 100000,
+        .max_time = 1.0,
+};
+
+static struct bbox domain;
+
+/* Boxes of the blocks that tile the domain. */
+static int num_bb;
+static struct bbox *bb_tab;
+
+/* Query boxes, of the size of a block at random offsets. */
+#define NUM_QUERY       1024
+static struct bbox q_tab[NUM_QUERY];
+
+static double timer_now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+/*
+  Test if a benchmark started at 't0' ran out of its time budget.
+*/
+static int bench_timeout(double t0, int i)
+{
+        return (i & 15) == 0 && i > 0 && timer_now() - t0 > conf.max_time;
+}
+
+static void bench_report(const char *name, uint64_t num_ops, double t,
+                         uint64_t bytes)
+{
+        printf("%-28s %12llu %12.1f", name, (unsigned long long) num_ops,
+               t * 1.0e9 / num_ops);
+        if (bytes)
+                printf(" %12.1f", bytes / t / 1.0e6);
+        printf("\n");
+}
+
+static uint64_t block_size(void)
+{
+        return conf.dim_size / conf.num_blocks;
+}
+
+static int bench_init(void)
+{
+        uint64_t bs = block_size();
+        int i, k, n;
+
+        memset(&domain, 0, sizeof(domain));
+        domain.num_dims = conf.ndim;
+        for (k = 0; k < conf.ndim; k++)
+                domain.ub.c[k] = conf.dim_size - 1;
+
+        num_bb = 1;
+        for (k = 0; k < conf.ndim; k++)
+                num_bb *= conf.num_blocks;
+
+        bb_tab = malloc(sizeof(*bb_tab) * num_bb);
+        if (!bb_tab)
+                return -ENOMEM;
+
+        for (i = 0; i < num_bb; i++) {
+                memset(&bb_tab[i], 0, sizeof(bb_tab[i]));
+                bb_tab[i].num_dims = conf.ndim;
+                for (k = 0, n = i; k < conf.ndim; k++, n /= conf.num_blocks) {
+                        bb_tab[i].lb.c[k] = (n % conf.num_blocks) * bs;
+                        bb_tab[i].ub.c[k] = bb_tab[i].lb.c[k] + bs - 1;
+                }
+        }
+
+        srand(1);
+        for (i = 0; i < NUM_QUERY; i++) {
+                memset(&q_tab[i], 0, sizeof(q_tab[i]));
+                q_tab[i].num_dims = conf.ndim;
+                for (k = 0; k < conf.ndim; k++) {
+                        q_tab[i].lb.c[k] = rand() % (conf.dim_size - bs + 1);
+                        q_tab[i].ub.c[k] = q_tab[i].lb.c[k] + bs - 1;
+                }
+        }
+
+        return 0;
+}
+
+static void odsc_init(struct obj_descriptor *odsc, const struct bbox *bb,
+                      unsigned int version)
+{
+        memset(odsc, 0, sizeof(*odsc));
+        strcpy(odsc->name, "bench_var");
+        odsc->version = version;
+        odsc->size = conf.size_elem;
+        odsc->bb = *bb;
+}
+
+static int bench_bbox_to_intv(struct sspace *ssd)
+{
+        struct intv *i_tab;
+        uint64_t num_intv = 0;
+        double t;
+        int i, n;
+
+        t = timer_now();
+        for (i = 0; i < conf.num_iter && !bench_timeout(t, i); i++) {
+                bbox_to_intv(&q_tab[i % NUM_QUERY], ssd->max_dim, ssd->bpd,
+                             &i_tab, &n);
+                num_intv += n;
+                free(i_tab);
+        }
+        bench_report("bbox_to_intv", i, timer_now() - t, 0);
+        printf("    %.1f intervals per box\n", (double) num_intv / i);
+
+        t = timer_now();
+        for (i = 0; i < conf.num_iter && !bench_timeout(t, i); i++) {
+                bbox_to_intv2(&q_tab[i % NUM_QUERY], ssd->max_dim, ssd->bpd,
+                              &i_tab, &n);
+                free(i_tab);
+        }
+        bench_report("bbox_to_intv2", i, timer_now() - t, 0);
+
+        num_intv = 0;
+        t = timer_now();
+        for (i = 0; i < conf.num_iter && !bench_timeout(t, i); i++) {
+                bbox_to_intv_sfc(&q_tab[i % NUM_QUERY], ssd->max_dim,
+                                 sfc_morton, &i_tab, &n);
+                num_intv += n;
+                free(i_tab);
+        }
+        bench_report("bbox_to_intv (z-order)", i, timer_now() - t, 0);
+        printf("    %.1f intervals per box\n", (double) num_intv / i);
+
+        return 0;
+}
+
+static int bench_ssd_hash(enum sspace_hash_version hash_version, const char *name)
+{
+        struct sspace *ssd;
+        struct dht_entry **de_tab;
+        char str[64];
+        double t;
+        int i, num_query;
+
+        ssd = ssd_alloc(&domain, conf.num_servers, conf.num_versions,
+                        hash_version);
+        if (!ssd)
+                return -ENOMEM;
+
+        de_tab = malloc(sizeof(*de_tab) * ssd->dht->num_entries);
+        if (!de_tab) {
+                ssd_free(ssd);
+                return -ENOMEM;
+        }
+
+        if (hash_version == ssd_hash_version_v1)
+                bench_bbox_to_intv(ssd);
+
+        /* First pass misses the SFC hash cache, the others hit. */
+        t = timer_now();
+        for (i = 0; i < NUM_QUERY && !bench_timeout(t, i); i++)
+                ssd_hash(ssd, &q_tab[i], de_tab);
+        num_query = i;
+        sprintf(str, "%s (miss)", name);
+        bench_report(str, num_query, timer_now() - t, 0);
+
+        t = timer_now();
+        for (i = 0; i < conf.num_iter && !bench_timeout(t, i); i++)
+                ssd_hash(ssd, &q_tab[i % num_query], de_tab);
+        sprintf(str, "%s (cached)", name);
+        bench_report(str, i, timer_now() - t, 0);
+
+        printf("    cache hits %llu misses %llu\n",
+               (unsigned long long) ssd->sh_tab.num_hit,
+               (unsigned long long) ssd->sh_tab.num_miss);
+
+        free(de_tab);
+        ssd_free(ssd);
+        return 0;
+}
+
+static int bench_dht(void)
+{
+        struct sspace *ssd;
+        struct dht_entry *de;
+        struct obj_descriptor odsc;
+        const struct obj_descriptor **podsc;
+        uint64_t num_match = 0;
+        double t;
+        int i, v, err = -ENOMEM;
+
+        ssd = ssd_alloc(&domain, 1, conf.num_versions, ssd_hash_version_v1);
+        if (!ssd)
+                return err;
+        de = ssd->dht->ent_tab[0];
+
+        podsc = malloc(sizeof(*podsc) * (num_bb + 1));
+        if (!podsc)
+                goto out;
+
+        t = timer_now();
+        for (v = 0; v < conf.num_versions; v++) {
+                for (i = 0; i < num_bb; i++) {
+                        odsc_init(&odsc, &bb_tab[i], v);
+                        err = dht_add_entry(de, &odsc);
+                        if (err < 0)
+                                goto out;
+                }
+        }
+        bench_report("dht_add_entry", (uint64_t) num_bb * conf.num_versions,
+                     timer_now() - t, 0);
+
+        t = timer_now();
+        for (i = 0; i < conf.num_iter && !bench_timeout(t, i); i++) {
+                odsc_init(&odsc, &q_tab[i % NUM_QUERY], i % conf.num_versions);
+                num_match += dht_find_entry_all(de, &odsc, podsc);
+        }
+        bench_report("dht_find_entry_all", i, timer_now() - t, 0);
+        printf("    %.1f descriptors per query, %d stored\n",
+               (double) num_match / i, de->odsc_num);
+
+        err = 0;
+ out:
+        free(podsc);
+        ssd_free(ssd);
+        return err;
+}
+
+static int bench_ls(void)
+{
+        struct ss_storage *ls;
+        struct obj_descriptor odsc;
+        struct obj_data *od;
+        uint64_t num_found = 0;
+        double t;
+        int i, v;
+
+        ls = ls_alloc(conf.num_versions);
+        if (!ls)
+                return -ENOMEM;
+
+        t = timer_now();
+        for (v = 0; v < conf.num_versions; v++) {
+                for (i = 0; i < num_bb; i++) {
+                        odsc_init(&odsc, &bb_tab[i], v);
+                        od = obj_data_alloc_no_data(&odsc, NULL);
+                        if (!od) {
+                                ls_free(ls);
+                                return -ENOMEM;
+                        }
+                        ls_add_obj(ls, od);
+                }
+        }
+        bench_report("ls_add_obj", (uint64_t) num_bb * conf.num_versions,
+                     timer_now() - t, 0);
+
+        t = timer_now();
+        for (i = 0; i < conf.num_iter && !bench_timeout(t, i); i++) {
+                odsc_init(&odsc, &q_tab[i % NUM_QUERY], i % conf.num_versions);
+                if (ls_find(ls, &odsc))
+                        num_found++;
+        }
+        bench_report("ls_find", i, timer_now() - t, 0);
+        printf("    %llu of %d queries found, %d stored\n",
+               (unsigned long long) num_found, i, ls->num_obj);
+
+        ls_free(ls);
+        return 0;
+}
+
+static int bench_copy_one(const char *name, struct obj_data *from,
+                          const struct bbox *bb)
+{
+        struct obj_descriptor odsc;
+        struct obj_data *to;
+        int i, num_iter;
+        double t;
+
+        odsc_init(&odsc, bb, 0);
+        to = obj_data_alloc(&odsc);
+        if (!to)
+                return -ENOMEM;
+
+        /* Copies are much longer than lookups. */
+        num_iter = conf.num_iter / 1000;
+        if (num_iter < 10)
+                num_iter = 10;
+
+        ssd_copy(to, from);
+        t = timer_now();
+        for (i = 0; i < num_iter && !bench_timeout(t, i); i++)
+                ssd_copy(to, from);
+        bench_report(name, i, timer_now() - t, obj_data_size(&odsc) * i);
+
+        obj_data_free(to);
+        return 0;
+}
+
+static int bench_copy(void)
+{
+        struct obj_descriptor odsc;
+        struct obj_data *from;
+        struct bbox bb;
+        int k, err;
+
+        odsc_init(&odsc, &bb_tab[0], 0);
+        from = obj_data_alloc(&odsc);
+        if (!from)
+                return -ENOMEM;
+        memset(from->data, 1, obj_data_size(&odsc));
+
+        err = bench_copy_one("ssd_copy (block)", from, &bb_tab[0]);
+        if (err < 0)
+                goto out;
+
+        /* Half of the block along the fastest dimension. */
+        bb = bb_tab[0];
+        bb.ub.c[0] = bb.lb.c[0] + (bb.ub.c[0] - bb.lb.c[0]) / 2;
+        err = bench_copy_one("ssd_copy (half rows)", from, &bb);
+        if (err < 0)
+                goto out;
+
+        /* Half of the block along the slowest dimension. */
+        bb = bb_tab[0];
+        k = conf.ndim - 1;
+        bb.ub.c[k] = bb.lb.c[k] + (bb.ub.c[k] - bb.lb.c[k]) / 2;
+        err = bench_copy_one("ssd_copy (half slab)", from, &bb);
+ out:
+        obj_data_free(from);
+        return err;
+}
+
+#ifdef DS_HAVE_DIMES
+#define NUM_DIMES_BUF   64
+
+static int bench_dimes_buffer(void)
+{
+        void *base, *ptr_tab[NUM_DIMES_BUF];
+        size_t size, buf_size = block_size() * conf.size_elem * NUM_DIMES_BUF;
+        double t;
+        int i, n;
+
+        base = malloc(buf_size);
+        if (!base)
+                return -ENOMEM;
+        dimes_buffer_init(base, buf_size);
+        memset(ptr_tab, 0, sizeof(ptr_tab));
+
+        t = timer_now();
+        for (i = 0; i < conf.num_iter && !bench_timeout(t, i); i++) {
+                n = rand() % NUM_DIMES_BUF;
+                if (ptr_tab[n]) {
+                        dimes_buffer_free(ptr_tab[n]);
+                        ptr_tab[n] = NULL;
+                } else {
+                        size = (rand() % block_size() + 1) * conf.size_elem;
+                        dimes_buffer_alloc(size, &ptr_tab[n]);
+                }
+        }
+        bench_report("dimes_buffer_alloc/free", i, timer_now() - t, 0);
+
+        for (n = 0; n < NUM_DIMES_BUF; n++)
+                if (ptr_tab[n])
+                        dimes_buffer_free(ptr_tab[n]);
+        dimes_buffer_finalize();
+        free(base);
+        return 0;
+}
+#endif
+
+static void usage(const char *prog)
+{
+        printf("Usage: %s [-d ndim] [-n domain size] [-b blocks per dim] "
+               "[-v versions] [-s servers] [-e element size] "
+               "[-i iterations] [-t seconds per benchmark]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+        int opt, err;
+
+        while ((opt = getopt(argc, argv, "d:n:b:v:s:e:i:t:h")) != -1) {
+                switch (opt) {
+                case 'd':
+                        conf.ndim = atoi(optarg);
+                        break;
+                case 'n':
+                        conf.dim_size = strtoull(optarg, NULL, 10);
+                        break;
+                case 'b':
+                        conf.num_blocks = atoi(optarg);
+                        break;
+                case 'v':
+                        conf.num_versions = atoi(optarg);
+                        break;
+                case 's':
+                        conf.num_servers = atoi(optarg);
+                        break;
+                case 'e':
+                        conf.size_elem = atoi(optarg);
+                        break;
+                case 'i':
+                        conf.num_iter = atoi(optarg);
+                        break;
+                case 't':
+                        conf.max_time = atof(optarg);
+                        break;
+                default:
+                        usage(argv[0]);
+                        return opt == 'h' ? 0 : 1;
+                }
+        }
+
+        if (conf.ndim < 1 || conf.ndim > BBOX_MAX_NDIM ||
+            conf.num_blocks < 1 || conf.dim_size < conf.num_blocks ||
+            conf.num_versions < 1 || conf.num_servers < 1 ||
+            conf.size_elem < 1 || conf.num_iter < 1 || conf.max_time <= 0) {
+                usage(argv[0]);
+                return 1;
+        }
+
+        err = bench_init();
+        if (err < 0)
+                goto err_out;
+
+        printf("ndim %d, domain %llu, %d blocks of %llu per dim, "
+               "%d versions, %d servers, element %zu bytes\n",
+               conf.ndim, (unsigned long long) conf.dim_size,
+               conf.num_blocks, (unsigned long long) block_size(),
+               conf.num_versions, conf.num_servers, conf.size_elem);
+        printf("%-28s %12s %12s %12s\n", "benchmark", "ops", "ns/op", "MB/s");
+
+        if ((err = bench_ssd_hash(ssd_hash_version_v1, "ssd_hash_v1")) < 0 ||
+            (err = bench_ssd_hash(ssd_hash_version_v2, "ssd_hash_v2")) < 0 ||
+            (err = bench_ssd_hash(ssd_hash_version_v3, "ssd_hash_v3")) < 0 ||
+            (err = bench_dht()) < 0 ||
+            (err = bench_ls()) < 0 ||
+            (err = bench_copy()) < 0)
+                goto err_out;
+#ifdef DS_HAVE_DIMES
+        err = bench_dimes_buffer();
+        if (err < 0)
+                goto err_out;
+#endif
+
+        free(bb_tab);
+        return 0;
+ err_out:
+        uloga("'%s()': failed with %d.\n", __func__, err);
+        return 1;
+}
@@ -2333,6 +2333,11 @@ struct msg_buf *msg_buf_alloc (struct rpc_server *rpc_s, const struct node_id *p
 	return msg;
 }
 
+void msg_buf_free(struct msg_buf *msg)
+{
+	free(msg);
+}
+
 //message/data transfer functions
 /*
   Generic interface to send a rpc message to a remote node; peer is subject to flow control.
@@ -1631,6 +1631,11 @@ struct msg_buf *msg_buf_alloc(struct rpc_server *rpc_s, const struct node_id *pe
 	return msg;
 }
 
+void msg_buf_free(struct msg_buf *msg)
+{
+	free(msg);
+}
+
 void rpc_add_service(enum cmd_type rpc_cmd, rpc_service rpc_func)	//Done
 {
 	rpc_commands[num_service].rpc_cmd = rpc_cmd;
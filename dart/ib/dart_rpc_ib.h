@@ -409,6 +409,13 @@ enum cmd_type {
 	ss_code_put,
 	ss_code_reply,
 	cp_remove,
+	ss_obj_get_fwd,
+	ss_obj_get_ack,
+	ss_obj_get_data,
+	ss_obj_cache_inval,
+	ss_obj_put_batch,
+	ss_obj_update_batch,
+	ss_obj_get_batch,
 #ifdef DS_HAVE_DIMES
 	dimes_ss_info_msg,
 	dimes_locate_data_msg,
@@ -522,6 +529,7 @@ void rpc_report_md_usage(struct rpc_server *rpc_s);
 void rpc_mem_info_cache(struct node_id *peer, struct msg_buf *msg, struct rpc_cmd *cmd);
 void rpc_mem_info_reset(struct node_id *peer, struct msg_buf *msg, struct rpc_cmd *cmd);
 struct msg_buf *msg_buf_alloc(struct rpc_server *rpc_s, const struct node_id *peer, int num_rpcs);
+void msg_buf_free(struct msg_buf *msg);
 
 void rpc_print_connection_err(struct rpc_server *rpc_s, struct node_id *peer, struct rdma_cm_event event);
 
@@ -0,0 +1,119 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "mempool.h"
+#include "debug.h"
+
+/* Max number of pools with per-thread free lists */
+#define MEM_POOL_MAX 16
+
+struct mem_pool_cache {
+    void *head;
+    int num;
+};
+
+static struct mem_pool *pool_tab[MEM_POOL_MAX];
+static int num_pool = 0;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+
+static __thread struct mem_pool_cache pool_cache[MEM_POOL_MAX];
+static __thread int f_pool_cache_init = 0;
+
+/* Release the objects cached by a thread when it exits */
+static void pool_cache_free(void *arg) {
+    struct mem_pool_cache *cache = arg;
+    int i;
+
+    for (i = 0; i < MEM_POOL_MAX; ++i) {
+        while (cache[i].head != NULL) {
+            void *p = cache[i].head;
+            cache[i].head = *(void **)p;
+            free(p);
+        }
+        cache[i].num = 0;
+    }
+}
+
+static void pool_key_create(void) {
+    pthread_key_create(&pool_key, pool_cache_free);
+}
+
+static int mem_pool_register(struct mem_pool *mp) {
+    pthread_mutex_lock(&pool_lock);
+    if (mp->id < 0 && num_pool < MEM_POOL_MAX) {
+        pool_tab[num_pool] = mp;
+        __sync_synchronize();
+        mp->id = num_pool++;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return mp->id;
+}
+
+/* Free list of the calling thread, or NULL if the pool has none */
+static struct mem_pool_cache *mem_pool_cache(struct mem_pool *mp) {
+    int id = mp->id;
+
+    if (id < 0) {
+        id = mem_pool_register(mp);
+        if (id < 0) {
+            return NULL;
+        }
+    }
+    if (!f_pool_cache_init) {
+        pthread_once(&pool_key_once, pool_key_create);
+        pthread_setspecific(pool_key, pool_cache);
+        f_pool_cache_init = 1;
+    }
+    return &pool_cache[id];
+}
+
+void *mem_pool_alloc(struct mem_pool *mp) {
+    struct mem_pool_cache *cache = mem_pool_cache(mp);
+    void *p;
+
+    __sync_fetch_and_add(&mp->num_alloc, 1);
+    if (cache != NULL && cache->head != NULL) {
+        p = cache->head;
+        cache->head = *(void **)p;
+        --cache->num;
+        __sync_fetch_and_add(&mp->num_reuse, 1);
+        return p;
+    }
+    return malloc(mp->size);
+}
+
+void mem_pool_free(struct mem_pool *mp, void *p) {
+    struct mem_pool_cache *cache;
+
+    if (p == NULL) {
+        return;
+    }
+
+    __sync_fetch_and_add(&mp->num_free, 1);
+    cache = mem_pool_cache(mp);
+    if (cache != NULL && cache->num < mp->max_free) {
+        *(void **)p = cache->head;
+        cache->head = p;
+        ++cache->num;
+        return;
+    }
+    __sync_fetch_and_add(&mp->num_release, 1);
+    free(p);
+}
+
+void mem_pool_print_stats(void) {
+    int i;
+
+    pthread_mutex_lock(&pool_lock);
+    for (i = 0; i < num_pool; ++i) {
+        struct mem_pool *mp = pool_tab[i];
+        uloga("mem_pool %-16s size %6zu alloc %10llu reuse %10llu "
+            "free %10llu release %10llu\n", mp->name, mp->size,
+            (unsigned long long)mp->num_alloc, (unsigned long long)mp->num_reuse,
+            (unsigned long long)mp->num_free, (unsigned long long)mp->num_release);
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
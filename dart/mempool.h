@@ -0,0 +1,38 @@
+#ifndef __MEMPOOL_H_
+#define __MEMPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  Pool of fixed-size objects for the structures the RPC paths allocate
+  and free at high rates. Freed objects are kept on a free list of the
+  calling thread (at most max_free of them) and reused by the next
+  allocation on that thread. Each object is a malloc() block of its
+  own, so an object from a pool may still be released with free().
+*/
+struct mem_pool {
+    const char *name;
+    size_t size;
+    int max_free;
+
+    /* Index of the per-thread free lists, assigned on first use. */
+    int id;
+
+    /* Statistics, updated atomically. */
+    uint64_t num_alloc;     /* allocations */
+    uint64_t num_reuse;     /* allocations served from a free list */
+    uint64_t num_free;      /* objects returned to the pool */
+    uint64_t num_release;   /* returned objects passed on to free() */
+};
+
+#define MEM_POOL_INIT(n, s, m) \
+    { .name = (n), .size = (s), .max_free = (m), .id = -1 }
+
+void *mem_pool_alloc(struct mem_pool *mp);
+void mem_pool_free(struct mem_pool *mp, void *p);
+
+/* Print the statistics of every pool used so far to stderr. */
+void mem_pool_print_stats(void);
+
+#endif
@@ -3,12 +3,16 @@
 #include <inttypes.h>
 #include <ifaddrs.h>
 #include <net/if.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "dart_rpc_tcp.h"
 #include "debug.h"
+#include "mempool.h"
 
 /* It may be better to store these values in rpc_server struct */
 /* Best size of bytes to be written in a single socket write call */
@@ -16,6 +20,16 @@ static uint64_t socket_best_write_size = 16384;
 /* Best size of bytes to be read in a single socket read call */
 static uint64_t socket_best_read_size = 87380;
 
+/* Max number of ready sockets handled by one rpc_process_event() call */
+#define RPC_EPOLL_MAX_EVENTS 64
+/* Max number of buffers gathered from a peer's send queue per sendmsg() */
+#define RPC_SENDV_MAX_IOV 64
+
+/* Message buffers with up to one RPC command come from a pool */
+#define MSG_BUF_POOL_SIZE (sizeof(struct msg_buf) + sizeof(struct rpc_cmd) + 7)
+static struct mem_pool msg_buf_pool = MEM_POOL_INIT("msg_buf", MSG_BUF_POOL_SIZE, 256);
+static struct mem_pool rpc_request_pool = MEM_POOL_INIT("rpc_request", sizeof(struct rpc_request), 256);
+
 static uint64_t str_to_uint64(const char *s) {
     uint64_t res = 0;
     while (*s != '\0') {
@@ -172,13 +186,13 @@ static int rpc_cb_request_posted(struct rpc_server *rpc_s, struct rpc_request *r
             goto err_out;
         }
     }
-    free(request);
+    mem_pool_free(&rpc_request_pool, request);
     request = NULL;
     return 0;
 
     err_out:
     if (request != NULL) {
-        free(request);
+        mem_pool_free(&rpc_request_pool, request);
     }
     return -1;
 }
@@ -235,6 +249,12 @@ struct rpc_server* rpc_server_init(const char *interface, int app_num_peers, voi
     rpc_s->thread_alive = 0; /* Should be set to 1 before creating the thread */
     rpc_s->dart_ref = dart_ref;
 
+    rpc_s->epollfd = epoll_create1(0);
+    if (rpc_s->epollfd < 0) {
+        printf("[%s]: create epoll instance failed!\n", __func__);
+        goto err_out;
+    }
+
     if (rpc_server_init_socket(rpc_s) < 0) {
         printf("[%s]: initialize socket for RPC server failed!\n", __func__);
         goto err_out;
@@ -253,6 +273,9 @@ struct rpc_server* rpc_server_init(const char *interface, int app_num_peers, voi
 
     err_out:
     if (rpc_s != NULL) {
+        if (rpc_s->epollfd >= 0) {
+            close(rpc_s->epollfd);
+        }
         free(rpc_s);
     }
     return NULL;
@@ -355,15 +378,239 @@ int rpc_connect(struct rpc_server *rpc_s, struct node_id *peer) {
         goto err_out;
     }
     peer->f_connected = 1;
+    if (rpc_register_peer(rpc_s, peer) < 0) {
+        printf("[%s]: register peer %d for event processing failed!\n", __func__, peer->ptlmap.id);
+        goto err_out;
+    }
     return 0;
 
     err_out:
     if (peer->sockfd >= 0) {
         close(peer->sockfd);
     }
+    peer->f_connected = 0;
     return -1;
 }
 
+/* Epoll data for a peer: its id in the high word, its socket in the low word */
+static uint64_t rpc_peer_key(const struct node_id *peer) {
+    return ((uint64_t)(uint32_t)peer->ptlmap.id << 32) | (uint32_t)peer->sockfd;
+}
+
+/*
+  Add the socket of a connected peer to the epoll set. The peer id is
+  stored next to the socket so the peer can be found again even after
+  the peer table is reallocated (see dc_base_tcp.c).
+*/
+int rpc_register_peer(struct rpc_server *rpc_s, struct node_id *peer) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u64 = rpc_peer_key(peer);
+    peer->f_want_write = 0;
+    /* RPCs are small and latency bound, do not let Nagle hold them back */
+    int one = 1;
+    setsockopt(peer->sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (epoll_ctl(rpc_s->epollfd, EPOLL_CTL_ADD, peer->sockfd, &ev) < 0) {
+        printf("[%s]: add socket of peer %d to epoll set failed!\n", __func__, peer->ptlmap.id);
+        goto err_out;
+    }
+    return 0;
+
+    err_out:
+    return -1;
+}
+
+/* Map a ready socket back to its peer: try the recorded id first, then scan. */
+static struct node_id *rpc_lookup_peer(struct rpc_server *rpc_s, uint64_t key) {
+    int id = (int)(uint32_t)(key >> 32);
+    int sockfd = (int)(uint32_t)key;
+    struct node_id *peer;
+    int i;
+
+    if (id >= 0 && id < rpc_s->num_peers) {
+        peer = &rpc_s->peer_tab[id];
+        if (peer->f_connected && peer->sockfd == sockfd) {
+            return peer;
+        }
+    }
+    for (i = 0; i < rpc_s->num_peers; ++i) {
+        peer = &rpc_s->peer_tab[i];
+        if (peer->f_connected && peer->sockfd == sockfd) {
+            return peer;
+        }
+    }
+    return NULL;
+}
+
+/* Ask (or stop asking) the event loop to tell us when `peer` is writable */
+static int rpc_peer_watch_write(struct rpc_server *rpc_s, struct node_id *peer, int f_write) {
+    struct epoll_event ev;
+
+    if (peer->f_want_write == f_write) {
+        return 0;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | (f_write ? EPOLLOUT : 0);
+    ev.data.u64 = rpc_peer_key(peer);
+    if (epoll_ctl(rpc_s->epollfd, EPOLL_CTL_MOD, peer->sockfd, &ev) < 0) {
+        printf("[%s]: update epoll events for peer %d failed!\n", __func__, peer->ptlmap.id);
+        return -1;
+    }
+    peer->f_want_write = f_write;
+    return 0;
+}
+
+/*
+  Account `n` written bytes against the head of the request. Returns
+  the number of bytes that belong to the following requests.
+*/
+static size_t rpc_request_consume(struct rpc_request *request, size_t n) {
+    while (request->iovcnt > 0) {
+        if (n < request->iov->iov_len) {
+            request->iov->iov_base = (char *)request->iov->iov_base + n;
+            request->iov->iov_len -= n;
+            return 0;
+        }
+        n -= request->iov->iov_len;
+        request->iov->iov_len = 0;
+        ++request->iov;
+        --request->iovcnt;
+    }
+    return n;
+}
+
+/* Complete every request still queued for a peer whose connection failed */
+static void peer_abort_send_list(struct rpc_server *rpc_s, struct node_id *peer) {
+    struct rpc_request *request, *t;
+    LIST_HEAD(done);
+
+    list_for_each_entry_safe(request, t, &peer->req_list, struct rpc_request, req_entry) {
+        list_del(&request->req_entry);
+        list_add_tail(&request->req_entry, &done);
+    }
+    peer->num_req = 0;
+    list_for_each_entry_safe(request, t, &done, struct rpc_request, req_entry) {
+        list_del(&request->req_entry);
+        printf("[%s]: drop %s for peer %d.\n", __func__,
+            request->data != NULL ? "RPC request" : "direct send", peer->ptlmap.id);
+        (*request->cb)(rpc_s, request);
+    }
+}
+
+/*
+  Write out as much of the peer's send queue as the socket takes. The
+  head requests are gathered into a single sendmsg(); fully written
+  requests are completed in order. Returns 1 when the socket would
+  block (only in non-blocking mode), 0 when the queue is empty and -1
+  on error.
+*/
+static int peer_process_send_list(struct rpc_server *rpc_s, struct node_id *peer, int f_blocking) {
+    struct iovec iov[RPC_SENDV_MAX_IOV];
+    struct msghdr mh;
+    struct rpc_request *request, *t;
+
+    while (!list_empty(&peer->req_list)) {
+        LIST_HEAD(done);
+        int iovcnt = 0;
+        int i;
+
+        list_for_each_entry(request, &peer->req_list, struct rpc_request, req_entry) {
+            for (i = 0; i < request->iovcnt && iovcnt < RPC_SENDV_MAX_IOV; ++i) {
+                iov[iovcnt++] = request->iov[i];
+            }
+            if (iovcnt == RPC_SENDV_MAX_IOV) {
+                break;
+            }
+        }
+
+        ssize_t n = 0;
+        if (iovcnt > 0) {
+            memset(&mh, 0, sizeof(mh));
+            mh.msg_iov = iov;
+            mh.msg_iovlen = iovcnt;
+            n = sendmsg(peer->sockfd, &mh, MSG_NOSIGNAL | (f_blocking ? 0 : MSG_DONTWAIT));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return 1;
+                }
+                printf("[%s]: send to peer %d failed!\n", __func__, peer->ptlmap.id);
+                peer_abort_send_list(rpc_s, peer);
+                return -1;
+            }
+        }
+
+        /* Move the requests that are now fully written out of the queue
+           before running any callback, they may post new requests. */
+        list_for_each_entry_safe(request, t, &peer->req_list, struct rpc_request, req_entry) {
+            n = (ssize_t)rpc_request_consume(request, (size_t)n);
+            if (request->iovcnt > 0) {
+                break;
+            }
+            list_del(&request->req_entry);
+            list_add_tail(&request->req_entry, &done);
+            --peer->num_req;
+        }
+        list_for_each_entry_safe(request, t, &done, struct rpc_request, req_entry) {
+            list_del(&request->req_entry);
+            if ((*request->cb)(rpc_s, request) < 0) {
+                printf("[%s]: call request callback function failed!\n", __func__);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+  Queue a request at the tail of the peer's send list and push out
+  whatever the socket accepts right now; the rest is written from
+  rpc_process_event() when the socket becomes writable again.
+*/
+static int peer_post_request(struct rpc_server *rpc_s, struct node_id *peer, struct rpc_request *request) {
+    list_add_tail(&request->req_entry, &peer->req_list);
+    ++peer->num_req;
+
+    int ret = peer_process_send_list(rpc_s, peer, 0);
+    if (ret < 0) {
+        printf("[%s]: process send list for peer %d failed!\n", __func__, peer->ptlmap.id);
+        return 0;
+    }
+    if (rpc_peer_watch_write(rpc_s, peer, ret == 1) < 0) {
+        /* Without write events the queue only drains on the next post */
+        printf("[%s]: peer %d send queue may stall!\n", __func__, peer->ptlmap.id);
+    }
+    return 0;
+}
+
+static struct rpc_request *rpc_request_alloc(struct msg_buf *msg) {
+    struct rpc_request *request = (struct rpc_request *)mem_pool_alloc(&rpc_request_pool);
+    if (request == NULL) {
+        printf("[%s]: allocate request failed!\n", __func__);
+        return NULL;
+    }
+
+    memset(request, 0, sizeof(*request));
+    request->msg = msg;
+    request->iov = request->iov_buf;
+    request->cb = (request_callback)rpc_cb_request_posted;
+    return request;
+}
+
+/* Flush everything queued for a peer, waiting for the socket if needed */
+int rpc_peer_flush(struct rpc_server *rpc_s, struct node_id *peer) {
+    if (!peer->f_connected || list_empty(&peer->req_list)) {
+        return 0;
+    }
+
+    int ret = peer_process_send_list(rpc_s, peer, 1);
+    rpc_peer_watch_write(rpc_s, peer, 0);
+    return ret;
+}
+
 static int rpc_process_cmd(struct rpc_server *rpc_s, struct rpc_cmd *cmd) {
     ulog("[%s]: peer %d (%s) will process RPC command %d from %d.\n", __func__,
         rpc_s->ptlmap.id, rpc_s->cmp_type == DART_SERVER ? "server" : "client", (int)cmd->cmd, cmd->id);
@@ -422,14 +669,49 @@ err_out:
 }
 
 int rpc_process_event(struct rpc_server *rpc_s) {
-    int i;
-    for (i = 0; i < rpc_s->num_peers; ++i) {
-        struct node_id *peer = &rpc_s->peer_tab[i];
-        if (!peer->f_connected) {
-            /* Not connected yet, no need for processing event */
+    struct epoll_event events[RPC_EPOLL_MAX_EVENTS];
+    int i, n;
+
+    n = epoll_wait(rpc_s->epollfd, events, RPC_EPOLL_MAX_EVENTS, 0);
+    if (n < 0) {
+        if (errno != EINTR) {
+            printf("[%s]: wait for socket events failed!\n", __func__);
+        }
+        return 0;
+    }
+
+    for (i = 0; i < n; ++i) {
+        struct node_id *peer = rpc_lookup_peer(rpc_s, events[i].data.u64);
+        int sockfd = (int)(uint32_t)events[i].data.u64;
+        int count = 0;
+
+        if (peer == NULL) {
+            /* Socket is not owned by any peer any more */
+            epoll_ctl(rpc_s->epollfd, EPOLL_CTL_DEL, sockfd, NULL);
             continue;
         }
 
+        if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            /* Remote side closed; drain what is left and stop watching */
+            ioctl(sockfd, FIONREAD, &count);
+            if (count == 0) {
+                peer_abort_send_list(rpc_s, peer);
+                epoll_ctl(rpc_s->epollfd, EPOLL_CTL_DEL, sockfd, NULL);
+                continue;
+            }
+        }
+
+        if (events[i].events & EPOLLOUT) {
+            /* Resume a partially written send queue */
+            int ret = peer_process_send_list(rpc_s, peer, 0);
+            if (ret >= 0) {
+                rpc_peer_watch_write(rpc_s, peer, ret == 1);
+            }
+        }
+
+        if (!(events[i].events & EPOLLIN)) {
+            continue;
+        }
         if (rpc_process_event_peer(rpc_s, peer) < 0) {
             printf("[%s]: process event for peer %d failed, skip!\n", __func__, peer->ptlmap.id);
             continue;
@@ -448,148 +730,127 @@ int rpc_barrier(struct rpc_server *rpc_s, void *comm) {
     return 0;
 }
 
-static int rpc_post_request(struct rpc_server *rpc_s, struct node_id *peer, struct rpc_request *request) {
-    if (socket_send_bytes(peer->sockfd, (char *)request->data, (uint64_t)request->size) < 0) {
-        printf("[%s]: send RPC request to peer %d failed!\n", __func__, peer->ptlmap.id);
-        goto err_out;
-    }
-
-    if (request->iodir == io_send) {
-        if (socket_send_bytes(peer->sockfd, (char *)request->msg->msg_data, (uint64_t)request->msg->size) < 0) {
-            printf("[%s]: send to peer %d directly failed!\n", __func__, peer->ptlmap.id);
-            goto err_out;
-        }
-    } else if (request->iodir == io_receive) {
-        if (socket_recv_bytes(peer->sockfd, (char *)request->msg->msg_data, (uint64_t)request->msg->size, 1) < 0) {
-            printf("[%s]: receive from peer %d directly failed!\n", __func__, peer->ptlmap.id);
-            goto err_out;
-        }
+int rpc_send(struct rpc_server *rpc_s, struct node_id *peer, struct msg_buf *msg) {
+    if (!peer->f_connected) {
+        rpc_connect(rpc_s, peer);
     }
-
-    if (request->cb == NULL) {
-        printf("[%s]: request doesn't have a callback function, may cause memory leak!\n", __func__);
+    if (!peer->f_connected) {
+        printf("[%s]: peer %d is not connected!\n", __func__, peer->ptlmap.id);
         goto err_out;
     }
 
-    if ((*request->cb)(rpc_s, request) < 0) {
-        printf("[%s]: call request callback function failed!\n", __func__);
-        return -1;
-    }
-    return 0;
-
-    err_out:
-    if (request->msg != NULL) {
-        if (request->msg->msg_data != NULL) {
-            free(request->msg->msg_data);
-        }
-        free(request->msg);
+    struct rpc_request *request = rpc_request_alloc(msg);
+    if (request == NULL) {
+        goto err_out;
     }
-    free(request);
-    return -1;
-}
 
-static int peer_process_send_list(struct rpc_server *rpc_s, struct node_id *peer) {
-    while (!list_empty(&peer->req_list)) {
-        struct rpc_request *request = list_entry(peer->req_list.next, struct rpc_request, req_entry);
-        request->msg->msg_rpc->id = rpc_s->ptlmap.id;
-        list_del(&request->req_entry);
-
-        if (rpc_post_request(rpc_s, peer, request) < 0) {
-            printf("[%s]: post RPC request for peer %d failed!\n", __func__, peer->ptlmap.id);
-            goto err_out;
-        }
+    /* TODO: should serialize data */
+    msg->msg_rpc->id = rpc_s->ptlmap.id;
+    request->iodir = io_send;
+    request->data = msg->msg_rpc;
+    request->size = sizeof(*msg->msg_rpc);
+    /* The command header and its payload go out in a single write */
+    request->iov_buf[0].iov_base = request->data;
+    request->iov_buf[0].iov_len = request->size;
+    request->iovcnt = 1;
+    if (msg->size > 0) {
+        request->iov_buf[1].iov_base = msg->msg_data;
+        request->iov_buf[1].iov_len = msg->size;
+        request->iovcnt = 2;
     }
-    return 0;
+    return peer_post_request(rpc_s, peer, request);
 
     err_out:
     return -1;
 }
 
-int rpc_send(struct rpc_server *rpc_s, struct node_id *peer, struct msg_buf *msg) {
+int rpc_send_direct(struct rpc_server *rpc_s, struct node_id *peer, struct msg_buf *msg) {
     if (!peer->f_connected) {
-        rpc_connect(rpc_s, peer);
+        printf("[%s]: cannot send to an unconnected peer directly!\n", __func__);
+        goto err_out;
     }
 
-    struct rpc_request *request = (struct rpc_request *)malloc(sizeof(struct rpc_request));
+    struct rpc_request *request = rpc_request_alloc(msg);
     if (request == NULL) {
-        printf("[%s]: allocate request failed!\n", __func__);
         goto err_out;
     }
 
     /* TODO: should serialize data */
-    request->msg = msg;
     request->iodir = io_send;
-    request->data = msg->msg_rpc;
-    request->size = sizeof(*msg->msg_rpc);
-    request->cb = (request_callback)rpc_cb_request_posted;
-    list_add(&request->req_entry, &peer->req_list);
-    if (peer_process_send_list(rpc_s, peer) < 0) {
-        printf("[%s]: process send list for peer %d failed!\n", __func__, peer->ptlmap.id);
-        goto err_out;
-    }
-    return 0;
+    request->iov_buf[0].iov_base = msg->msg_data;
+    request->iov_buf[0].iov_len = msg->size;
+    request->iovcnt = (msg->size > 0);
+    return peer_post_request(rpc_s, peer, request);
 
     err_out:
-    /* Request will be free in callback function */
     return -1;
 }
 
-int rpc_send_direct(struct rpc_server *rpc_s, struct node_id *peer, struct msg_buf *msg) {
+/*
+  Send a vector of buffers directly, with no RPC header: msg->msg_data
+  points to an array of iovec_t entries and msg->size is the number of
+  entries. The segments are written back to back, so the receiver sees
+  the same byte stream as with rpc_send_direct() on a packed buffer.
+  The array is consumed while the send progresses; release it in the
+  completion callback.
+*/
+int rpc_send_directv(struct rpc_server *rpc_s, struct node_id *peer, struct msg_buf *msg) {
     if (!peer->f_connected) {
         printf("[%s]: cannot send to an unconnected peer directly!\n", __func__);
         goto err_out;
     }
 
-    /* TODO: should serialize data */
-    if (socket_send_bytes(peer->sockfd, (char *)msg->msg_data, (uint64_t)msg->size) < 0) {
-        printf("[%s]: send to peer %d directly failed!\n", __func__, peer->ptlmap.id);
+    struct rpc_request *request = rpc_request_alloc(msg);
+    if (request == NULL) {
         goto err_out;
     }
 
-    if (msg->cb != NULL) {
-        if ((*msg->cb)(rpc_s, msg) < 0) {
-            printf("[%s]: call message callback function failed!\n", __func__);
-            goto err_out;
-        }
-    }
-    return 0;
+    /* iovec_t (ss_data.h) has the same layout as struct iovec */
+    request->iodir = io_send;
+    request->iov = (struct iovec *)msg->msg_data;
+    request->iovcnt = (int)msg->size;
+    return peer_post_request(rpc_s, peer, request);
 
     err_out:
     return -1;
 }
 
-// added by Tong
-int rpc_send_directv(struct rpc_server *rpc_s, struct node_id *peer, struct msg_buf *msg) {
-
-  return 0;
-}
-
 int rpc_receive(struct rpc_server *rpc_s, struct node_id *peer, struct msg_buf *msg) {
     if (!peer->f_connected) {
         rpc_connect(rpc_s, peer);
     }
+    if (!peer->f_connected) {
+        printf("[%s]: peer %d is not connected!\n", __func__, peer->ptlmap.id);
+        goto err_out;
+    }
 
-    struct rpc_request *request = (struct rpc_request *)malloc(sizeof(struct rpc_request));
-    if (request == NULL) {
-        printf("[%s]: allocate request failed!\n", __func__);
+    /* The reply follows our command on the stream, so anything already
+       queued for this peer has to go out first. */
+    if (rpc_peer_flush(rpc_s, peer) < 0) {
+        printf("[%s]: flush send queue for peer %d failed!\n", __func__, peer->ptlmap.id);
         goto err_out;
     }
 
     /* TODO: should serialize data */
-    request->msg = msg;
-    request->iodir = io_receive;
-    request->data = msg->msg_rpc;
-    request->size = sizeof(*msg->msg_rpc);
-    request->cb = (request_callback)rpc_cb_request_posted;
-    list_add(&request->req_entry, &peer->req_list);
-    if (peer_process_send_list(rpc_s, peer) < 0) {
-        printf("[%s]: process send list for peer %d failed!\n", __func__, peer->ptlmap.id);
+    msg->msg_rpc->id = rpc_s->ptlmap.id;
+    if (socket_send_bytes(peer->sockfd, (char *)msg->msg_rpc, (uint64_t)sizeof(*msg->msg_rpc)) < 0) {
+        printf("[%s]: send RPC request to peer %d failed!\n", __func__, peer->ptlmap.id);
         goto err_out;
     }
+    if (socket_recv_bytes(peer->sockfd, (char *)msg->msg_data, (uint64_t)msg->size, 1) < 0) {
+        printf("[%s]: receive from peer %d directly failed!\n", __func__, peer->ptlmap.id);
+        goto err_out;
+    }
+
+    if (msg->cb != NULL) {
+        if ((*msg->cb)(rpc_s, msg) < 0) {
+            printf("[%s]: call message callback function failed!\n", __func__);
+        }
+    }
     return 0;
 
     err_out:
-    /* Request will be free in callback function */
+    /* msg is still owned by the caller */
     return -1;
 }
 
@@ -621,6 +882,14 @@ int rpc_receive_direct(struct rpc_server *rpc_s, struct node_id *peer, struct ms
 /* TODO: */
 int rpc_server_free(struct rpc_server *rpc_s) {
     if(rpc_s != NULL) {
+        /* Do not lose data still queued for a peer */
+        int i;
+        for (i = 0; i < rpc_s->num_peers; ++i) {
+            rpc_peer_flush(rpc_s, &rpc_s->peer_tab[i]);
+        }
+        if (rpc_s->epollfd >= 0) {
+            close(rpc_s->epollfd);
+        }
         free(rpc_s);
     }
     return 0;
@@ -628,13 +897,20 @@ int rpc_server_free(struct rpc_server *rpc_s) {
 
 struct msg_buf* msg_buf_alloc(struct rpc_server *rpc_s, const struct node_id *peer, int num_rpcs) {
     size_t size = sizeof(struct msg_buf) + sizeof(struct rpc_cmd) * num_rpcs + 7; /* 7 is for alignment padding */
-    struct msg_buf *msg = (struct msg_buf *)malloc(size);
+    struct msg_buf *msg;
+    if (num_rpcs <= 1) {
+        size = MSG_BUF_POOL_SIZE;
+        msg = (struct msg_buf *)mem_pool_alloc(&msg_buf_pool);
+    } else {
+        msg = (struct msg_buf *)malloc(size);
+    }
     if (msg == NULL) {
         printf("[%s]: allocate message failed!\n", __func__);
         goto err_out;
     }
 
     memset(msg, 0, size);
+    msg->f_pool = (num_rpcs <= 1);
     msg->peer = peer;
     msg->cb = default_completion_with_data_callback;
     if (num_rpcs > 0) {
@@ -644,10 +920,19 @@ struct msg_buf* msg_buf_alloc(struct rpc_server *rpc_s, const struct node_id *pe
     return msg;
 
     err_out:
-    if (msg != NULL) {
+    return NULL;
+}
+
+/* Release a message buffer from msg_buf_alloc(); free() also works */
+void msg_buf_free(struct msg_buf *msg) {
+    if (msg == NULL) {
+        return;
+    }
+    if (msg->f_pool) {
+        mem_pool_free(&msg_buf_pool, msg);
+    } else {
         free(msg);
     }
-    return NULL;
 }
 
 void rpc_mem_info_cache(struct node_id *peer, struct msg_buf *msg, struct rpc_cmd *cmd) {
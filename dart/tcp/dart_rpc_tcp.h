@@ -15,6 +15,7 @@ extern "C" {
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "config.h"
 #include "list.h"
@@ -119,6 +120,12 @@ struct rpc_request{
     void    *data;
     size_t  size;
 
+    /* Buffers still to be written; iov points to iov_buf or to a
+       caller supplied vector (rpc_send_directv). */
+    struct iovec iov_buf[2];
+    struct iovec *iov;
+    int     iovcnt;
+
     request_callback cb;
 };
 
@@ -137,6 +144,9 @@ struct msg_buf{
     completion_callback cb;
     void    *private;
     const struct node_id    *peer;
+
+    /* Set when allocated from the msg_buf pool. */
+    int f_pool;
 };
 
 enum rpc_component {
@@ -158,6 +168,8 @@ struct rpc_server {
     pthread_t comm_thread; /* Thread for managing connections */
     int thread_alive;
 
+    int epollfd; /* Readiness notification for all connected peer sockets */
+
     void *dart_ref; /* Points to dart_server or dart_client struct */
 };
 
@@ -177,6 +189,7 @@ struct node_id {
 
     int sockfd; /* Socket */
     int f_connected; /* Flag: if the peer is connected through `sockfd` */
+    int f_want_write; /* Flag: waiting for `sockfd` to drain `req_list` */
 };
 
 enum cmd_type { 
@@ -209,6 +222,13 @@ enum cmd_type {
     ss_obj_info,
     ss_info,
     cp_remove,
+    ss_obj_get_fwd,
+    ss_obj_get_ack,
+    ss_obj_get_data,
+    ss_obj_cache_inval,
+    ss_obj_put_batch,
+    ss_obj_update_batch,
+    ss_obj_get_batch,
 #ifdef DS_HAVE_ACTIVESPACE
     ss_code_put,
     ss_code_reply,
@@ -274,9 +294,11 @@ struct payload_unregistration_info {
     int num_cp;
 } __attribute__((__packed__));
 
+void msg_buf_free(struct msg_buf *msg);
+
 static int default_completion_callback(struct rpc_server *rpc_s, struct msg_buf *msg) {
     if (msg != NULL) {
-        free(msg);
+        msg_buf_free(msg);
     }
     return 0;
 }
@@ -286,7 +308,7 @@ static int default_completion_with_data_callback(struct rpc_server *rpc_s, struc
         if (msg->msg_data != NULL) {
             free(msg->msg_data);
         }
-        free(msg);
+        msg_buf_free(msg);
     }
     return 0;
 }
@@ -301,6 +323,8 @@ void rpc_server_set_peer_ref(struct rpc_server *rpc_s, struct node_id *peer_tab,
 int rpc_write_config(struct rpc_server *rpc_s, const char *filename);
 int rpc_read_config(struct sockaddr_in *address, const char *filename);
 int rpc_connect(struct rpc_server *rpc_s, struct node_id *peer);
+int rpc_register_peer(struct rpc_server *rpc_s, struct node_id *peer);
+int rpc_peer_flush(struct rpc_server *rpc_s, struct node_id *peer);
 int rpc_process_event(struct rpc_server *rpc_s);
 int rpc_barrier(struct rpc_server *rpc_s, void *comm);
 int rpc_send(struct rpc_server *rpc_s, struct node_id *peer, struct msg_buf *msg);
@@ -24,7 +24,7 @@ static int rpc_cb_recv_cn_register(struct rpc_server *rpc_s, struct msg_buf *msg
     dc_barrier(dc);
 
     free(msg->msg_data);
-    free(msg);
+    msg_buf_free(msg);
     return 0;
 }
 
@@ -43,6 +43,9 @@ static int rpc_handler_cn_register(struct rpc_server *rpc_s, struct rpc_cmd *cmd
         goto err_out;
     }
     memset(peer_tab, 0, size);
+    /* Queued requests are linked to the old table, write them out first */
+    rpc_peer_flush(rpc_s, &dc->peer_tab[0]);
+    rpc_peer_flush(rpc_s, &dc->peer_tab[1]);
     if (dc->peer_tab[0].f_connected) {
         peer_tab[dc->peer_tab[0].ptlmap.id] = dc->peer_tab[0];
     }
@@ -126,6 +129,9 @@ static void *dc_listen(void *client) {
         }
         peer->sockfd = sockfd_c;
         peer->f_connected = 1;
+        if (rpc_register_peer(dc->rpc_s, peer) < 0) {
+            printf("[%s]: register peer %d for event processing failed, skip!\n", __func__, peer->ptlmap.id);
+        }
     }
 }
 
@@ -142,6 +148,8 @@ static int dc_register_at_master(struct dart_client *dc, int appid) {
 
     struct node_id *peer_master = &dc->peer_tab[0];
     INIT_LIST_HEAD(&peer_master->req_list);
+    /* Slot for the server accepted in dc_listen() */
+    INIT_LIST_HEAD(&dc->peer_tab[1].req_list);
     if (rpc_read_config(&peer_master->ptlmap.address, filename_conf) < 0) {
         printf("[%s]: read RPC config file failed!\n", __func__);
         goto err_out;
@@ -193,7 +201,7 @@ static int dc_register_at_master(struct dart_client *dc, int appid) {
 
     err_out:
     if (msg != NULL) {
-        free(msg);
+        msg_buf_free(msg);
     }
     return -1;
 }
@@ -283,7 +291,7 @@ static int dc_unregister(struct dart_client *dc) {
 
     err_out:
     if (msg != NULL) {
-        free(msg);
+        msg_buf_free(msg);
     }
     return -1;
 }
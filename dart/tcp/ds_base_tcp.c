@@ -69,7 +69,7 @@ static int rpc_handler_cn_unregister(struct rpc_server *rpc_s, struct rpc_cmd *c
 
     err_out:
     if (msg != NULL) {
-        free(msg);
+        msg_buf_free(msg);
     }
     return -1;
 }
@@ -134,7 +134,7 @@ static int ds_register_cp(struct dart_server *ds) {
         if (msg->msg_data != NULL) {
             free(msg->msg_data);
         }
-        free(msg);
+        msg_buf_free(msg);
     }
     return -1;
 }
@@ -157,7 +157,7 @@ int rpc_cb_recv_sp_announce_cp(struct rpc_server *rpc_s, struct msg_buf *msg) {
     }
 
     free(msg->msg_data);
-    free(msg);
+    msg_buf_free(msg);
     return 0;
 }
 
@@ -207,7 +207,7 @@ int rpc_handler_sp_announce_cp(struct rpc_server *rpc_s, struct rpc_cmd *cmd) {
         if (msg->msg_data != NULL) {
             free(msg->msg_data);
         }
-        free(msg);
+        msg_buf_free(msg);
     }
     return -1;
 }
@@ -258,7 +258,7 @@ int ds_announce_cp(struct dart_server *ds, struct app_info *app) {
         if (msg->msg_data != NULL) {
             free(msg->msg_data);
         }
-        free(msg);
+        msg_buf_free(msg);
     }
     return -1;
 }
@@ -327,7 +327,7 @@ int rpc_cb_recv_sp_reg_reply(struct rpc_server *rpc_s, struct msg_buf *msg) {
     }
 
     free(msg->msg_data);
-    free(msg);
+    msg_buf_free(msg);
     return 0;
 }
 
@@ -368,7 +368,7 @@ int rpc_handler_sp_reg_reply(struct rpc_server *rpc_s, struct rpc_cmd *cmd) {
         if (msg->msg_data != NULL) {
             free(msg->msg_data);
         }
-        free(msg);
+        msg_buf_free(msg);
     }
     return -1;
 }
@@ -439,7 +439,7 @@ int rpc_handler_sp_reg_request(struct rpc_server *rpc_s, struct rpc_cmd *cmd) {
         if (msg->msg_data != NULL) {
             free(msg->msg_data);
         }
-        free(msg);
+        msg_buf_free(msg);
     }
     return -1;
 }
@@ -502,6 +502,9 @@ static void *ds_listen(void *server) {
         }
         peer->sockfd = sockfd_c;
         peer->f_connected = 1;
+        if (rpc_register_peer(ds->rpc_s, peer) < 0) {
+            printf("[%s]: register peer %d for event processing failed, skip!\n", __func__, peer->ptlmap.id);
+        }
     }
 }
 
@@ -570,7 +573,7 @@ int ds_boot_slave(struct dart_server *ds) {
 
     err_out:
     if (msg != NULL) {
-        free(msg);
+        msg_buf_free(msg);
     }
     return -1;
 }
@@ -61,6 +61,12 @@ struct intv {
         uint64_t lb, ub;
 };
 
+/* Space filling curves for the linearization of the domain. */
+enum sfc_curve {
+        sfc_hilbert = 0,
+        sfc_morton              /* Z-order */
+};
+
 uint64_t bbox_dist(struct bbox *, int);
 void bbox_divide(struct bbox *b0, struct bbox *b_tab);
 int bbox_include(const struct bbox *, const struct bbox *);
@@ -71,6 +77,10 @@ int bbox_equals(const struct bbox *, const struct bbox *);
 uint64_t bbox_volume(struct bbox *);
 void bbox_to_intv(const struct bbox *, uint64_t, int, struct intv **, int *);
 void bbox_to_intv2(const struct bbox *, uint64_t, int, struct intv **, int *);
+void bbox_to_intv_sfc(const struct bbox *, uint64_t, enum sfc_curve, struct intv **, int *);
+int bbox_to_intv_cap(const struct bbox *, uint64_t, enum sfc_curve, struct intv *, int, struct coord *);
+int bbox_intv_match(const struct bbox *, uint64_t, enum sfc_curve,
+                    int (*)(const struct intv *, void *), void *);
 void bbox_to_origin(struct bbox *, const struct bbox *);
 
 int intv_do_intersect(struct intv *, struct intv *);
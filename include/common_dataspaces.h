@@ -76,9 +76,33 @@ int common_dspaces_put_location_aware(const char *var_name,
         uint64_t *lb,
         uint64_t *ub,
         void *data);
+int common_dspaces_put_batch(int num_var, const char **var_name,
+        unsigned int *ver, int *size,
+        int *ndim,
+        uint64_t **lb,
+        uint64_t **ub,
+        const void **data);
+int common_dspaces_get_batch(int num_var, const char **var_name,
+        unsigned int *ver, int *size,
+        int *ndim,
+        uint64_t **lb,
+        uint64_t **ub,
+        void **data);
+struct dspaces_get_req;
+int common_dspaces_iget(const char *var_name,
+        unsigned int ver, int size,
+        int ndim,
+        uint64_t *lb,
+        uint64_t *ub,
+        void *data,
+        struct dspaces_get_req **req);
+int common_dspaces_test(struct dspaces_get_req *req, int *done);
+int common_dspaces_wait(struct dspaces_get_req *req);
+int common_dspaces_waitall(int num_req, struct dspaces_get_req **req);
 char* common_dspaces_get_latest_meta(unsigned int ver, char *name, int *nVars, int *version);
 char* common_dspaces_get_next_meta(unsigned int ver, char *name, int *nVars, int *version);
 int common_dspaces_put_sync(void);
+int common_dspaces_put_aggregate_init(void *comm);
 void common_dspaces_finalize (void);
 void common_dspaces_kill (void);
 int common_dspaces_get_num_space_peers(void);
@@ -243,6 +243,85 @@ int dspaces_get (const char *var_name,
         int ndim, uint64_t *lb, uint64_t *ub,
         void *data);
 
+/**
+ * @brief Insert a batch of data objects into the space with one request.
+ *
+ * Same as calling dspaces_put() for each object i in 0 .. num_var-1, with
+ * arguments var_name[i], ver[i], size[i], ndim[i], lb[i], ub[i] and data[i];
+ * the objects are sent together, and each server that indexes them is
+ * updated once for the whole batch. Use dspaces_put_sync() to wait for the
+ * batch to complete.
+ *
+ * @param[in] num_var:  Number of objects in the batch.
+ *
+ * @return  0 indicates success.
+ */
+int dspaces_put_batch (int num_var, const char **var_name,
+        unsigned int *ver, int *size,
+        int *ndim, uint64_t **lb, uint64_t **ub,
+        const void **data);
+
+/**
+ * @brief Retrieve a batch of data objects from the space.
+ *
+ * Same as calling dspaces_get() for each object i in 0 .. num_var-1, with
+ * arguments var_name[i], ver[i], size[i], ndim[i], lb[i], ub[i] and data[i];
+ * the queries run concurrently and share one request per server.
+ *
+ * @param[in] num_var:  Number of objects in the batch.
+ *
+ * @return  0 indicates success; -EAGAIN if an object is not available.
+ */
+int dspaces_get_batch (int num_var, const char **var_name,
+        unsigned int *ver, int *size,
+        int *ndim, uint64_t **lb, uint64_t **ub,
+        void **data);
+
+struct dspaces_get_req;
+
+/**
+ * @brief Start retrieving a data object from the space without waiting for it.
+ *
+ * Takes the same arguments as dspaces_get(). Several gets can be in flight at
+ * once; each must be completed with dspaces_test(), dspaces_wait() or
+ * dspaces_waitall(), and 'data' must not be used until then.
+ *
+ * @param[out] req:     Handle of the get.
+ *
+ * @return  0 indicates success.
+ */
+int dspaces_iget (const char *var_name,
+        unsigned int ver, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        void *data, struct dspaces_get_req **req);
+
+/**
+ * @brief Check whether a get started by dspaces_iget() is complete.
+ *
+ * @param[in] req:      Handle of the get; released once the get is complete
+ *                      or has failed.
+ * @param[out] flag:    Set to 1 if the get is complete or has failed, 0
+ *                      otherwise.
+ *
+ * @return  Result of the get, as for dspaces_get(), if it is complete.
+ */
+int dspaces_test (struct dspaces_get_req *req, int *flag);
+
+/**
+ * @brief Wait for a get started by dspaces_iget() and release its handle,
+ * also when the wait fails.
+ *
+ * @return  Result of the get, as for dspaces_get().
+ */
+int dspaces_wait (struct dspaces_get_req *req);
+
+/**
+ * @brief Wait for all the gets in 'req' and release their handles.
+ *
+ * @return  0 indicates success; otherwise the first error of the gets.
+ */
+int dspaces_waitall (int num_req, struct dspaces_get_req **req);
+
 /**
  * @brief Query the space to retrieve next available version of metadata.
  * The metadata is 1-D buffer and is variable length. It is identified
@@ -311,6 +390,21 @@ void dspaces_define_gdim (const char *var_name,
  */
 int dspaces_put_sync(void);
 
+/**
+ * @brief Merge the puts of the writers on each compute node.
+ *
+ * After this call, dspaces_put() holds the objects until dspaces_put_sync(),
+ * where the ranks of 'comm' on one node send them to a node master. The
+ * master merges adjacent blocks of the same variable and version into larger
+ * objects and puts them together. dspaces_put_sync() becomes collective over
+ * 'comm', and returns once the objects of the node are in the space.
+ *
+ * @param[in] comm:     Pointer to the MPI communicator of the writers.
+ *
+ * @return  0 indicates success.
+ */
+int dspaces_put_aggregate_init(void *comm);
+
 /**
  * @brief Get number of DataSpaces servers.
  * @return Number of space server.
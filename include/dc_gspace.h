@@ -66,6 +66,11 @@ struct dcg_space {
         struct bbox             ss_domain;
         struct global_dimension default_gdim;
 
+        /* Shared spaces to place queries on the DHT; the default one
+           and a 'struct sspace_list_entry' per other global dimension. */
+        struct sspace           *default_ssd;
+        struct list_head        sspace_list;
+
         /* List of 'struct dcg_lock' */
         struct list_head        locks_list;
         /* List of 'struct gdim_list_entry' */
@@ -74,7 +79,11 @@ struct dcg_space {
         int                     num_pending;
 
         enum sspace_hash_version    hash_version;
+        enum ds_data_placement      data_placement;
         int    max_versions; 
+        /* Versions per DHT split epoch of the default space, 0 if the
+           split does not change. */
+        int                     split_period;
         /* Version bookeeping for objects available in the space. */
         int                     num_vers;
         int                     versions[64];
@@ -86,6 +95,12 @@ void dcg_free(struct dcg_space *);
 void dcgrpc_kill(struct dcg_space *);
 int dcg_obj_put(struct obj_data *);
 int dcg_obj_get(struct obj_data *);
+int dcg_obj_put_batch(struct obj_data *[], int);
+int dcg_obj_get_batch(struct obj_data *[], int);
+struct query_tran_entry;
+int dcg_obj_iget(struct obj_data *, struct query_tran_entry **);
+int dcg_obj_test(struct query_tran_entry *, int *);
+int dcg_obj_wait(struct query_tran_entry *);
 int dcg_obj_put_to_server(struct obj_data *, int);
 int dcg_get_versions(int **);
 int dcg_obj_filter(struct obj_data *);
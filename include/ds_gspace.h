@@ -34,6 +34,8 @@
 #ifndef __DS_GSPACE_H_
 #define __DS_GSPACE_H_
 
+#include <pthread.h>
+
 #include "dart.h"
 #include "ss_data.h"
 
@@ -63,6 +65,28 @@ struct ds_gspace {
         /* List of allocated locks. */
         struct list_head        locks_list;
 
+        /* Clients caching the layout of a variable; per variable name. */
+        struct list_head        layout_watch_list;
+
+        /* Requests waiting for the DHT split of their epoch from
+           server 0. */
+        struct list_head        split_wait_list;
+
+        /* Worker threads for data and metadata queries; RPC
+           communication stays on the thread calling dsg_process(). */
+        int                     num_workers;
+        pthread_t               *workers;
+        int                     f_workers_stop;
+        pthread_mutex_t         work_lock;
+        pthread_cond_t          work_cond;
+        struct list_head        work_list;
+        struct list_head        work_done_list;
+
+        /* Guards for the state shared with the workers. */
+        pthread_rwlock_t        ls_lock;
+        pthread_rwlock_t        dht_lock;
+        pthread_mutex_t         sspace_lock;
+
         int kill;
 };
 
@@ -34,6 +34,7 @@
 
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "bbox.h"
 #include "list.h"
@@ -92,14 +93,84 @@ struct obj_data {
         /* Count how many references are to this data object. */
         int                     refcnt;
 
+        /* Entry in the resident objects of its version in the local
+           storage, most recently used first, to pick the objects to
+           spill; 'mem_ver' is NULL when the object is not listed. */
+        struct ls_mem_ver       *mem_ver;
+        struct list_head        mem_entry;
+
         /* Flag to mark if we should free this data object. */
-        unsigned int            f_free:1;
+        unsigned int            f_free:1,
+        /* Flag to mark data mapped from a spill file. */
+                                f_spilled:1,
+        /* Flag to mark data allocated from the payload arena. */
+                                f_arena:1;
+};
+
+/*
+  Spatial hash of the  objects of one variable. An  object is binned by
+  the grid cell that holds its lower corner; the cell extent is set by
+  the first object added, and 'ext' keeps the largest object extent to
+  bound the cells a query has to visit.
+*/
+struct sp_index {
+        int                     num_obj;
+        int                     ndim;
+        struct coord            cell;
+        struct coord            ext;
+
+        /* Offset of the bounding box from the list entry of an object. */
+        long                    bb_off;
+
+        int                     size_hash;
+        struct list_head        *obj_hash;
+};
+
+/*
+  Objects of one variable version, indexed by region.
+*/
+struct sp_var {
+        struct list_head        var_entry;
+
+        char                    name[sizeof(((struct obj_descriptor *) 0)->name)];
+        unsigned int            version;
+
+        struct sp_index         spi;
+};
+
+/*
+  Variables hashed by  name and version modulo 'size_ver',  such that
+  the versions which are equal modulo 'size_ver' share a bin.
+*/
+struct sp_var_tab {
+        int                     num_var;
+        int                     size_ver;
+
+        /* Offset of the bounding box from the list entry of an object. */
+        long                    bb_off;
+
+        int                     size_hash;
+        struct list_head        *var_hash;
 };
 
 struct ss_storage {
         int                     num_obj;
         int                     size_hash;
-        /* List of data objects. */
+
+        /* Data objects, by (name, version) and region. */
+        struct sp_var_tab       vars;
+
+        /* Budget for the data of the resident objects, 0 for none. Over
+           budget, objects are spilled to files under 'spill_dir' and
+           mapped back, oldest version and least recently used first.
+           'mem_list' holds the resident objects by version, newest
+           first; readers reorder it under 'mem_lock'. */
+        uint64_t                mem_budget, mem_used;
+        struct list_head        mem_list;
+        pthread_mutex_t         mem_lock;
+        char                    *spill_dir;
+
+        /* List of data objects (DIMES only). */
         struct list_head        obj_hash[1];
 };
 
@@ -125,12 +196,25 @@ struct dht_entry {
         struct bbox             *bb_tab;
 
         int			odsc_size, odsc_num;
-        struct list_head	odsc_hash[1];
+        /* Object descriptors, by (name, version) and region. */
+        struct sp_var_tab	odsc_vars;
+};
+
+/* An SFC interval of a DHT entry; 'next' is the first interval of the
+   following entry. */
+struct dht_seg {
+        struct intv             intv;
+        int                     rank;
+        int                     next;
 };
 
 struct dht {
         struct bbox             bb_glb_domain;
 
+        /* Intervals of all the entries, in index order (v1 and v3). */
+        int                     num_seg;
+        struct dht_seg          *seg_tab;
+
         int                     num_entries;
         struct dht_entry        *ent_tab[1];
 };
@@ -140,9 +224,53 @@ enum sspace_hash_version {
                              //  using hilbert SFC
     ssd_hash_version_v2, // decompose the global data domain using
                          // recursive bisection of the longest dimension   
+    ssd_hash_version_v3, // decompose the global data domain using
+                         // Z-order (Morton) SFC
     _ssd_hash_version_count,
 };
 
+enum ds_data_placement {
+    ds_place_writer = 0,    // (default) store an object on the server its
+                            //  writer sends it to
+    ds_place_domain,        // split an object along the DHT decomposition and
+                            //  store each part on the server that indexes it
+    _ds_place_count,
+};
+
+/* Number of buckets the SFC index space is split in to track the load
+   of a shared space; sized for a split to fit in 'hdr_ss_info'. */
+#define SSD_SPLIT_BUCKETS       96
+/* Initial size of the split table of a shared space; a space that does
+   not keep all its splits drops the oldest epoch when the table is full. */
+#define SSD_SPLIT_MAX           64
+
+/*
+  Split of the SFC index space among the DHT entries for the versions
+  of one epoch: 'w_tab' is the relative load of each bucket of the
+  index space, and every entry gets an equal share of the load.
+*/
+struct ssd_split {
+        int                     epoch;
+        uint16_t                w_tab[SSD_SPLIT_BUCKETS];
+
+        int                     num_seg;
+        struct dht_seg          *seg_tab;
+};
+
+/*
+  Cache of the  DHT entries that a bounding box maps to, bounded to
+  'max_ent' entries and evicted in LRU order.
+*/
+struct sfc_hash_tab {
+        int                     num_ent, max_ent;
+
+        int                     size_hash;
+        struct list_head        *sh_hash;
+        struct list_head        sh_lru;
+
+        uint64_t                num_hit, num_miss;
+};
+
 /*
   Shared space structure.
 */
@@ -159,6 +287,34 @@ struct sspace {
         // for v2 
         int total_num_bbox;
         enum sspace_hash_version    hash_version;
+        /* Bisection tree of the domain in heap order (node i has
+           children 2i+1 and 2i+2); the last 'total_num_bbox' nodes are
+           the leaves. */
+        struct bbox             *kd_tab;
+
+        /* Cached results of ssd_hash(). */
+        struct sfc_hash_tab     sh_tab;
+
+        /* Load-aware split of the index space (v1 and v3 only), see
+           ssd_split_init(): versions are grouped in epochs of
+           'split_period' versions, each one placed by a split from
+           'split_tab' (sorted by epoch). With 'split_keep' set, the
+           table grows instead of dropping the oldest epoch. */
+        int                     split_period;
+        int                     split_keep;
+        int                     num_split;
+        int                     max_split;
+        struct ssd_split        *split_tab;
+
+        /* The domain in SFC order; 'dom_pos' is the position of the
+           first cell of each interval among the 'dom_size' cells. */
+        int                     num_dom;
+        struct intv             *dom_tab;
+        uint64_t                *dom_pos;
+        uint64_t                dom_size;
+
+        /* Bytes put in each bucket, not yet reported or decayed. */
+        uint64_t                load_tab[SSD_SPLIT_BUCKETS];
 };
 
 struct sspace_list_entry {
@@ -167,6 +323,12 @@ struct sspace_list_entry {
         struct sspace   *ssd;
 };
 
+enum ss_split_op {
+    ss_split_none = 0,      // plain space info
+    ss_split_get,           // ask server 0 for the split of 'split_epoch'
+    ss_split_reply,         // split of 'split_epoch' in 'split_w'
+};
+
 // Header for space info.
 struct hdr_ss_info {
     int     num_dims;
@@ -174,6 +336,14 @@ struct hdr_ss_info {
     int     num_space_srv;
     unsigned char hash_version;
     int max_versions;
+    unsigned char data_placement;
+    // Load-aware DHT split of the default shared space; on a
+    // 'ss_split_get' from a server, 'split_w' is its load report.
+    int split_period;
+    unsigned char split_op;
+    int split_epoch;
+    int split_shift;
+    uint16_t split_w[SSD_SPLIT_BUCKETS];
 } __attribute__ ((__packed__));
 
 /* Header structure for obj_get requests. */
@@ -196,6 +366,39 @@ struct hdr_obj_get {
     struct global_dimension gdim;
 } __attribute__((__packed__));
 
+/*
+  Steps of a routed obj_get: the client sends the query to its DHT
+  peers, which route the matching pieces to the data owners.
+*/
+enum get_fwd_step {
+    fwd_lookup = 0,
+    fwd_fetch
+};
+
+/* Header structure for routed obj_get requests. */
+struct hdr_obj_get_fwd {
+    int                     qid;
+    /* Requesting client. */
+    int                     rank;
+    int                     step;
+    struct obj_descriptor   odsc;
+    struct global_dimension gdim;
+} __attribute__((__packed__));
+
+#define HDR_GET_MAX_VERS        32
+
+/*
+  Header structure for the reply of a DHT peer to a routed obj_get: the
+  number of pieces it routed, or the versions available on error.
+*/
+struct hdr_obj_get_ack {
+    int                     qid;
+    int                     rc;
+    int                     num_obj;
+    int                     num_vers;
+    int                     versions[HDR_GET_MAX_VERS];
+} __attribute__((__packed__));
+
 /* Header structure for obj_put requests. */
 struct hdr_obj_put {
     struct obj_descriptor odsc;
@@ -205,6 +408,27 @@ struct hdr_obj_put {
 #endif
 } __attribute__((__packed__));
 
+/*
+  Header structure for batched requests: obj_put, DHT updates and
+  routed obj_get lookups. The payload holds 'num_obj' entries, and for
+  obj_put the data of the objects, in order, after them.
+*/
+struct hdr_obj_batch {
+    int                     num_obj;
+    uint64_t                size;
+#ifdef DS_SYNC_MSG
+    int* sync_op_id_ptr; //synchronization lock pointer
+#endif
+} __attribute__((__packed__));
+
+/* Entry of a batched obj_put or DHT update. */
+struct obj_batch_ent {
+    struct obj_descriptor   odsc;
+    struct global_dimension gdim;
+    /* Lowest ranked DHT peer of the object, for DHT updates. */
+    int                     rank;
+} __attribute__((__packed__));
+
 
 /* Header structure for meta_get requests. */
 struct hdr_nvars_get {
@@ -260,30 +484,65 @@ int ssd_init(struct sspace *, int);
 void ssd_free(struct sspace *);
 int ssd_copy(struct obj_data *, struct obj_data *);
 int ssd_copy_local(struct obj_data *, struct obj_data *);
+int ssd_data_iov(struct obj_data *, const struct obj_descriptor *, size_t, int, iovec_t **);
 // TODO: ssd_copyv is not supported yet
 int ssd_copyv(struct obj_data *, struct obj_data *);
 int ssd_copy_list(struct obj_data *, struct list_head *);
 int ssd_copy_list_shmem(struct obj_data *, struct list_head *, int);
 int ssd_filter(struct obj_data *, struct obj_descriptor *, double *);
 int ssd_hash(struct sspace *, const struct bbox *, struct dht_entry *[]);
+int ssd_hash_ver(struct sspace *, const struct bbox *, unsigned int, struct dht_entry *[]);
+int ssd_hash_self(struct sspace *, const struct bbox *, unsigned int);
+
+int ssd_split_init(struct sspace *, int, int);
+int ssd_split_epoch(const struct sspace *, unsigned int);
+int ssd_split_find(const struct sspace *, int);
+int ssd_split_get(const struct sspace *, int, uint16_t *);
+int ssd_split_set(struct sspace *, int, const uint16_t *);
+void ssd_split_add_load(struct sspace *, const struct bbox *, size_t);
+int ssd_split_take_load(struct sspace *, uint16_t *);
+void ssd_split_merge_load(struct sspace *, const uint16_t *, int);
+void ssd_split_decide(struct sspace *, uint16_t *);
 
 int dht_add_entry(struct dht_entry *, const struct obj_descriptor *);
 const struct obj_descriptor * dht_find_entry(struct dht_entry *, const struct obj_descriptor *);
 int dht_find_entry_all(struct dht_entry *, struct obj_descriptor *, 
                        const struct obj_descriptor *[]);
 int dht_find_versions(struct dht_entry *, struct obj_descriptor *, int []);
+int dht_find_layout(struct dht_entry *, const struct obj_descriptor *);
+
+int spi_init(struct sp_index *, long);
+void spi_free(struct sp_index *);
+void spi_add(struct sp_index *, struct list_head *);
+void spi_del(struct sp_index *, struct list_head *);
+int spi_search(struct sp_index *, const struct bbox *,
+               int (*)(struct list_head *, void *), void *);
+
+int spv_init(struct sp_var_tab *, int, long);
+void spv_free(struct sp_var_tab *);
+struct list_head *spv_bin(struct sp_var_tab *, const char *, unsigned int);
+struct sp_var *spv_find(struct sp_var_tab *, const char *, unsigned int);
+struct sp_var *spv_get(struct sp_var_tab *, const char *, unsigned int);
+void spv_del(struct sp_var_tab *, struct sp_var *);
 
 struct ss_storage *ls_alloc(int max_versions);
 void ls_free(struct ss_storage *);
 void ls_add_obj(struct ss_storage *, struct obj_data *);
+int ls_set_mem_budget(struct ss_storage *, uint64_t, const char *);
+int ls_spill_pick(struct ss_storage *, uint64_t, struct obj_data **, int);
+int ls_spill_write(struct ss_storage *, struct obj_data *, void **);
+void ls_spill_done(struct ss_storage *, struct obj_data *, void *);
 struct obj_data* ls_lookup(struct ss_storage *, char *);
+struct obj_data* ls_lookup_version(struct ss_storage *, const char *, unsigned int);
 void ls_remove(struct ss_storage *, struct obj_data *);
 void ls_try_remove_free(struct ss_storage *, struct obj_data *);
 struct obj_data * ls_find(struct ss_storage *, const struct obj_descriptor *);
+struct obj_data * ls_find_cover(struct ss_storage *, const struct obj_descriptor *);
 struct obj_data * ls_find_next(struct ss_storage *, const struct obj_descriptor *);
 struct obj_data * ls_find_latest(struct ss_storage *, const struct obj_descriptor *);
 struct obj_data * ls_find_no_version(struct ss_storage *, struct obj_descriptor *);
 
+int obj_data_arena_init(size_t);
 struct obj_data *obj_data_alloc(struct obj_descriptor *);
 struct obj_data *shmem_obj_data_alloc(struct obj_descriptor *, int);
 struct obj_data *obj_data_allocv(struct obj_descriptor *);
@@ -39,9 +39,12 @@
 
 #include "bbox.h"
 #include "sfc.h"
-#include "queue.h"
 #include "debug.h"
 
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
 //static inline unsigned int 
 static inline uint64_t 
 coord_dist(struct coord *c0, struct coord *c1, int dim)
@@ -221,50 +224,6 @@ static int compute_bits(uint64_t n)
         return nr_bits;
 }
 
-/*
-  Tranlate a bounding bb box into a 1D inteval using a SFC.
-  Assumption: bb has the same size on all dimensions and the size is a
-  power of 2.
-*/
-static void bbox_flat(struct bbox *bb, struct intv *itv, int bpd)
-{
-    int dims = bb->num_dims;
-    bitmask_t* sfc_coord;
-    int i, j, k;
-    uint64_t index;
-
-    //sfc_coord = malloc(sizeof(bitmask_t)*dims);
-    /*
-    bb->lb.c[0], c[1], c[2]...c[dims] 
-    bb->ub.c[0], c[1], c[2]...c[dims]
-    */
-    //itv->lb = ~(0UL);   //TODO for 64 bits
-    itv->lb = ~(0ULL);   //TODO for 64 bits
-    itv->ub = 0;
-
-    //initialize sfc_coord: all the possible 2-based number with dims bits
-    sfc_coord = malloc(sizeof(bitmask_t) * dims); //TODO free resource
-    for(i = 0; i < (1<<dims); i++){
-        j = 0;
-        //memcpy(sfc_coord, bb->lb.c, dims);
-        for(k = 0; k < dims; k++){
-            sfc_coord[k] = bb->lb.c[k];
-        }
-        while(j < dims){
-            if(i & (1<<j))
-                sfc_coord[j] = bb->ub.c[j];
-            j++;
-        }
-        //printf("coord is [%d,%d]\n\n", (int)sfc_coord[0],(int)sfc_coord[1]);
-        index = hilbert_c2i(dims, bpd, sfc_coord);
-        if (index < itv->lb)
-            itv->lb = index;
-        else if (index > itv->ub)
-            itv->ub = index;
-    }
-    free(sfc_coord);
-}
-
 static int intv_compar(const void *a, const void *b)
 {
         const struct intv *i0 = a, *i1 = b;
@@ -296,181 +255,297 @@ static uint64_t intv_compact(struct intv *i_tab, uint64_t num_itv)
         return (i+1);
 }
 
+static int intv_sort_compact(struct intv *i_tab, int num_itv)
+{
+        if (num_itv < 2)
+                return num_itv;
+
+        qsort(i_tab, num_itv, sizeof(*i_tab), &intv_compar);
+        return (int) intv_compact(i_tab, num_itv);
+}
+
 /*
-  Find the equivalence in 1d index space using a SFC for a bounding
-  box bb.
+  Test an aligned cube of side 'side' at 'lb' against 'bb': 0 - the
+  cube is outside, 1 - it crosses the border of 'bb', 2 - it is inside.
 */
-void bbox_to_intv(const struct bbox *bb, uint64_t dim_virt, int bpd, 
-                  struct intv **intv, int *num_intv)
+static int cube_in_bbox(const struct bbox *bb, const uint64_t *lb, uint64_t side)
 {
-    //const int 1<<(bb->num_dims);
-    struct bbox *bb_virt;
-    struct bbox *b_tab; //the number of b_tab is 2^n
-    struct queue q_can, q_good;
-    struct intv *i_tab, *i_tmp;
-    //int max;
-    uint64_t max;
-    int i, n;
+        int i, f_in = 1;
 
-    max = dim_virt; //n is the next power of 2 that includes the user's bbox
-    bpd = compute_bits(max); //TODO
+        for (i = 0; i < bb->num_dims; i++) {
+                if (lb[i] > bb->ub.c[i] || lb[i] + side - 1 < bb->lb.c[i])
+                        return 0;
+                if (lb[i] < bb->lb.c[i] || lb[i] + side - 1 > bb->ub.c[i])
+                        f_in = 0;
+        }
 
-    bb_virt = malloc(sizeof(struct bbox));
-    memset(bb_virt, 0, sizeof(struct bbox));
-    bb_virt->num_dims = bb->num_dims;
+        return f_in ? 2 : 1;
+}
 
-    for(i = 0; i < bb->num_dims; i++){
-        bb_virt->ub.c[i] = max - 1;
-    }
+/*
+  Z-order (Morton) index of a point: bit b of coordinate d goes to bit
+  b * ndim + d of the index.
+*/
+static uint64_t morton_c2i(int ndim, int bpd, const uint64_t *c)
+{
+        uint64_t index = 0, m;
+        int b, d;
+
+#ifdef __BMI2__
+        /* Bits of dimension 0 are 'ndim' apart. */
+        for (m = 1, b = ndim; b < 64; b = b * 2)
+                m |= m << b;
+        for (d = 0; d < ndim; d++)
+                index |= _pdep_u64(c[d], m << d);
+#else
+        switch (ndim) {
+        case 2:
+                for (d = 0; d < 2; d++) {
+                        uint64_t x = c[d] & 0xffffffffULL;
+                        x = (x | (x << 16)) & 0x0000ffff0000ffffULL;
+                        x = (x | (x << 8))  & 0x00ff00ff00ff00ffULL;
+                        x = (x | (x << 4))  & 0x0f0f0f0f0f0f0f0fULL;
+                        x = (x | (x << 2))  & 0x3333333333333333ULL;
+                        x = (x | (x << 1))  & 0x5555555555555555ULL;
+                        index |= x << d;
+                }
+                break;
+        case 3:
+                for (d = 0; d < 3; d++) {
+                        uint64_t x = c[d] & 0x1fffffULL;
+                        x = (x | (x << 32)) & 0x001f00000000ffffULL;
+                        x = (x | (x << 16)) & 0x001f0000ff0000ffULL;
+                        x = (x | (x << 8))  & 0x100f00f00f00f00fULL;
+                        x = (x | (x << 4))  & 0x10c30c30c30c30c3ULL;
+                        x = (x | (x << 2))  & 0x1249249249249249ULL;
+                        index |= x << d;
+                }
+                break;
+        default:
+                for (b = 0; b < bpd; b++)
+                        for (d = 0; d < ndim; d++) {
+                                m = (c[d] >> b) & 1;
+                                index |= m << (b * ndim + d);
+                        }
+                break;
+        }
+#endif
 
-    queue_init(&q_can);
-    queue_init(&q_good);
+        return index;
+}
 
-    n = 1 << (bb->num_dims); //number of b_tab
-    b_tab = malloc(sizeof(struct bbox) * n);
-    memset(b_tab, 0, sizeof(struct bbox) * n); //TODO sizeof???
+/*
+  An aligned cube of side 2^k is a single run of the Hilbert and of the
+  Z-order curve, so its interval follows from the index of any of its
+  points.
+*/
+static void cube_to_intv(const uint64_t *lb, int ndim, int bpd, int k,
+                         enum sfc_curve curve, struct intv *itv)
+{
+        bitmask_t c[BBOX_MAX_NDIM];
+        uint64_t mask;
+        int i;
 
-    queue_enqueue(&q_can, bb_virt);
-    while(! queue_is_empty(&q_can)){
+        mask = (k * ndim >= 64) ? ~0ULL : (1ULL << (k * ndim)) - 1;
+        if (curve == sfc_morton) {
+                itv->lb = morton_c2i(ndim, bpd, lb) & ~mask;
+                itv->ub = itv->lb | mask;
+                return;
+        }
 
-        bb_virt = (struct bbox *)queue_dequeue(&q_can);
-        if(bbox_include(bb, bb_virt)){
-            //printf("include\n");
-            i_tmp = malloc(sizeof(struct intv));
-            bbox_flat(bb_virt, i_tmp, bpd);
-            queue_enqueue(&q_good, i_tmp);
-            free(bb_virt);
+        for (i = 0; i < ndim; i++)
+                c[i] = lb[i];
+
+        itv->lb = hilbert_c2i(ndim, bpd, c) & ~mask;
+        itv->ub = itv->lb | mask;
+}
+
+/*
+  Decompose 'bb' into 'curve' intervals of the aligned cubes that cover
+  it, one level of cubes at a time starting from the cube of side
+  'dim_virt'. 'c_tab' is scratch space for 2 * 'max_intv' corners of
+  the cubes that cross the border of 'bb'. If the next level would not
+  fit in 'max_intv' intervals, the crossing cubes are taken whole and
+  the result covers more than 'bb'; with 'f_exact' set, -1 is returned
+  instead. Returns the number of sorted, disjoint intervals.
+*/
+static int bbox_decompose(const struct bbox *bb, uint64_t dim_virt,
+                          enum sfc_curve curve, struct intv *i_tab,
+                          int max_intv, struct coord *c_tab, int f_exact)
+{
+        const int ndim = bb->num_dims, num_child = 1 << ndim;
+        const int bpd = compute_bits(dim_virt);
+        struct coord *cur = c_tab, *next = c_tab + max_intv, *tmp;
+        uint64_t lb[BBOX_MAX_NDIM], half;
+        int num_cur = 1, num_next, num_i = 0;
+        int k = bpd - 1, i, j, d;
+
+        memset(&cur[0], 0, sizeof(cur[0]));
+        switch (cube_in_bbox(bb, cur[0].c, dim_virt)) {
+        case 0:
+                return 0;
+        case 2:
+                cube_to_intv(cur[0].c, ndim, bpd, k, curve, &i_tab[0]);
+                return 1;
         }
-        else if(bbox_does_intersect(bb, bb_virt)){
-            //printf("intersect\n");
-            bbox_divide(bb_virt, b_tab);
-            free(bb_virt);
-
-            for(i = 0; i < n; i++){
-                bb_virt = malloc(sizeof(struct bbox));
-                *bb_virt = b_tab[i];
-                queue_enqueue(&q_can, bb_virt);
-
-                //printf("b_tab+%d is [%d,%d]\n", i, bb_virt->lb.c[0],bb_virt->lb.c[1]);
-                //printf("b_tab+%d is [%d,%d]\n", i, bb_virt->ub.c[0],bb_virt->ub.c[1]);
-                //printf("bb_virt is dims[%d]\n", bb_virt->num_dims);
-            }
+
+        while (num_cur > 0) {
+                if (num_i + num_cur * num_child > max_intv) {
+                        num_i = intv_sort_compact(i_tab, num_i);
+                        if (num_i + num_cur * num_child > max_intv) {
+                                if (f_exact)
+                                        return -1;
+                                for (j = 0; j < num_cur; j++)
+                                        cube_to_intv(cur[j].c, ndim, bpd, k,
+                                                     curve, &i_tab[num_i++]);
+                                break;
+                        }
+                }
+
+                half = 1ULL << --k;
+                num_next = 0;
+                for (j = 0; j < num_cur; j++) {
+                        for (i = 0; i < num_child; i++) {
+                                for (d = 0; d < ndim; d++)
+                                        lb[d] = cur[j].c[d] +
+                                                ((i & (1 << d)) ? half : 0);
+
+                                switch (cube_in_bbox(bb, lb, half)) {
+                                case 1:
+                                        memcpy(next[num_next++].c, lb,
+                                               sizeof(lb[0]) * ndim);
+                                        break;
+                                case 2:
+                                        cube_to_intv(lb, ndim, bpd, k, curve,
+                                                     &i_tab[num_i++]);
+                                        break;
+                                }
+                        }
+                }
+
+                tmp = cur;
+                cur = next;
+                next = tmp;
+                num_cur = num_next;
         }
-        else
-            //printf("finish\n");
-            free(bb_virt);
-    }
-    free(b_tab);
-    n = queue_size(&q_good);
-    i_tab = malloc(n * sizeof(struct intv));
-
-    //uloga("total # boxes to decompose is %d\n", n);
-    n = 0;
-    while(!queue_is_empty(&q_good)){
-        i_tmp = queue_dequeue(&q_good);
-        i_tab[n++] = *i_tmp;
-        free(i_tmp);
-    }
-    qsort(i_tab, n, sizeof(struct intv), &intv_compar);
-    n = intv_compact(i_tab, n);
 
-    i_tab = realloc(i_tab, n*sizeof(struct intv));
-    *intv = i_tab;
-    *num_intv = n;
+        return intv_sort_compact(i_tab, num_i);
 }
 
-
 /*
-  New test ...
+  Decompose 'bb' into at most 'max_intv' intervals of the 'curve' index
+  space, without allocating; 'c_tab' is scratch space for 2 *
+  'max_intv' coordinates. Parts of the border of 'bb' are taken with
+  coarser cubes when the exact decomposition does not fit, so the
+  intervals may cover more than 'bb'.
 */
-void bbox_to_intv2(const struct bbox *bb, uint64_t dim_virt, int bpd, 
-                  struct intv **intv, int *num_intv)
+int bbox_to_intv_cap(const struct bbox *bb, uint64_t dim_virt,
+                     enum sfc_curve curve, struct intv *i_tab, int max_intv,
+                     struct coord *c_tab)
 {
-    struct bbox *bb_tab, *pbb;
-    int bb_size, bb_head, bb_tail;
-    struct intv *i_tab;
-    uint64_t n, i;
-    int i_num, i_size, i_resize = 0;
-
-    n = dim_virt;
-    bpd = compute_bits(n);
-
-   // bb_size = 4000; //TODO
-    bb_size = 4096;
-    bb_tab = malloc(sizeof(*bb_tab) * bb_size);
-    pbb = &bb_tab[bb_size - 1];
-    bb_head = bb_size - 1;
-    bb_tail = 0;
-
-    pbb->num_dims = bb->num_dims;
-    for(i = 0; i < pbb->num_dims; i++){
-        pbb->lb.c[i] = 0;
-        pbb->ub.c[i] = n - 1;
-    }
+        return bbox_decompose(bb, dim_virt, curve, i_tab, max_intv, c_tab, 0);
+}
 
-    //i_size = 4000;
-    i_size = 4096;
-    i_num = 0;
-    i_tab = malloc(sizeof(*i_tab) * i_size);
-
-    n = 1 << (bb->num_dims);
-    while(bb_head != bb_tail){
-        pbb = &bb_tab[bb_head];
-        if(bbox_include(bb, pbb)){
-            if(i_num == i_size){
-                i_size = i_size + i_size/2;
-                i_tab = realloc(i_tab, sizeof(*i_tab)*i_size);
-                i_resize++;
-            }
-            bbox_flat(pbb, &i_tab[i_num], bpd);
-            i_num++;
-        }
-        else if(bbox_does_intersect(bb, pbb)){
-                        if((bb_tail+n)%bb_size == (bb_head - (bb_head%n))){
-                               // int bb_nsize = (bb_size + bb_size/2) & (~0x07); /**1 byte is 8 bits**/
-				int tmp_size = bb_size + bb_size/2;
-				int bb_nsize = tmp_size - tmp_size % (1 << bb->num_dims);
-                                struct bbox *bb_ntab;
-                                int bb_nhead = bb_head - (bb_head % n);
-
-                                bb_ntab = malloc(sizeof(*bb_ntab) * bb_nsize);
-                                if (bb_tail > bb_head) {
-                                        memcpy(bb_ntab, &bb_tab[bb_nhead], sizeof(*bb_ntab)*(bb_tail-bb_nhead));
-                                }
-                                else {
-                                        memcpy(bb_ntab, &bb_tab[bb_nhead], sizeof(*bb_ntab)*(bb_size-bb_nhead));
-                                        memcpy(&bb_ntab[bb_size-bb_nhead], bb_tab, sizeof(*bb_ntab)*bb_tail);
-                                }
-                                bb_head = bb_head % n;
-                                bb_tail = bb_size - n;
-                                bb_size = bb_nsize;
+/* Cube of side 2^k at 'lb' for bbox_intv_match(). */
+static int bbox_match_cube(const struct bbox *bb, const uint64_t *lb, int bpd,
+                           int k, enum sfc_curve curve,
+                           int (*f_test)(const struct intv *, void *), void *arg)
+{
+        const int ndim = bb->num_dims;
+        uint64_t c[BBOX_MAX_NDIM];
+        struct intv itv;
+        int i, d, f_in;
 
-                                free(bb_tab);
-                                bb_tab = bb_ntab;
-                                pbb = &bb_tab[bb_head];
-                        }
-            bbox_divide(pbb, &bb_tab[bb_tail]);
-                        bb_tail = (bb_tail + n) % bb_size;
+        f_in = cube_in_bbox(bb, lb, 1ULL << k);
+        if (f_in == 0)
+                return 0;
+
+        cube_to_intv(lb, ndim, bpd, k, curve, &itv);
+        if (!(*f_test)(&itv, arg))
+                return 0;
+        if (f_in == 2)
+                return 1;
+
+        for (i = 0; i < (1 << ndim); i++) {
+                for (d = 0; d < ndim; d++)
+                        c[d] = lb[d] + ((i & (1 << d)) ? (1ULL << (k - 1)) : 0);
+                if (bbox_match_cube(bb, c, bpd, k - 1, curve, f_test, arg))
+                        return 1;
         }
 
-                bb_head = (bb_head + 1) % bb_size;
-    }
-#ifdef DEBUG
-	//printf("============bb_size = %d, total_size=%d===========\n", bb_size, bb_size*sizeof(*bb_tab));
-#endif
-    free(bb_tab);
-    // printf("I had to resize the interval array %d times.\n", i_resize);
+        return 0;
+}
 
+/*
+  Return 1 if a cell of 'bb' has its 'curve' index in the part of the
+  index space selected by 'f_test', which tells whether an interval
+  intersects that part. Exact; only the cubes of 'bb' that 'f_test'
+  keeps are refined, so a small part costs little.
+*/
+int bbox_intv_match(const struct bbox *bb, uint64_t dim_virt,
+                    enum sfc_curve curve,
+                    int (*f_test)(const struct intv *, void *), void *arg)
+{
+        const int bpd = compute_bits(dim_virt);
+        uint64_t lb[BBOX_MAX_NDIM];
+
+        memset(lb, 0, sizeof(lb));
+        return bbox_match_cube(bb, lb, bpd, bpd - 1, curve, f_test, arg);
+}
+
+/*
+  Exact decomposition of 'bb' into intervals of the 'curve' index
+  space; the table is allocated and returned in 'intv'.
+*/
+void bbox_to_intv_sfc(const struct bbox *bb, uint64_t dim_virt,
+                      enum sfc_curve curve, struct intv **intv, int *num_intv)
+{
+        struct intv *i_tab;
+        struct coord *c_tab;
+        int max_intv = 1024, n;
+
+        while (1) {
+                i_tab = malloc(sizeof(*i_tab) * max_intv);
+                c_tab = malloc(sizeof(*c_tab) * 2 * max_intv);
+                if (!i_tab || !c_tab) {
+                        free(c_tab);
+                        n = 0;
+                        break;
+                }
 
-    qsort(i_tab, i_num, sizeof(*i_tab), &intv_compar);
-    n = intv_compact(i_tab, i_num);
-    //printf("after compact, n = %llu, i_tab[300]=[%llu, %llu]", n, i_tab[300].lb, i_tab[300].ub);
-    // printf("Compact size is: %d.\n", n);
+                n = bbox_decompose(bb, dim_virt, curve, i_tab, max_intv,
+                                   c_tab, 1);
+                free(c_tab);
+                if (n >= 0)
+                        break;
+
+                free(i_tab);
+                max_intv = max_intv * 4;
+        }
 
-    /** Reduce the index array size to the used elements only. **/
-    i_tab = realloc(i_tab, sizeof(*i_tab) * n);
-    *intv = i_tab;
-    *num_intv = n;
+        if (n > 0)
+                i_tab = realloc(i_tab, sizeof(*i_tab) * n);
+        *intv = i_tab;
+        *num_intv = n;
+}
+
+/*
+  Find the equivalence in 1d index space using a SFC for a bounding
+  box bb.
+*/
+void bbox_to_intv(const struct bbox *bb, uint64_t dim_virt, int bpd, 
+                  struct intv **intv, int *num_intv)
+{
+        bbox_to_intv_sfc(bb, dim_virt, sfc_hilbert, intv, num_intv);
+}
+
+/*
+  Same as bbox_to_intv().
+*/
+void bbox_to_intv2(const struct bbox *bb, uint64_t dim_virt, int bpd, 
+                  struct intv **intv, int *num_intv)
+{
+        bbox_to_intv_sfc(bb, dim_virt, sfc_hilbert, intv, num_intv);
 }
 
 
@@ -42,6 +42,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <math.h>
+#include <limits.h>
 
 #include "common_dataspaces.h"
 #include "debug.h"
@@ -320,6 +321,379 @@ char* common_dspaces_get_next_meta(unsigned int ver, char *name, int *nVars, int
 	return data;
 }
 
+/*
+  Put aggregation: the writers on a node hold their puts until
+  put_sync, when the node master gathers them, merges adjacent blocks
+  of the same variable and version into larger objects and puts the
+  result as one batch.
+*/
+struct put_aggr_ent {
+    struct obj_descriptor odsc;
+    struct global_dimension gdim;
+} __attribute__((__packed__));
+
+static struct {
+    int f_enabled;
+    MPI_Comm node_comm;
+    struct list_head obj_list;
+} put_aggr;
+
+/*
+  Split 'comm' by compute node, as DIMES does for its shared memory;
+  the lowest rank on a node gives the color and becomes the master.
+*/
+static int put_aggr_init_node_comm(MPI_Comm comm)
+{
+    char name[MPI_MAX_PROCESSOR_NAME], *name_tab;
+    int rank, size, len, color, ret;
+
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    name_tab = malloc((size_t) size * MPI_MAX_PROCESSOR_NAME);
+    if (!name_tab)
+        return -ENOMEM;
+
+    memset(name, 0, sizeof(name));
+    MPI_Get_processor_name(name, &len);
+    MPI_Allgather(name, MPI_MAX_PROCESSOR_NAME, MPI_CHAR,
+                  name_tab, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, comm);
+    for (color = 0; color < rank; color++)
+        if (strcmp(name_tab + (size_t) color * MPI_MAX_PROCESSOR_NAME,
+                   name) == 0)
+            break;
+    free(name_tab);
+
+    ret = MPI_Comm_split(comm, color, rank, &put_aggr.node_comm);
+    if (ret != MPI_SUCCESS) {
+        uloga("'%s()': mpi_comm_split() failed with %d.\n", __func__, ret);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+static int put_aggr_add(const char *var_name,
+        unsigned int ver, int size,
+        int ndim,
+        uint64_t *lb,
+        uint64_t *ub,
+        const void *data)
+{
+    struct obj_descriptor odsc = {
+            .version = ver, .owner = -1,
+            .st = st,
+            .size = size,
+            .bb = {.num_dims = ndim,}
+    };
+    struct obj_data *od;
+
+    if (!is_ndim_within_bound(ndim))
+        return -EINVAL;
+
+    memset(odsc.bb.lb.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+    memset(odsc.bb.ub.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+
+    memcpy(odsc.bb.lb.c, lb, sizeof(uint64_t)*ndim);
+    memcpy(odsc.bb.ub.c, ub, sizeof(uint64_t)*ndim);
+
+    strncpy(odsc.name, var_name, sizeof(odsc.name)-1);
+    odsc.name[sizeof(odsc.name)-1] = '\0';
+
+    /* Keep a copy, the caller may reuse 'data' on return. */
+    od = obj_data_alloc_with_data(&odsc, data);
+    if (!od) {
+        uloga("'%s()': failed, can not allocate data object.\n",
+            __func__);
+        return -ENOMEM;
+    }
+    set_global_dimension(&dcg->gdim_list, var_name, &dcg->default_gdim,
+                         &od->gdim);
+
+    list_add_tail(&od->obj_entry, &put_aggr.obj_list);
+
+    return 0;
+}
+
+/*
+  Two blocks merge if they are parts of the same variable and version,
+  and match in all the dimensions but one, where they touch.
+*/
+static int put_aggr_can_merge(const struct obj_descriptor *o1,
+        const struct global_dimension *gd1,
+        const struct obj_descriptor *o2,
+        const struct global_dimension *gd2)
+{
+    int d, dim = -1;
+
+    if (strcmp(o1->name, o2->name) != 0 || o1->version != o2->version ||
+        o1->size != o2->size || o1->bb.num_dims != o2->bb.num_dims ||
+        gd1->ndim != gd2->ndim || !global_dimension_equal(gd1, gd2))
+        return 0;
+
+    for (d = 0; d < o1->bb.num_dims; d++) {
+        if (o1->bb.lb.c[d] == o2->bb.lb.c[d] &&
+            o1->bb.ub.c[d] == o2->bb.ub.c[d])
+            continue;
+        if (dim >= 0)
+            return 0;
+        if (o1->bb.ub.c[d] + 1 != o2->bb.lb.c[d] &&
+            o2->bb.ub.c[d] + 1 != o1->bb.lb.c[d])
+            return 0;
+        dim = d;
+    }
+
+    return dim >= 0;
+}
+
+/*
+  Merge the blocks in 'od_tab' into as few objects as possible. The
+  merged boxes are found first, so that every block is copied once.
+  The objects are returned in 'od_tab', and their number.
+*/
+static int put_aggr_coalesce(struct obj_data **od_tab, int num_od)
+{
+    struct obj_descriptor *box;
+    struct obj_data *od;
+    int *grp, i, j, k, f_merged, num_grp = 0;
+
+    box = malloc(sizeof(*box) * num_od);
+    grp = malloc(sizeof(*grp) * num_od);
+    if (!box || !grp) {
+        num_grp = num_od;
+        goto out;
+    }
+
+    for (i = 0; i < num_od; i++) {
+        box[i] = od_tab[i]->obj_desc;
+        grp[i] = i;
+    }
+
+    do {
+        f_merged = 0;
+        for (i = 0; i < num_od; i++) {
+            if (grp[i] != i)
+                continue;
+            for (j = i + 1; j < num_od; j++) {
+                if (grp[j] != j ||
+                    !put_aggr_can_merge(&box[i], &od_tab[i]->gdim,
+                                        &box[j], &od_tab[j]->gdim))
+                    continue;
+
+                for (k = 0; k < box[i].bb.num_dims; k++) {
+                    if (box[j].bb.lb.c[k] < box[i].bb.lb.c[k])
+                        box[i].bb.lb.c[k] = box[j].bb.lb.c[k];
+                    if (box[j].bb.ub.c[k] > box[i].bb.ub.c[k])
+                        box[i].bb.ub.c[k] = box[j].bb.ub.c[k];
+                }
+                for (k = 0; k < num_od; k++)
+                    if (grp[k] == j)
+                        grp[k] = i;
+                f_merged = 1;
+            }
+        }
+    } while (f_merged);
+
+    /* Build the merged objects in place of their first block. */
+    for (i = 0; i < num_od; i++) {
+        if (grp[i] != i)
+            continue;
+        for (k = i + 1; k < num_od && grp[k] != i; k++)
+            ;
+        if (k == num_od)
+            continue;
+
+        /* Without memory, put the blocks as they are. */
+        od = obj_data_alloc(&box[i]);
+        if (!od)
+            continue;
+        od->gdim = od_tab[i]->gdim;
+        for (k = i; k < num_od; k++) {
+            if (grp[k] != i)
+                continue;
+            ssd_copy(od, od_tab[k]);
+            if (k != i) {
+                obj_data_free(od_tab[k]);
+                od_tab[k] = 0;
+            }
+        }
+        obj_data_free(od_tab[i]);
+        od_tab[i] = od;
+    }
+
+    for (i = 0; i < num_od; i++)
+        if (od_tab[i])
+            od_tab[num_grp++] = od_tab[i];
+ out:
+    free(box);
+    free(grp);
+    return num_grp;
+}
+
+/*
+  Merge and put a table of blocks; the table is emptied.
+*/
+static int put_aggr_put(struct obj_data **od_tab, int num_od)
+{
+    int i, err = 0;
+
+    num_od = put_aggr_coalesce(od_tab, num_od);
+    if (num_od > 0)
+        err = dcg_obj_put_batch(od_tab, num_od);
+    for (i = 0; i < num_od; i++)
+        obj_data_free(od_tab[i]);
+    if (err < 0)
+        return err;
+    if (num_od > 0)
+        sync_op_id = err;
+
+    return 0;
+}
+
+/*
+  Gather the puts held on the node to its master, which merges and puts
+  them. Collective over the node communicator.
+*/
+static int put_aggr_flush(void)
+{
+    struct put_aggr_ent *ent;
+    struct obj_data *od, *t, **od_tab = 0;
+    char *buf = 0, *rbuf = 0, *p;
+    uint64_t size = 0, total = 0;
+    int node_rank, node_size, my_size, num_od = 0, i, f_ok = 1;
+    int err = -ENOMEM;
+
+    MPI_Comm_rank(put_aggr.node_comm, &node_rank);
+    MPI_Comm_size(put_aggr.node_comm, &node_size);
+
+    int size_tab[node_size], disp_tab[node_size];
+
+    list_for_each_entry(od, &put_aggr.obj_list, struct obj_data, obj_entry) {
+        size += sizeof(*ent) + obj_data_size(&od->obj_desc);
+        num_od++;
+    }
+    if (size > 0 && size <= INT_MAX)
+        buf = malloc(size);
+    my_size = (size == 0 || buf) ? (int) size : -1;
+
+    p = buf;
+    if (buf) {
+        list_for_each_entry(od, &put_aggr.obj_list, struct obj_data, obj_entry) {
+            ent = (struct put_aggr_ent *) p;
+            ent->odsc = od->obj_desc;
+            ent->gdim = od->gdim;
+            p += sizeof(*ent);
+            memcpy(p, od->data, obj_data_size(&od->obj_desc));
+            p += obj_data_size(&od->obj_desc);
+        }
+    }
+
+    MPI_Gather(&my_size, 1, MPI_INT, size_tab, 1, MPI_INT, 0,
+               put_aggr.node_comm);
+    if (node_rank == 0) {
+        for (i = 0; i < node_size; i++) {
+            if (size_tab[i] < 0 || total + size_tab[i] > INT_MAX) {
+                f_ok = 0;
+                break;
+            }
+            disp_tab[i] = (int) total;
+            total += size_tab[i];
+        }
+        if (f_ok && total > 0) {
+            rbuf = malloc(total);
+            if (!rbuf)
+                f_ok = 0;
+        }
+    }
+    MPI_Bcast(&f_ok, 1, MPI_INT, 0, put_aggr.node_comm);
+
+    if (!f_ok) {
+        /* Too much to gather; put the blocks of this rank. */
+        od_tab = malloc(sizeof(*od_tab) * (num_od + 1));
+        if (!od_tab)
+            goto out;
+        i = 0;
+        list_for_each_entry_safe(od, t, &put_aggr.obj_list, struct obj_data, obj_entry) {
+            list_del(&od->obj_entry);
+            od_tab[i++] = od;
+        }
+        err = put_aggr_put(od_tab, num_od);
+        goto out;
+    }
+
+    MPI_Gatherv(buf, my_size, MPI_BYTE, rbuf, size_tab, disp_tab, MPI_BYTE,
+                0, put_aggr.node_comm);
+    list_for_each_entry_safe(od, t, &put_aggr.obj_list, struct obj_data, obj_entry) {
+        list_del(&od->obj_entry);
+        obj_data_free(od);
+    }
+    err = 0;
+    if (node_rank != 0 || total == 0)
+        goto out;
+
+    num_od = 0;
+    for (p = rbuf; p < rbuf + total; num_od++) {
+        ent = (struct put_aggr_ent *) p;
+        p += sizeof(*ent) + obj_data_size(&ent->odsc);
+    }
+    err = -ENOMEM;
+    od_tab = malloc(sizeof(*od_tab) * num_od);
+    if (!od_tab)
+        goto out;
+
+    for (i = 0, p = rbuf; i < num_od; i++) {
+        ent = (struct put_aggr_ent *) p;
+        od_tab[i] = obj_data_alloc_no_data(&ent->odsc, p + sizeof(*ent));
+        if (!od_tab[i])
+            break;
+        od_tab[i]->gdim = ent->gdim;
+        p += sizeof(*ent) + obj_data_size(&ent->odsc);
+    }
+    err = put_aggr_put(od_tab, i);
+    if (i < num_od && err == 0)
+        err = -ENOMEM;
+ out:
+    free(od_tab);
+    free(buf);
+    free(rbuf);
+    return err;
+}
+
+int common_dspaces_put_aggregate_init(void *comm)
+{
+    int err;
+
+    if (!is_dspaces_lib_init() || !comm)
+        return -EINVAL;
+    if (put_aggr.f_enabled)
+        return 0;
+
+    err = put_aggr_init_node_comm(*(MPI_Comm *) comm);
+    if (err < 0) {
+        uloga("'%s()': failed with %d.\n", __func__, err);
+        return err;
+    }
+    INIT_LIST_HEAD(&put_aggr.obj_list);
+    put_aggr.f_enabled = 1;
+
+    return 0;
+}
+
+static void put_aggr_free(void)
+{
+    struct obj_data *od, *t;
+
+    if (!put_aggr.f_enabled)
+        return;
+
+    list_for_each_entry_safe(od, t, &put_aggr.obj_list, struct obj_data, obj_entry) {
+        list_del(&od->obj_entry);
+        obj_data_free(od);
+    }
+    MPI_Comm_free(&put_aggr.node_comm);
+    put_aggr.f_enabled = 0;
+}
+
 #ifdef SHMEM_OBJECTS
 int common_dspaces_put(const char *var_name, 
         unsigned int ver, int size,
@@ -331,6 +705,9 @@ int common_dspaces_put(const char *var_name,
         if (!is_dspaces_lib_init() || !is_ndim_within_bound(ndim)) {
             return -EINVAL;
         }
+        if (put_aggr.f_enabled)
+            return put_aggr_add(var_name, ver, size, ndim, lb, ub, data);
+
         struct obj_descriptor odsc_big= {
                     .version = ver, .owner = -1, 
                     .st = st,
@@ -441,6 +818,9 @@ int common_dspaces_put(const char *var_name,
         uint64_t *ub,
         const void *data)
 {
+        if (is_dspaces_lib_init() && put_aggr.f_enabled)
+            return put_aggr_add(var_name, ver, size, ndim, lb, ub, data);
+
 #if defined(DS_HAVE_DSPACES_LOCATION_AWARE_WRITE)
         return common_dspaces_put_location_aware(var_name, ver, size, ndim,
                     lb, ub, data);
@@ -582,13 +962,251 @@ int common_dspaces_remove(const char *var_name, unsigned int ver)
     return err;
 }
 
+/*
+  Build the objects of a batched put or get, with no data of their own.
+*/
+static struct obj_data **obj_batch_alloc(int num_var, const char **var_name,
+        unsigned int *ver, int *size, int *ndim,
+        uint64_t **lb, uint64_t **ub, void **data)
+{
+    struct obj_data **od_tab;
+    int i;
+
+    od_tab = calloc(num_var, sizeof(*od_tab));
+    if (!od_tab)
+        return NULL;
+
+    for (i = 0; i < num_var; i++) {
+        struct obj_descriptor odsc = {
+                .version = ver[i], .owner = -1,
+                .st = st,
+                .size = size[i],
+                .bb = {.num_dims = ndim[i],}
+        };
+
+        memset(odsc.bb.lb.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+        memset(odsc.bb.ub.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+
+        memcpy(odsc.bb.lb.c, lb[i], sizeof(uint64_t)*ndim[i]);
+        memcpy(odsc.bb.ub.c, ub[i], sizeof(uint64_t)*ndim[i]);
+
+        strncpy(odsc.name, var_name[i], sizeof(odsc.name)-1);
+        odsc.name[sizeof(odsc.name)-1] = '\0';
+
+        od_tab[i] = obj_data_alloc_no_data(&odsc, data[i]);
+        if (!od_tab[i])
+            break;
+
+        set_global_dimension(&dcg->gdim_list, var_name[i], &dcg->default_gdim,
+                             &od_tab[i]->gdim);
+    }
+
+    if (i < num_var) {
+        while (i--)
+            obj_data_free(od_tab[i]);
+        free(od_tab);
+        return NULL;
+    }
+
+    return od_tab;
+}
+
+static void obj_batch_free(struct obj_data **od_tab, int num_var)
+{
+    int i;
+
+    for (i = 0; i < num_var; i++)
+        obj_data_free(od_tab[i]);
+    free(od_tab);
+}
+
+static int is_batch_valid(int num_var, int *ndim)
+{
+    int i;
+
+    if (!is_dspaces_lib_init() || num_var <= 0)
+        return 0;
+
+    for (i = 0; i < num_var; i++)
+        if (!is_ndim_within_bound(ndim[i]))
+            return 0;
+
+    return 1;
+}
+
+int common_dspaces_put_batch(int num_var, const char **var_name,
+        unsigned int *ver, int *size,
+        int *ndim,
+        uint64_t **lb,
+        uint64_t **ub,
+        const void **data)
+{
+    struct obj_data **od_tab;
+    int err;
+
+    if (!is_batch_valid(num_var, ndim))
+        return -EINVAL;
+
+    od_tab = obj_batch_alloc(num_var, var_name, ver, size, ndim, lb, ub,
+                             (void **) data);
+    if (!od_tab) {
+        uloga("'%s()': failed, can not allocate data objects.\n",
+            __func__);
+        return -ENOMEM;
+    }
+
+    err = dcg_obj_put_batch(od_tab, num_var);
+    obj_batch_free(od_tab, num_var);
+    if (err < 0) {
+        uloga("'%s()': failed with %d, can not put data objects.\n",
+            __func__, err);
+        return err;
+    }
+    sync_op_id = err;
+
+    return 0;
+}
+
+int common_dspaces_get_batch(int num_var, const char **var_name,
+        unsigned int *ver, int *size,
+        int *ndim,
+        uint64_t **lb,
+        uint64_t **ub,
+        void **data)
+{
+    struct obj_data **od_tab;
+    int err;
+
+    if (!is_batch_valid(num_var, ndim))
+        return -EINVAL;
+
+    od_tab = obj_batch_alloc(num_var, var_name, ver, size, ndim, lb, ub,
+                             data);
+    if (!od_tab) {
+        uloga("'%s()': failed, can not allocate data objects.\n",
+            __func__);
+        return -ENOMEM;
+    }
+
+    err = dcg_obj_get_batch(od_tab, num_var);
+    obj_batch_free(od_tab, num_var);
+    if (err < 0 && err != -EAGAIN)
+        uloga("'%s()': failed with %d, can not get data objects.\n",
+            __func__, err);
+
+    return err;
+}
+
+/*
+  A get started by common_dspaces_iget().
+*/
+struct dspaces_get_req {
+    struct obj_data *od;
+    struct query_tran_entry *qte;
+};
+
+int common_dspaces_iget(const char *var_name,
+        unsigned int ver, int size,
+        int ndim,
+        uint64_t *lb,
+        uint64_t *ub,
+        void *data,
+        struct dspaces_get_req **preq)
+{
+    struct dspaces_get_req *req;
+    struct obj_data **od_tab;
+    int err = -ENOMEM;
+
+    if (!is_batch_valid(1, &ndim))
+        return -EINVAL;
+
+    req = malloc(sizeof(*req));
+    od_tab = obj_batch_alloc(1, &var_name, &ver, &size, &ndim, &lb, &ub,
+                             &data);
+    if (!req || !od_tab) {
+        uloga("'%s()': failed, can not allocate data object.\n",
+            __func__);
+        free(req);
+        if (od_tab)
+            obj_batch_free(od_tab, 1);
+        return -ENOMEM;
+    }
+    req->od = od_tab[0];
+    free(od_tab);
+
+    err = dcg_obj_iget(req->od, &req->qte);
+    if (err < 0) {
+        uloga("'%s()': failed with %d, can not get data object.\n",
+            __func__, err);
+        obj_data_free(req->od);
+        free(req);
+        return err;
+    }
+    *preq = req;
+
+    return 0;
+}
+
+int common_dspaces_test(struct dspaces_get_req *req, int *done)
+{
+    int err;
+
+    err = dcg_obj_test(req->qte, done);
+    if (*done) {
+        obj_data_free(req->od);
+        free(req);
+    }
+    if (err < 0 && err != -EAGAIN)
+        uloga("'%s()': failed with %d, can not get data object.\n",
+            __func__, err);
+
+    return err;
+}
+
+int common_dspaces_wait(struct dspaces_get_req *req)
+{
+    int err;
+
+    err = dcg_obj_wait(req->qte);
+    obj_data_free(req->od);
+    free(req);
+    if (err < 0 && err != -EAGAIN)
+        uloga("'%s()': failed with %d, can not get data object.\n",
+            __func__, err);
+
+    return err;
+}
+
+int common_dspaces_waitall(int num_req, struct dspaces_get_req **req)
+{
+    int i, err, rc = 0;
+
+    for (i = 0; i < num_req; i++) {
+        err = common_dspaces_wait(req[i]);
+        if (err < 0 && rc == 0)
+            rc = err;
+    }
+
+    return rc;
+}
+
 int common_dspaces_put_sync(void)
 {
 	if (!is_dspaces_lib_init()) {
 		return -EINVAL;
 	}
 
-    int err = dcg_obj_sync(sync_op_id);
+    int err = 0, rc;
+
+    if (put_aggr.f_enabled)
+        err = put_aggr_flush();
+    if (err == 0)
+        err = dcg_obj_sync(sync_op_id);
+    if (put_aggr.f_enabled) {
+        /* Return once the merged puts of the node are in. */
+        MPI_Allreduce(&err, &rc, 1, MPI_INT, MPI_MIN, put_aggr.node_comm);
+        err = rc;
+    }
     if (err < 0)
         uloga("'%s()': failed with %d, can not complete put_sync.\n", 
 			__func__, err);
@@ -645,6 +1263,7 @@ void common_dspaces_finalize(void)
 #ifdef DS_HAVE_DIMES
     dimes_client_free();
 #endif
+    put_aggr_free();
     dcg_free(dcg);
     dcg = 0;
 }
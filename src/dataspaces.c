@@ -162,6 +162,47 @@ int dspaces_get (const char *var_name,
     return common_dspaces_get(var_name, ver, size, ndim, lb, ub, data);    
 }
 
+int dspaces_put_batch (int num_var, const char **var_name,
+        unsigned int *ver, int *size,
+        int *ndim, uint64_t **lb, uint64_t **ub,
+        const void **data)
+{
+    return common_dspaces_put_batch(num_var, var_name, ver, size, ndim,
+                                    lb, ub, data);
+}
+
+int dspaces_get_batch (int num_var, const char **var_name,
+        unsigned int *ver, int *size,
+        int *ndim, uint64_t **lb, uint64_t **ub,
+        void **data)
+{
+    return common_dspaces_get_batch(num_var, var_name, ver, size, ndim,
+                                    lb, ub, data);
+}
+
+int dspaces_iget (const char *var_name,
+        unsigned int ver, int size,
+        int ndim, uint64_t *lb, uint64_t *ub,
+        void *data, struct dspaces_get_req **req)
+{
+    return common_dspaces_iget(var_name, ver, size, ndim, lb, ub, data, req);
+}
+
+int dspaces_test (struct dspaces_get_req *req, int *flag)
+{
+    return common_dspaces_test(req, flag);
+}
+
+int dspaces_wait (struct dspaces_get_req *req)
+{
+    return common_dspaces_wait(req);
+}
+
+int dspaces_waitall (int num_req, struct dspaces_get_req **req)
+{
+    return common_dspaces_waitall(num_req, req);
+}
+
 char* dspaces_get_latest_meta(unsigned int ver, char *name, int *nVars, int *version){
 
     return common_dspaces_get_latest_meta(ver, name, nVars, version);
@@ -177,6 +218,11 @@ int dspaces_put_sync(void)
 	return common_dspaces_put_sync();
 }
 
+int dspaces_put_aggregate_init(void *comm)
+{
+    return common_dspaces_put_aggregate_init(comm);
+}
+
 void dspaces_finalize(void)
 {
 	common_dspaces_finalize();
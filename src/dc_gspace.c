@@ -69,11 +69,15 @@ static double demo_sum_timing;
 
 typedef unsigned char		_u8;
 
+/* Max number of query layouts kept in the cache. */
+#define QC_MAX_ENTRIES          256
+
 struct query_cache_entry {
         struct list_head        q_entry;
 
-        /* Initial query copy. */
+        /* Initial query copy; the version is not part of the key. */
         struct obj_descriptor   q_obj;
+        struct global_dimension gdim;
 
         /* Decomposition of initial query. */
         int                     num_odsc;
@@ -112,8 +116,14 @@ struct query_tran_entry {
                     f_peer_received:1,
                     f_odsc_recv:1,
                     f_complete:1,
-                    f_err:1;
+                    f_err:1,
+                    f_no_cache:1,
+                    f_cached:1;
         int num_peers;
+
+        /* Destination and result of a non-blocking get. */
+        struct obj_data         *od_ref;
+        int                     rc;
 };
 
 /*
@@ -313,28 +323,6 @@ static void qt_free_obj_data_shmem(struct query_tran_entry *qte, int unlink)
             i++;
         }
 }
-/*
-  Allocate obj data storage for a given transaction, i.e., allocate
-  space for all object pieces.
-*/
-static int qt_alloc_obj_data(struct query_tran_entry *qte)
-{
-        struct obj_data *od;
-        int n = 0;
-        list_for_each_entry(od, &qte->od_list, struct obj_data, obj_entry) {
-                od->data = malloc(obj_data_size(&od->obj_desc));
-                if (!od->data)
-                        break;
-                n++;
-        }
-
-        if (n != qte->num_od) {
-                qt_free_obj_data(qte, 0);
-                return -ENOMEM;
-        }
-        return 0;
-}
-
 /*
   Allocate obj data storage for a given transaction, i.e., allocate
   space for all object pieces.
@@ -402,24 +390,21 @@ static int qt_add_obj(struct query_tran_entry *qte, struct obj_descriptor *odsc)
         return 0;
 }
 
-static int qte_set_odsc_from_cache(struct query_tran_entry *qte, 
-        const struct query_cache_entry *qce)
+/*
+  Drop the pieces and replies of a query, to start it over.
+*/
+static void qte_reset(struct query_tran_entry *qte)
 {
-        int err, i;
-
-        for (i = 0; i < qce->num_odsc; i++) {
-                err = qt_add_obj(qte, qce->odsc_tab+i);
-                if (err < 0)
-                        break;
-        }
-
-        if (i != qce->num_odsc) {
-                qt_free_obj_data(qte, 1);
-                return err;
-        }
-        qte->size_od = qce->num_odsc;
-
-        return 0;
+        qt_free_obj_data(qte, 1);
+        qte->size_od = qte->num_od = qte->num_parts_rec = 0;
+        qte->qh->qh_num_peer = 0;
+        qte->qh->qh_num_req_posted = 0;
+        qte->qh->qh_num_rep_received = 0;
+        qte->f_peer_received = 0;
+        qte->f_odsc_recv = 0;
+        qte->f_complete = 0;
+        qte->f_err = 0;
+        qte->f_cached = 0;
 }
 
 static struct query_cache_entry *qce_alloc(int num_obj_desc)
@@ -485,19 +470,70 @@ static void qc_del_entry(struct query_cache *qc, struct query_cache_entry *qce)
         qc->num_ent--;
 }
 
-static const struct query_cache_entry *
-qc_find(struct query_cache *qc, struct obj_descriptor *odsc)
+/*
+  Find the layout of a query by name, bounding box and global
+  dimension, for any version; the entry moves to the front of the list.
+*/
+static struct query_cache_entry *
+qc_find(struct query_cache *qc, struct obj_descriptor *odsc,
+        struct global_dimension *gdim)
 {
         struct query_cache_entry *qce = 0;
 
         list_for_each_entry(qce, &qc->q_list, struct query_cache_entry, q_entry) {
-                if (obj_desc_equals_no_owner(&qce->q_obj, odsc))
+                if (strcmp(qce->q_obj.name, odsc->name) == 0 &&
+                    qce->q_obj.size == odsc->size &&
+                    bbox_equals(&qce->q_obj.bb, &odsc->bb) &&
+                    global_dimension_equal(&qce->gdim, gdim)) {
+                        list_del(&qce->q_entry);
+                        list_add(&qce->q_entry, &qc->q_list);
                         return qce;
+                }
         }
 
         return NULL;
 }
 
+/*
+  Remember the pieces of a completed query; the least recently used
+  entry makes room if the cache is full.
+*/
+static void qc_add_query(struct query_cache *qc, struct query_tran_entry *qte)
+{
+        struct query_cache_entry *qce;
+
+        qce = qce_alloc(qte->num_od);
+        if (!qce)
+                return;
+
+        qce_set_obj_desc(qce, &qte->q_obj, &qte->od_list);
+        memcpy(&qce->gdim, &qte->gdim, sizeof(struct global_dimension));
+
+        if (qc->num_ent >= QC_MAX_ENTRIES) {
+                struct query_cache_entry *lru;
+
+                lru = list_entry(qc->q_list.prev, struct query_cache_entry, q_entry);
+                qc_del_entry(qc, lru);
+                qce_free(lru);
+        }
+        qc_add_entry(qc, qce);
+}
+
+/*
+  Drop the cached layouts of variable 'name'.
+*/
+static void qc_del_name(struct query_cache *qc, const char *name)
+{
+        struct query_cache_entry *qce, *tqce;
+
+        list_for_each_entry_safe(qce, tqce, &qc->q_list, struct query_cache_entry, q_entry) {
+                if (strcmp(qce->q_obj.name, name) == 0) {
+                        qc_del_entry(qc, qce);
+                        qce_free(qce);
+                }
+        }
+}
+
 static void qc_free(struct query_cache *qc)
 {
         struct query_cache_entry *qce, *tqce;
@@ -805,7 +841,7 @@ static int dcg_lock_request(struct dcg_lock *lock, enum lock_type type)
 
         err = rpc_send(dcg->dc->rpc_s, peer, msg);
         if (err < 0) {
-                free(msg);
+                msg_buf_free(msg);
                 goto err_out;
         }
 
@@ -862,59 +898,148 @@ static int cq_received_all_parts(struct query_tran_entry *qte)
         return (l_vol == g_vol);
 }
 
+#ifdef SHMEM_OBJECTS
 /* Forward definition. */
 static int dcg_obj_data_get(struct query_tran_entry *);
+#endif
 
-static int get_dht_peers_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+/*
+  Find the shared space for global dimension 'gd', or set it up; the
+  client places queries on the DHT itself, as the servers do.
+*/
+static struct sspace *dcg_lookup_sspace(const struct global_dimension *gd)
 {
-        struct query_tran_entry *qte = msg->private;
-        int i = 0;
+        struct sspace_list_entry *ssd_entry;
+        struct bbox domain;
+        int i;
 
-        while (i < qte->qh->qh_size && qte->qh->qh_peerid_tab[i] != -1)
-                i++;
-        qte->qh->qh_num_peer = i;
-        qte->f_peer_received = 1;
+        if (global_dimension_equal(gd, &dcg->default_gdim)) {
+                if (!dcg->default_ssd) {
+                        dcg->default_ssd = ssd_alloc(&dcg->ss_domain,
+                                dcg->ss_info.num_space_srv, 1, dcg->hash_version);
+                        if (dcg->default_ssd && dcg->split_period > 0 &&
+                            ssd_split_init(dcg->default_ssd, dcg->split_period, 0) < 0) {
+                                ssd_free(dcg->default_ssd);
+                                dcg->default_ssd = NULL;
+                        }
+                }
+                return dcg->default_ssd;
+        }
 
-        free(msg);
+        list_for_each_entry(ssd_entry, &dcg->sspace_list,
+                            struct sspace_list_entry, entry) {
+                if (global_dimension_equal(gd, &ssd_entry->gdim))
+                        return ssd_entry->ssd;
+        }
 
-        return 0;
+        memset(&domain, 0, sizeof(struct bbox));
+        domain.num_dims = gd->ndim;
+        for (i = 0; i < gd->ndim; i++)
+                domain.ub.c[i] = gd->sizes.c[i] - 1;
+
+        ssd_entry = malloc(sizeof(*ssd_entry));
+        if (!ssd_entry)
+                return NULL;
+
+        memcpy(&ssd_entry->gdim, gd, sizeof(struct global_dimension));
+        ssd_entry->ssd = ssd_alloc(&domain, dcg->ss_info.num_space_srv, 1,
+                                   dcg->hash_version);
+        if (!ssd_entry->ssd) {
+                free(ssd_entry);
+                return NULL;
+        }
+
+        list_add(&ssd_entry->entry, &dcg->sspace_list);
+        return ssd_entry->ssd;
 }
 
-/* 
-   Util function to retrieve the DHT peer ids for an object descriptor
-   from the server peer. The object descriptor should be embedded in a
-   query transaction entry structure.
+static void dcg_free_sspace(void)
+{
+        struct sspace_list_entry *ssd_entry, *t;
+
+        if (dcg->default_ssd)
+                ssd_free(dcg->default_ssd);
+        list_for_each_entry_safe(ssd_entry, t, &dcg->sspace_list,
+                                 struct sspace_list_entry, entry) {
+                ssd_free(ssd_entry->ssd);
+                list_del(&ssd_entry->entry);
+                free(ssd_entry);
+        }
+}
+
+/*
+  Make sure 'ssd' has the DHT split for objects of 'version'; server 0
+  sets the split of each epoch.
 */
-static int get_dht_peers(struct query_tran_entry *qte)
+static int dcg_split_get(struct sspace *ssd, unsigned int version)
 {
-        struct hdr_obj_get *oh;
+        struct hdr_ss_info *hsi;
         struct msg_buf *msg;
         struct node_id *peer;
-        int err = -ENOMEM;
+        int epoch, err = -ENOMEM;
+
+        if (!ssd->split_period)
+                return 0;
+        epoch = ssd_split_epoch(ssd, version);
+        if (ssd_split_find(ssd, epoch))
+                return 0;
 
-        peer = dcg_which_peer();
+        peer = dc_get_peer(dcg->dc, 0);
         msg = msg_buf_alloc(dcg->dc->rpc_s, peer, 1);
-        if (!msg) 
+        if (!msg)
                 goto err_out;
 
-        msg->msg_rpc->cmd = ss_obj_get_dht_peers;
+        msg->msg_rpc->cmd = ss_info;
         msg->msg_rpc->id = DCG_ID;
-        msg->msg_data = qte->qh->qh_peerid_tab;
-        msg->size = sizeof(int) * qte->qh->qh_size;
-        msg->cb = get_dht_peers_completion;
-        msg->private = qte;
 
-        oh = (struct hdr_obj_get *) msg->msg_rpc->pad;
-        oh->qid = qte->q_id;
-        oh->u.o.odsc = qte->q_obj;
-        oh->rank = DCG_ID;
-        memcpy(&oh->gdim, &qte->gdim, sizeof(struct global_dimension));
+        hsi = (struct hdr_ss_info *) msg->msg_rpc->pad;
+        hsi->split_op = ss_split_get;
+        hsi->split_epoch = epoch;
 
-        err = rpc_receive(dcg->dc->rpc_s, peer, msg);
-        if (err == 0)
-                return 0;
+        err = rpc_send(dcg->dc->rpc_s, peer, msg);
+        if (err < 0) {
+                msg_buf_free(msg);
+                goto err_out;
+        }
+
+        DC_WAIT_COMPLETION(ssd_split_find(ssd, epoch));
+
+        return 0;
+ err_out:
+        ERROR_TRACE();
+}
+
+/* 
+   Util function to compute the DHT peer ids for an object descriptor;
+   this is the placement the servers use, so no need to ask them. The
+   object descriptor should be embedded in a query transaction entry
+   structure.
+*/
+static int get_dht_peers(struct query_tran_entry *qte)
+{
+        struct dht_entry *de_tab[dcg->ss_info.num_space_srv];
+        struct sspace *ssd;
+        int num_de, i, err = -ENOMEM;
+
+        ssd = dcg_lookup_sspace(&qte->gdim);
+        if (!ssd)
+                goto err_out;
+
+        err = dcg_split_get(ssd, qte->q_obj.version);
+        if (err < 0)
+                goto err_out;
+
+        num_de = ssd_hash_ver(ssd, &qte->q_obj.bb, qte->q_obj.version, de_tab);
+        if (num_de < 0) {
+                err = num_de;
+                goto err_out;
+        }
+        for (i = 0; i < num_de && i < qte->qh->qh_size; i++)
+                qte->qh->qh_peerid_tab[i] = de_tab[i]->rank;
+        qte->qh->qh_num_peer = i;
+        qte->f_peer_received = 1;
 
-        free(msg);
+        return 0;
  err_out:
         ERROR_TRACE();
 }
@@ -953,7 +1078,7 @@ static int get_obj_descriptors(struct query_tran_entry *qte)
                 qte->qh->qh_num_req_posted++;
                 err = rpc_send(dcg->dc->rpc_s, peer, msg);
                 if (err < 0) {
-                        free(msg);
+                        msg_buf_free(msg);
                         qte->qh->qh_num_req_posted--;
                         goto err_out;
                 }
@@ -975,7 +1100,7 @@ static int obj_get_dht_peers_completion(void *dcg_ref, struct msg_buf *msg) // _
         struct hdr_obj_get *oh;
         int i, err;
 
-        free(msg);
+        msg_buf_free(msg);
 
         for (i = 0; i < qte->dht_peer_num; i++) {
                 err = -ENOMEM;
@@ -996,7 +1121,7 @@ static int obj_get_dht_peers_completion(void *dcg_ref, struct msg_buf *msg) // _
                 qte->dht_peer_req++;
                 err = rpc_send(dcg->dc->rpc_s, peer, msg);
                 if (err < 0) {
-                        free(msg);
+                        msg_buf_free(msg);
                         qte->dht_peer_req--;
                         break;
                 }
@@ -1049,7 +1174,7 @@ static int dcgrpc_obj_get_dht_peers(struct rpc_server *rpc_s, struct rpc_cmd *cm
         err = rpc_receive_direct(rpc_s, peer, msg);
         peer->mb = MB_RPC_MSG;
         if (err < 0) {
-                free(msg);
+                msg_buf_free(msg);
                 goto err_out;
         }
 
@@ -1070,7 +1195,7 @@ static int obj_data_get_completion(struct rpc_server *rpc_s, struct msg_buf *msg
         qte->f_complete = 1;
     }
 
-    free(msg);
+    msg_buf_free(msg);
     return 0;
 }
 
@@ -1165,7 +1290,7 @@ static int dcg_obj_data_get(struct query_tran_entry *qte)
 
                 err = rpc_receive(dcg->dc->rpc_s, peer, msg);
                 if (err < 0) {
-                    free(msg);
+                    msg_buf_free(msg);
                     free(od->data);
                     od->data = NULL;
                     goto err_out;
@@ -1184,65 +1309,6 @@ static int dcg_obj_data_get(struct query_tran_entry *qte)
 }
 #endif
 
-#ifndef SHMEM_OBJECTS
-static int dcg_obj_data_get(struct query_tran_entry *qte)
-{
-        struct msg_buf *msg;
-        struct node_id *peer;
-        struct hdr_obj_get *oh;
-        struct obj_data *od;
-        int err;
-
-        err = qt_alloc_obj_data(qte);
-        if (err < 0)
-                goto err_out;
-
-        list_for_each_entry(od, &qte->od_list, struct obj_data, obj_entry) {
-                peer = dc_get_peer(dcg->dc, od->obj_desc.owner);
-
-                err = -ENOMEM;
-                msg = msg_buf_alloc(dcg->dc->rpc_s, peer, 1);
-                if (!msg) {
-                        free(od->data);
-                        od->data = NULL;
-                        goto err_out;
-                }
-
-                msg->msg_data = od->data;
-                msg->size = obj_data_size(&od->obj_desc);
-                msg->cb = obj_data_get_completion;
-                msg->private = qte;
-
-                msg->msg_rpc->cmd = ss_obj_get;
-                msg->msg_rpc->id = DCG_ID;
-
-                oh = (struct hdr_obj_get *) msg->msg_rpc->pad;
-                oh->qid = qte->q_id;
-                oh->u.o.odsc = od->obj_desc;
-                oh->u.o.odsc.version = qte->q_obj.version;
-                memcpy(&oh->gdim, &qte->gdim,
-                    sizeof(struct global_dimension));
-
-                err = rpc_receive(dcg->dc->rpc_s, peer, msg);
-                if (err < 0) {
-                        free(msg);
-                        free(od->data);
-                        od->data = NULL;
-                        goto err_out;
-                }
-                // TODO: uncomment next line ?!
-                // qte->num_req++;
-                //uloga("Found object descriptor in obj_get \n");
-        }
-
-        return 0;
- err_out:
-        uloga("'%s()': failed with %d.\n", __func__, err);
-        return err;
-}
-
-#endif
-
 /*
   Initiate a custom filter retrieve operation.
   TODO: add a parameter for cusom functions ... 
@@ -1284,7 +1350,7 @@ static int obj_filter_init(struct query_tran_entry *qte)
 
                 err = rpc_receive(dcg->dc->rpc_s, peer, msg);
                 if (err < 0) {
-                        free(msg);
+                        msg_buf_free(msg);
                         goto err_out;
                 }
         }
@@ -1358,7 +1424,7 @@ static int obj_get_desc_completion(struct rpc_server *rpc_s, struct msg_buf *msg
 
     free(oh);
     free(od_tab);
-    free(msg);
+    msg_buf_free(msg);
 
     if(qte->qh->qh_num_rep_received == qte->qh->qh_num_peer) {
         /* Object descriptor receive completed. */
@@ -1370,7 +1436,7 @@ static int obj_get_desc_completion(struct rpc_server *rpc_s, struct msg_buf *msg
 err_out_free:
     free(oh);
     free(od_tab);
-    free(msg);
+    msg_buf_free(msg);
 
 	ERROR_TRACE();
 }
@@ -1406,7 +1472,7 @@ static int obj_get_desc_completion(struct rpc_server *rpc_s, struct msg_buf *msg
 
         free(oh);
         free(od_tab);
-        free(msg);
+        msg_buf_free(msg);
 
         if (qte->qh->qh_num_rep_received == qte->qh->qh_num_peer) {
                 /* Object descriptor receive completed. */
@@ -1417,7 +1483,7 @@ static int obj_get_desc_completion(struct rpc_server *rpc_s, struct msg_buf *msg
  err_out_free:
         free(oh);
         free(od_tab);
-        free(msg);
+        msg_buf_free(msg);
 
     ERROR_TRACE();
 }
@@ -1453,8 +1519,9 @@ static int dcgrpc_obj_get_desc(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
         struct msg_buf *msg;
         int err = -ENOMEM;
 
-        /* Test for errors ... */
-        if (oh->rc < 0) {
+        /* Test for errors, or for a peer that indexes no part of the
+           query; no descriptors follow. */
+        if (oh->rc < 0 || oh->u.o.num_de == 0) {
 		/* TODO: copy versions available if any !!! */
                 struct query_tran_entry *qte = qt_find(&dcg->qt, oh->qid);
                 if (!qte) {
@@ -1464,6 +1531,8 @@ static int dcgrpc_obj_get_desc(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
                 qte->qh->qh_num_rep_received++; 
                 if (qte->qh->qh_num_rep_received == qte->qh->qh_num_peer)
                         qte->f_odsc_recv = 1;
+                if (oh->rc == 0)
+                        return 0;
                 qte->f_err = 1;
 
 		versions_add(oh->u.v.num_vers, oh->u.v.versions);
@@ -1502,66 +1571,537 @@ static int dcgrpc_obj_get_desc(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 
         free(od_tab);
         free(oht);
-        free(msg);
+        msg_buf_free(msg);
 
  err_out:
         uloga("'%s()': failed with %d.\n", __func__, err);
         return err;
 }
 
+#if HAVE_TCP_SOCKET
 /*
-  Assemble the object 'od' from pieces in 'qte->od_list'.
+  The pieces of a routed get come from servers we may not have talked
+  to yet, and a registered client does not accept connections; so
+  connect to all the space servers first.
 */
-static int dcg_obj_assemble(struct query_tran_entry *qte, struct obj_data *od)
+static int dcg_connect_servers(void)
 {
-        int err;
-        #ifdef SHMEM_OBJECTS
-            int nums = qte->num_od/(qte->qh->qh_num_peer * 2);
+        struct node_id *peer;
+        int i;
 
-            err = ssd_copy_list_shmem(od, &qte->od_list, nums);
-        #endif
-        #ifndef SHMEM_OBJECTS
-            err = ssd_copy_list(od, &qte->od_list);
-        #endif
-        if (err == 0)
-                return 0;
+        for (i = 0; i < dcg->dc->num_sp; i++) {
+                peer = dc_get_peer(dcg->dc, i);
+                if (!peer->f_connected &&
+                    rpc_connect(dcg->dc->rpc_s, peer) < 0)
+                        return -EIO;
+        }
 
-        uloga("'%s()': failed with %d.\n", __func__, err);
-        return err;
+        return 0;
 }
+#endif
 
 /*
-  Free resources after 'dcg_obj_put()' inserts an object in the space.
+  A routed get is complete when all the DHT peers of the query replied
+  and all the pieces they routed arrived.
 */
-static int obj_put_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+static void obj_get_route_check(struct query_tran_entry *qte)
 {
-        struct obj_data *od = msg->private;
+        if (qte->f_peer_received &&
+            qte->qh->qh_num_rep_received == qte->qh->qh_num_peer &&
+            qte->num_parts_rec == qte->size_od)
+                qte->f_complete = 1;
+}
 
-#ifndef DS_SYNC_MSG
-        (*msg->sync_op_id) = 1;
+/*
+  Send a query to be routed through the space: the DHT peers of the
+  query locate the pieces, and the owners send the pieces back to us.
+  A DHT peer we fail to reach marks the query for a retry.
+*/
+static int obj_get_route(struct query_tran_entry *qte)
+{
+        struct dht_entry *de_tab[dcg->ss_info.num_space_srv];
+        struct hdr_obj_get_fwd *hf;
+        struct sspace *ssd;
+        struct msg_buf *msg;
+        struct node_id *peer;
+        int num_de, i, err;
+
+#if HAVE_TCP_SOCKET
+        err = dcg_connect_servers();
+        if (err < 0)
+                goto err_out;
 #endif
+        err = -ENOMEM;
+        ssd = dcg_lookup_sspace(&qte->gdim);
+        if (!ssd)
+                goto err_out;
 
-        obj_data_free(od);
-        free(msg);
+        err = dcg_split_get(ssd, qte->q_obj.version);
+        if (err < 0)
+                goto err_out;
 
-        dcg_dec_pending();
+        num_de = ssd_hash_ver(ssd, &qte->q_obj.bb, qte->q_obj.version, de_tab);
+        if (num_de < 0) {
+                err = num_de;
+                goto err_out;
+        }
+        for (i = 0; i < num_de; i++) {
+                peer = dc_get_peer(dcg->dc, de_tab[i]->rank);
+                msg = msg_buf_alloc(dcg->dc->rpc_s, peer, 1);
+                if (!msg) {
+                        qte->f_err = 1;
+                        break;
+                }
+
+                msg->msg_rpc->cmd = ss_obj_get_fwd;
+                msg->msg_rpc->id = DCG_ID;
+
+                hf = (struct hdr_obj_get_fwd *) msg->msg_rpc->pad;
+                hf->qid = qte->q_id;
+                hf->rank = DCG_ID;
+                hf->step = fwd_lookup;
+                hf->odsc = qte->q_obj;
+                memcpy(&hf->gdim, &qte->gdim, sizeof(struct global_dimension));
+
+                if (rpc_send(dcg->dc->rpc_s, peer, msg) < 0) {
+                        msg_buf_free(msg);
+                        qte->f_err = 1;
+                        break;
+                }
+        }
+        qte->qh->qh_num_peer = i;
+        qte->f_peer_received = 1;
+
+        obj_get_route_check(qte);
         return 0;
+ err_out:
+        ERROR_TRACE();
 }
 
+static int obj_batch_send_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+        free(msg->msg_data);
+        msg_buf_free(msg);
+        return 0;
+}
 
 /*
-    Server has completed processing data, release client sync 
+  Route a batch of queries: each DHT peer gets one request with the
+  lookups of all the queries it indexes.
 */
-#ifdef DS_SYNC_MSG
-static int dcgrpc_server_completion(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+static int obj_get_route_batch(struct query_tran_entry *qte_tab[], int num_qte)
 {
-    
-    struct hdr_obj_put *hdr = (struct hdr_obj_put *)cmd->pad;
-     
-     (*hdr->sync_op_id_ptr) = 1;
+        int num_sp = dcg->ss_info.num_space_srv;
+        struct hdr_obj_get_fwd *hf_tab[num_sp], *hf;
+        int num_hf[num_sp];
+        struct dht_entry *de_tab[num_sp];
+        struct query_tran_entry *qte;
+        struct hdr_obj_batch *hb;
+        struct msg_buf *msg;
+        struct node_id *peer;
+        struct sspace *ssd;
+        int num_de, rank, i, j, err;
 
-    return 0;
-}
+        memset(hf_tab, 0, sizeof(hf_tab));
+        memset(num_hf, 0, sizeof(num_hf));
+#if HAVE_TCP_SOCKET
+        err = dcg_connect_servers();
+        if (err < 0)
+                goto err_out;
+#endif
+        err = -ENOMEM;
+        for (i = 0; i < num_qte; i++) {
+                qte = qte_tab[i];
+                ssd = dcg_lookup_sspace(&qte->gdim);
+                if (!ssd)
+                        goto err_out;
+
+                err = dcg_split_get(ssd, qte->q_obj.version);
+                if (err < 0)
+                        goto err_out;
+
+                num_de = ssd_hash_ver(ssd, &qte->q_obj.bb, qte->q_obj.version, de_tab);
+                if (num_de < 0) {
+                        err = num_de;
+                        goto err_out;
+                }
+                err = -ENOMEM;
+                for (j = 0; j < num_de; j++) {
+                        rank = de_tab[j]->rank;
+                        if (!hf_tab[rank]) {
+                                hf_tab[rank] = malloc(sizeof(*hf) * num_qte);
+                                if (!hf_tab[rank])
+                                        goto err_out;
+                        }
+
+                        hf = &hf_tab[rank][num_hf[rank]++];
+                        hf->qid = qte->q_id;
+                        hf->rank = DCG_ID;
+                        hf->step = fwd_lookup;
+                        hf->odsc = qte->q_obj;
+                        memcpy(&hf->gdim, &qte->gdim, sizeof(struct global_dimension));
+                }
+                qte->qh->qh_num_peer = num_de;
+        }
+
+        for (rank = 0; rank < num_sp; rank++) {
+                if (!num_hf[rank])
+                        continue;
+
+                peer = dc_get_peer(dcg->dc, rank);
+                msg = msg_buf_alloc(dcg->dc->rpc_s, peer, 1);
+                if (msg) {
+                        msg->msg_rpc->cmd = ss_obj_get_batch;
+                        msg->msg_rpc->id = DCG_ID;
+
+                        hb = (struct hdr_obj_batch *) msg->msg_rpc->pad;
+                        hb->num_obj = num_hf[rank];
+                        hb->size = sizeof(*hf) * num_hf[rank];
+
+                        msg->msg_data = hf_tab[rank];
+                        msg->size = hb->size;
+                        msg->cb = obj_batch_send_completion;
+
+                        if (rpc_send(dcg->dc->rpc_s, peer, msg) == 0) {
+                                hf_tab[rank] = NULL;
+                                continue;
+                        }
+                        msg_buf_free(msg);
+                }
+
+                /* The queries will not hear from this peer. */
+                for (j = 0; j < num_hf[rank]; j++) {
+                        qte = qt_find(&dcg->qt, hf_tab[rank][j].qid);
+                        qte->qh->qh_num_peer--;
+                        qte->f_err = 1;
+                }
+                free(hf_tab[rank]);
+                hf_tab[rank] = NULL;
+        }
+
+        for (i = 0; i < num_qte; i++) {
+                qte_tab[i]->f_peer_received = 1;
+                obj_get_route_check(qte_tab[i]);
+        }
+
+        return 0;
+ err_out:
+        for (rank = 0; rank < num_sp; rank++)
+                free(hf_tab[rank]);
+        ERROR_TRACE();
+}
+
+/*
+  RPC routine to receive the number of pieces a DHT peer routed for
+  our query.
+*/
+static int dcgrpc_obj_get_ack(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        struct hdr_obj_get_ack *ha = (struct hdr_obj_get_ack *) cmd->pad;
+        struct query_tran_entry *qte;
+        int err = -ENOENT;
+
+        qte = qt_find(&dcg->qt, ha->qid);
+        if (!qte)
+                goto err_out;
+
+        qte->qh->qh_num_rep_received++;
+        qte->size_od += ha->num_obj;
+        if (ha->rc < 0) {
+                int versions[HDR_GET_MAX_VERS];
+
+                qte->f_err = 1;
+                memcpy(versions, ha->versions, sizeof(versions));
+                versions_add(ha->num_vers, versions);
+        }
+
+        obj_get_route_check(qte);
+        return 0;
+ err_out:
+        ERROR_TRACE();
+}
+
+static int obj_get_data_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+        struct query_tran_entry *qte = msg->private;
+
+        qte->num_parts_rec++;
+        obj_get_route_check(qte);
+
+        msg_buf_free(msg);
+        return 0;
+}
+
+/* Scratch space the payloads we drop are read into, a chunk at a time. */
+#define OBJ_DRAIN_CHUNK         (64 * 1024)
+static char obj_drain_buf[OBJ_DRAIN_CHUNK];
+
+/* Account a dropped piece of the query 'qte', if any, for a retry. */
+static void obj_get_drain_done(struct query_tran_entry *qte)
+{
+        if (qte) {
+                qte->f_err = 1;
+                qte->num_parts_rec++;
+                obj_get_route_check(qte);
+        }
+}
+
+#if !HAVE_TCP_SOCKET
+static int obj_get_drain_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+        obj_get_drain_done(msg->private);
+        msg_buf_free(msg);
+        return 0;
+}
+#endif
+
+/*
+  Read and drop the payload of a piece we can not store, so that the
+  messages that follow from 'peer' are parsed right; the query 'qte',
+  if any, is marked for a retry. This runs when we are out of memory,
+  so the payload goes through a fixed scratch buffer.
+*/
+static int obj_get_data_drain(struct rpc_server *rpc_s, struct node_id *peer,
+                              struct rpc_cmd *cmd, struct query_tran_entry *qte)
+{
+        struct hdr_obj_get *oh = (struct hdr_obj_get *) cmd->pad;
+        size_t left = obj_data_size(&oh->u.o.odsc);
+        int err = 0;
+#if HAVE_TCP_SOCKET
+        struct msg_buf msg;
+
+        /* The payload follows on the stream; receives are synchronous,
+           so the same buffer serves every chunk. */
+        memset(&msg, 0, sizeof(msg));
+        msg.peer = peer;
+        msg.msg_data = obj_drain_buf;
+        while (left > 0) {
+                msg.size = min(left, sizeof(obj_drain_buf));
+                err = rpc_receive_direct(rpc_s, peer, &msg);
+                if (err < 0)
+                        break;
+                left -= msg.size;
+        }
+        obj_get_drain_done(qte);
+        if (err == 0)
+                return 0;
+#else
+        struct msg_buf *msg;
+
+        /* The owner releases the piece once we fetch from it; the
+           bytes themselves are not needed. */
+        err = -ENOMEM;
+        msg = msg_buf_alloc(rpc_s, peer, 0);
+        if (!msg) {
+                obj_get_drain_done(qte);
+                goto err_out;
+        }
+
+        msg->size = min(left, sizeof(obj_drain_buf));
+        msg->msg_data = obj_drain_buf;
+        msg->cb = obj_get_drain_completion;
+        msg->private = qte;
+
+        rpc_mem_info_cache(peer, msg, cmd);
+        err = rpc_receive_direct(rpc_s, peer, msg);
+        rpc_mem_info_reset(peer, msg, cmd);
+        if (err == 0)
+                return 0;
+
+        obj_get_drain_done(qte);
+        msg_buf_free(msg);
+ err_out:
+#endif
+        ERROR_TRACE();
+}
+
+/*
+  RPC routine to receive a piece of a routed get from its owner.
+*/
+static int dcgrpc_obj_get_data(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        struct hdr_obj_get *oh = (struct hdr_obj_get *) cmd->pad;
+        struct node_id *peer = dc_get_peer(dcg->dc, cmd->id);
+        struct query_tran_entry *qte;
+        struct obj_data *od;
+        struct msg_buf *msg;
+        int err;
+
+        qte = qt_find(&dcg->qt, oh->qid);
+        if (oh->rc < 0) {
+                /* The owner no longer has the piece; no payload. */
+                if (!qte)
+                        return -ENOENT;
+                qte->f_err = 1;
+                qte->num_parts_rec++;
+                obj_get_route_check(qte);
+                return 0;
+        }
+        if (!qte) {
+                uloga("'%s()': no query %d, dropping the piece.\n",
+                      __func__, oh->qid);
+                return obj_get_data_drain(rpc_s, peer, cmd, NULL);
+        }
+
+        od = obj_data_alloc_no_data(&oh->u.o.odsc, NULL);
+        if (!od)
+                return obj_get_data_drain(rpc_s, peer, cmd, qte);
+
+        od->data = malloc(obj_data_size(&od->obj_desc));
+        msg = msg_buf_alloc(rpc_s, peer, 0);
+        if (!od->data || !msg) {
+                free(od->data);
+                free(od);
+                if (msg)
+                        msg_buf_free(msg);
+                return obj_get_data_drain(rpc_s, peer, cmd, qte);
+        }
+        list_add(&od->obj_entry, &qte->od_list);
+        qte->num_od++;
+
+        msg->msg_data = od->data;
+        msg->size = obj_data_size(&od->obj_desc);
+        msg->cb = obj_get_data_completion;
+        msg->private = qte;
+
+        rpc_mem_info_cache(peer, msg, cmd);
+        err = rpc_receive_direct(rpc_s, peer, msg);
+        rpc_mem_info_reset(peer, msg, cmd);
+        if (err == 0)
+                return 0;
+
+        msg_buf_free(msg);
+        ERROR_TRACE();
+}
+
+/*
+  Fetch the pieces of a query straight from the owners in a cached
+  layout. A piece we fail to request marks the query for a retry.
+*/
+static int obj_get_cached(struct query_tran_entry *qte,
+                          const struct query_cache_entry *qce)
+{
+        struct hdr_obj_get_fwd *hf;
+        struct msg_buf *msg;
+        struct node_id *peer;
+        int i, err;
+
+#if HAVE_TCP_SOCKET
+        err = dcg_connect_servers();
+        if (err < 0)
+                goto err_out;
+#endif
+        qte->f_peer_received = 1;
+        qte->f_cached = 1;
+        for (i = 0; i < qce->num_odsc; i++) {
+                peer = dc_get_peer(dcg->dc, qce->odsc_tab[i].owner);
+                msg = msg_buf_alloc(dcg->dc->rpc_s, peer, 1);
+                if (!msg) {
+                        qte->f_err = 1;
+                        break;
+                }
+
+                msg->msg_rpc->cmd = ss_obj_get_fwd;
+                msg->msg_rpc->id = DCG_ID;
+
+                hf = (struct hdr_obj_get_fwd *) msg->msg_rpc->pad;
+                hf->qid = qte->q_id;
+                hf->rank = DCG_ID;
+                hf->step = fwd_fetch;
+                hf->odsc = qce->odsc_tab[i];
+                hf->odsc.version = qte->q_obj.version;
+                hf->odsc.st = qte->q_obj.st;
+                memcpy(&hf->gdim, &qte->gdim, sizeof(struct global_dimension));
+
+                if (rpc_send(dcg->dc->rpc_s, peer, msg) < 0) {
+                        msg_buf_free(msg);
+                        qte->f_err = 1;
+                        break;
+                }
+                qte->size_od++;
+        }
+
+        obj_get_route_check(qte);
+        return 0;
+#if HAVE_TCP_SOCKET
+ err_out:
+        ERROR_TRACE();
+#endif
+}
+
+/*
+  RPC routine to forget the layouts of a variable whose writers changed
+  their decomposition.
+*/
+static int dcgrpc_obj_cache_inval(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        struct hdr_obj_get *oh = (struct hdr_obj_get *) cmd->pad;
+        struct query_tran_entry *qte;
+
+        qc_del_name(&dcg->qc, oh->u.o.odsc.name);
+
+        /* Queries in flight may still see the old layout. */
+        list_for_each_entry(qte, &dcg->qt.q_list, struct query_tran_entry, q_entry) {
+                if (strcmp(qte->q_obj.name, oh->u.o.odsc.name) == 0)
+                        qte->f_no_cache = 1;
+        }
+
+        return 0;
+}
+
+/*
+  Assemble the object 'od' from pieces in 'qte->od_list'.
+*/
+static int dcg_obj_assemble(struct query_tran_entry *qte, struct obj_data *od)
+{
+        int err;
+        #ifdef SHMEM_OBJECTS
+            int nums = qte->num_od/(qte->qh->qh_num_peer * 2);
+
+            err = ssd_copy_list_shmem(od, &qte->od_list, nums);
+        #endif
+        #ifndef SHMEM_OBJECTS
+            err = ssd_copy_list(od, &qte->od_list);
+        #endif
+        if (err == 0)
+                return 0;
+
+        uloga("'%s()': failed with %d.\n", __func__, err);
+        return err;
+}
+
+/*
+  Free resources after 'dcg_obj_put()' inserts an object in the space.
+*/
+static int obj_put_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+        struct obj_data *od = msg->private;
+
+#ifndef DS_SYNC_MSG
+        (*msg->sync_op_id) = 1;
+#endif
+
+        obj_data_free(od);
+        msg_buf_free(msg);
+
+        dcg_dec_pending();
+        return 0;
+}
+
+
+/*
+    Server has completed processing data, release client sync 
+*/
+#ifdef DS_SYNC_MSG
+static int dcgrpc_server_completion(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+    
+    struct hdr_obj_put *hdr = (struct hdr_obj_put *)cmd->pad;
+     
+     (*hdr->sync_op_id_ptr)++;
+
+    return 0;
+}
 #endif
 
 
@@ -1578,6 +2118,8 @@ static int dcgrpc_ss_info(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
     dcg->default_gdim.ndim = hsi->num_dims;
     dcg->hash_version = hsi->hash_version;
     dcg->max_versions = hsi->max_versions;
+    dcg->data_placement = hsi->data_placement;
+    dcg->split_period = hsi->split_period;
 	int i;
 	for(i = 0; i < hsi->num_dims; i++){
 		dcg->ss_domain.lb.c[i] = 0;
@@ -1586,6 +2128,16 @@ static int dcgrpc_ss_info(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 	}
 	dcg->f_ss_info = 1;
 
+	/* Server 0 sent the DHT split of an epoch. */
+	if (hsi->split_op == ss_split_reply) {
+		uint16_t w_tab[SSD_SPLIT_BUCKETS];
+		struct sspace *ssd = dcg_lookup_sspace(&dcg->default_gdim);
+
+		memcpy(w_tab, hsi->split_w, sizeof(w_tab));
+		if (ssd)
+			ssd_split_set(ssd, hsi->split_epoch, w_tab);
+	}
+
 	return 0;
 }
 
@@ -1640,6 +2192,9 @@ struct dcg_space *dcg_alloc(int num_nodes, int appid, void* comm)
         dcg_l->num_pending = 0;
         qt_init(&dcg_l->qt);
         rpc_add_service(ss_obj_get_desc, dcgrpc_obj_get_desc);
+        rpc_add_service(ss_obj_get_ack, dcgrpc_obj_get_ack);
+        rpc_add_service(ss_obj_get_data, dcgrpc_obj_get_data);
+        rpc_add_service(ss_obj_cache_inval, dcgrpc_obj_cache_inval);
         rpc_add_service(cp_lock, dcgrpc_lock_service);
         rpc_add_service(cn_timing, dcgrpc_time_log);
         rpc_add_service(ss_info, dcgrpc_ss_info);
@@ -1671,7 +2226,9 @@ struct dcg_space *dcg_alloc(int num_nodes, int appid, void* comm)
         INIT_LIST_HEAD(&dcg_l->locks_list);
         init_gdim_list(&dcg_l->gdim_list);    
         qc_init(&dcg_l->qc);
+        INIT_LIST_HEAD(&dcg_l->sspace_list);
         dcg_l->hash_version = ssd_hash_version_v1; // set default hash version
+        dcg_l->data_placement = ds_place_writer;
 
 
 
@@ -1687,53 +2244,268 @@ int dcg_barrier(struct dcg_space *dcg)
         return dc_barrier(dcg->dc);
 }
 
-void dcg_free(struct dcg_space *dcg)
-{
-#ifdef DEBUG
-        uloga("'%s()': num pending = %d.\n", __func__, dcg->num_pending);
-#endif
+void dcg_free(struct dcg_space *dcg)
+{
+#ifdef DEBUG
+        uloga("'%s()': num pending = %d.\n", __func__, dcg->num_pending);
+#endif
+
+	while (dcg->num_pending) {
+	      dc_process(dcg->dc);
+	}
+
+    dc_free(dcg->dc);
+    qc_free(&dcg->qc);
+    dcg_free_sspace();
+	lock_free();
+
+    free_gdim_list(&dcg->gdim_list);
+    free(dcg);
+}
+
+void dcgrpc_kill(struct dcg_space *dcg)
+{
+	int peer_id;
+	struct node_id *peer;
+	struct hdr_dsg_kill *hdr;
+	struct msg_buf *msg;
+	int err;
+
+	for(peer_id = 0; peer_id < dcg->dc->num_sp; peer_id++){
+	    peer = dc_get_peer(dcg->dc, peer_id);
+	    int sync_op_id = syncop_next();
+        msg = msg_buf_alloc(dcg->dc->rpc_s, peer, 1);
+	    if (!msg) {
+	        exit(-1);
+        }
+		msg->sync_op_id = syncop_ref(sync_op_id);
+
+		msg->msg_rpc->cmd = ss_kill;
+		msg->msg_rpc->id = DCG_ID;
+
+		hdr = (struct hdr_dsg_kill *)msg->msg_rpc->pad;
+	    hdr->kill_flag = 1;
+		err = rpc_send(dcg->dc->rpc_s, peer, msg);
+		if (err < 0) {
+		    msg_buf_free(msg);
+			uloga("RPC for kill failed with %d\n", err);
+			exit(-1);
+		}
+	}
+}
+
+/*
+  The server a client puts its objects to.
+*/
+static struct node_id *dcg_put_peer(void)
+{
+        if (flag_set_mpi_rank)
+                return dc_get_peer(dcg->dc, mpi_rank % dcg->dc->num_sp);
+
+        return dcg_which_peer();
+}
+
+static int obj_put_batch_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+#ifndef DS_SYNC_MSG
+        /* A put placed on several servers completes with its last
+           batch; see obj_put_place(). */
+        (*msg->sync_op_id)++;
+#endif
+
+        free(msg->msg_data);
+        msg_buf_free(msg);
+
+        dcg_dec_pending();
+        return 0;
+}
+
+/*
+  Send a put batch 'buf' of 'num_obj' entries and their data to 'peer'.
+*/
+static int obj_put_batch_post(struct node_id *peer, int sync_op_id,
+                              int num_obj, void *buf, uint64_t size)
+{
+        struct hdr_obj_batch *hb;
+        struct msg_buf *msg;
+        int err = -ENOMEM;
+
+        msg = msg_buf_alloc(dcg->dc->rpc_s, peer, 1);
+        if (!msg)
+                goto err_out;
+
+        msg->msg_data = buf;
+        msg->size = size;
+        msg->cb = obj_put_batch_completion;
+#ifndef DS_SYNC_MSG
+        msg->sync_op_id = syncop_ref(sync_op_id);
+#endif
+
+        msg->msg_rpc->cmd = ss_obj_put_batch;
+        msg->msg_rpc->id = DCG_ID;
+
+        hb = (struct hdr_obj_batch *) msg->msg_rpc->pad;
+        hb->num_obj = num_obj;
+        hb->size = size;
+#ifdef DS_SYNC_MSG
+        hb->sync_op_id_ptr = syncop_ref(sync_op_id);
+#endif
+
+        err = rpc_send(dcg->dc->rpc_s, peer, msg);
+        if (err < 0) {
+                msg_buf_free(msg);
+                goto err_out;
+        }
+
+        dcg_inc_pending();
+        return 0;
+ err_out:
+        ERROR_TRACE();
+}
+
+/* Depth of the splits of an object placed by domain: at most 2^depth
+   parts. */
+#define DCG_PLACE_SPLIT_DEPTH   6
+
+/*
+  Part of an object placed by domain, and the server that stores it.
+*/
+struct put_part {
+        int                     idx;
+        int                     rank;
+        struct bbox             bb;
+};
+
+/*
+  Halve the region 'bb' of object 'idx' on its longest dimension until
+  each part is indexed by a single DHT entry, or 'depth' runs out; the
+  parts are appended to 'pt_tab'. Returns the new number of parts.
+*/
+static int obj_put_split(struct sspace *ssd, struct bbox *bb, int idx,
+                         int depth, struct put_part *pt_tab, int num_pt)
+{
+        struct dht_entry *de_tab[ssd->dht->num_entries];
+        struct bbox b_tab[2];
+        int num_de, dim, d;
+
+        num_de = ssd_hash(ssd, bb, de_tab);
+        if (num_de > 1 && depth > 0) {
+                for (dim = 0, d = 1; d < bb->num_dims; d++)
+                        if (bbox_dist(bb, d) > bbox_dist(bb, dim))
+                                dim = d;
+                if (bbox_dist(bb, dim) > 1) {
+                        bbox_divide_in2_ondim(bb, b_tab, dim);
+                        num_pt = obj_put_split(ssd, &b_tab[0], idx, depth-1,
+                                               pt_tab, num_pt);
+                        return obj_put_split(ssd, &b_tab[1], idx, depth-1,
+                                             pt_tab, num_pt);
+                }
+        }
+
+        pt_tab[num_pt].idx = idx;
+        pt_tab[num_pt].rank = (num_de > 0) ? de_tab[0]->rank : -1;
+        pt_tab[num_pt].bb = *bb;
+        return num_pt + 1;
+}
+
+/*
+  Put the objects in 'od_tab' by domain: each object is split along
+  the DHT decomposition, and every server gets one batch with the parts
+  it indexes. The put completes when all the batches do.
+*/
+static int obj_put_place(struct obj_data *od_tab[], int num_obj)
+{
+        struct put_part *pt_tab, *pt;
+        struct obj_batch_ent *ent;
+        struct obj_data part;
+        struct sspace *ssd;
+        struct node_id *peer;
+        int num_sp = dcg->ss_info.num_space_srv;
+        uint64_t size_tab[num_sp];
+        int num_tab[num_sp];
+        int num_pt = 0, num_batch = 0, sync_op_id, rank, i, j;
+        char *buf, *data;
+        int err = -ENOMEM;
+
+        pt_tab = malloc(sizeof(*pt_tab) * num_obj << DCG_PLACE_SPLIT_DEPTH);
+        if (!pt_tab)
+                goto err_out;
+
+        for (i = 0; i < num_obj; i++) {
+                ssd = dcg_lookup_sspace(&od_tab[i]->gdim);
+                if (!ssd) {
+                        free(pt_tab);
+                        goto err_out;
+                }
+                num_pt = obj_put_split(ssd, &od_tab[i]->obj_desc.bb, i,
+                                       DCG_PLACE_SPLIT_DEPTH, pt_tab, num_pt);
+        }
 
-	while (dcg->num_pending) {
-	      dc_process(dcg->dc);
-	}
+        memset(size_tab, 0, sizeof(size_tab));
+        memset(num_tab, 0, sizeof(num_tab));
+        for (pt = pt_tab; pt < pt_tab + num_pt; pt++) {
+                if (pt->rank < 0 || pt->rank >= num_sp)
+                        pt->rank = dcg_put_peer()->ptlmap.id;
+                if (num_tab[pt->rank]++ == 0)
+                        num_batch++;
+                size_tab[pt->rank] += sizeof(*ent) + (uint64_t)
+                        od_tab[pt->idx]->obj_desc.size * bbox_volume(&pt->bb);
+        }
 
-    dc_free(dcg->dc);
-    qc_free(&dcg->qc);
-	lock_free();
+        /* Each batch completion counts up to 1. */
+        sync_op_id = syncop_next();
+        *syncop_ref(sync_op_id) = 1 - num_batch;
 
-    free_gdim_list(&dcg->gdim_list);
-    free(dcg);
-}
+        memset(&part, 0, sizeof(part));
+        for (rank = 0; rank < num_sp; rank++) {
+                if (!num_tab[rank])
+                        continue;
 
-void dcgrpc_kill(struct dcg_space *dcg)
-{
-	int peer_id;
-	struct node_id *peer;
-	struct hdr_dsg_kill *hdr;
-	struct msg_buf *msg;
-	int err;
+                err = -ENOMEM;
+                buf = malloc(size_tab[rank]);
+                if (!buf)
+                        break;
 
-	for(peer_id = 0; peer_id < dcg->dc->num_sp; peer_id++){
-	    peer = dc_get_peer(dcg->dc, peer_id);
-	    int sync_op_id = syncop_next();
-        msg = msg_buf_alloc(dcg->dc->rpc_s, peer, 1);
-	    if (!msg) {
-	        exit(-1);
+                ent = (struct obj_batch_ent *) buf;
+                data = (char *) (ent + num_tab[rank]);
+                for (j = 0, pt = pt_tab; pt < pt_tab + num_pt; pt++) {
+                        if (pt->rank != rank)
+                                continue;
+
+                        ent[j].odsc = od_tab[pt->idx]->obj_desc;
+                        ent[j].odsc.bb = pt->bb;
+                        memcpy(&ent[j].gdim, &od_tab[pt->idx]->gdim,
+                               sizeof(struct global_dimension));
+                        ent[j].rank = -1;
+
+                        part.obj_desc = ent[j].odsc;
+                        part.data = data;
+                        ssd_copy(&part, od_tab[pt->idx]);
+                        data += obj_data_size(&ent[j].odsc);
+                        j++;
+                }
+
+                peer = dc_get_peer(dcg->dc, rank);
+                err = obj_put_batch_post(peer, sync_op_id, num_tab[rank],
+                                         buf, size_tab[rank]);
+                if (err < 0) {
+                        free(buf);
+                        break;
+                }
+                num_batch--;
         }
-		msg->sync_op_id = syncop_ref(sync_op_id);
+        free(pt_tab);
 
-		msg->msg_rpc->cmd = ss_kill;
-		msg->msg_rpc->id = DCG_ID;
+        if (err < 0) {
+                /* Let the batches sent complete the operation. */
+                *syncop_ref(sync_op_id) += num_batch;
+                goto err_out;
+        }
 
-		hdr = (struct hdr_dsg_kill *)msg->msg_rpc->pad;
-	    hdr->kill_flag = 1;
-		err = rpc_send(dcg->dc->rpc_s, peer, msg);
-		if (err < 0) {
-		    free(msg);
-			uloga("RPC for kill failed with %d\n", err);
-			exit(-1);
-		}
-	}
+        return sync_op_id;
+ err_out:
+        uloga("'%s()': failed with %d.\n", __func__, err);
+        return err;
 }
 
 /*
@@ -1746,13 +2518,15 @@ int dcg_obj_put(struct obj_data *od)
         int sync_op_id;
         int err = -ENOMEM;
 
-        if (flag_set_mpi_rank) {
-            int peer_id = mpi_rank % dcg->dc->num_sp;
-            peer = dc_get_peer(dcg->dc, peer_id);
-        } else {
-            peer = dcg_which_peer();
+        if (dcg->data_placement == ds_place_domain) {
+                /* The parts are copied out, the object is done. */
+                sync_op_id = obj_put_place(&od, 1);
+                if (sync_op_id >= 0)
+                        obj_data_free(od);
+                return sync_op_id;
         }
 
+        peer = dcg_put_peer();
         sync_op_id = syncop_next();
 
         msg = msg_buf_alloc(dcg->dc->rpc_s, peer, 1);
@@ -1781,7 +2555,7 @@ int dcg_obj_put(struct obj_data *od)
 
         err = rpc_send(dcg->dc->rpc_s, peer, msg);
         if (err < 0) {
-                free(msg);
+                msg_buf_free(msg);
                 goto err_out;
         }
 
@@ -1793,6 +2567,53 @@ int dcg_obj_put(struct obj_data *od)
         return err;
 }
 
+/*
+  Put a batch of objects in one request: the server gets the
+  descriptors and the data of all the objects in one payload, and
+  updates each DHT peer once for the whole batch.
+*/
+int dcg_obj_put_batch(struct obj_data *od_tab[], int num_obj)
+{
+        struct obj_batch_ent *ent;
+        uint64_t size;
+        char *buf, *data;
+        int sync_op_id, i;
+        int err = -ENOMEM;
+
+        if (dcg->data_placement == ds_place_domain)
+                return obj_put_place(od_tab, num_obj);
+
+        size = sizeof(*ent) * num_obj;
+        for (i = 0; i < num_obj; i++)
+                size += obj_data_size(&od_tab[i]->obj_desc);
+
+        buf = malloc(size);
+        if (!buf)
+                goto err_out;
+
+        ent = (struct obj_batch_ent *) buf;
+        data = (char *) (ent + num_obj);
+        for (i = 0; i < num_obj; i++) {
+                ent[i].odsc = od_tab[i]->obj_desc;
+                memcpy(&ent[i].gdim, &od_tab[i]->gdim, sizeof(struct global_dimension));
+                ent[i].rank = -1;
+                memcpy(data, od_tab[i]->data, obj_data_size(&od_tab[i]->obj_desc));
+                data += obj_data_size(&od_tab[i]->obj_desc);
+        }
+
+        sync_op_id = syncop_next();
+        err = obj_put_batch_post(dcg_put_peer(), sync_op_id, num_obj, buf, size);
+        if (err < 0) {
+                free(buf);
+                goto err_out;
+        }
+
+        return sync_op_id;
+ err_out:
+        uloga("'%s()': failed with %d.\n", __func__, err);
+        return err;
+}
+
 // Write data to explicitly specified server (using server_id)
 int dcg_obj_put_to_server(struct obj_data *od, int server_id)
 {
@@ -1830,7 +2651,7 @@ int dcg_obj_put_to_server(struct obj_data *od, int server_id)
 
         err = rpc_send(dcg->dc->rpc_s, peer, msg);
         if (err < 0) {
-                free(msg);
+                msg_buf_free(msg);
                 goto err_out;
         }
 
@@ -1864,10 +2685,174 @@ int dcg_obj_sync(int sync_op_id)
         return err;
 }
 
+/*
+  Advance a get query once its replies are in: a query that used a
+  stale cached layout starts over through the DHT, others have their
+  object assembled. Returns 1 when the query is done, with the result
+  in 'qte->rc'.
+*/
+static int qte_progress(struct query_tran_entry *qte)
+{
+#ifndef SHMEM_OBJECTS
+        struct query_cache_entry *qce;
+        int err;
+
+        if (!qte->f_complete)
+                return 0;
+
+        if (qte->f_cached && qte->f_err) {
+                /* Stale layout; the entry may be gone already. */
+                qce = qc_find(&dcg->qc, &qte->q_obj, &qte->gdim);
+                if (qce) {
+                        qc_del_entry(&dcg->qc, qce);
+                        qce_free(qce);
+                }
+                qte_reset(qte);
+                err = obj_get_route(qte);
+                if (err < 0) {
+                        qte->rc = err;
+                        return 1;
+                }
+                return 0;
+        }
+
+        if (qte->f_err) {
+                qte->rc = -EAGAIN;
+                return 1;
+        }
+        if (!qte->f_cached && !qte->f_no_cache)
+                qc_add_query(&dcg->qc, qte);
+        qte->rc = dcg_obj_assemble(qte, qte->od_ref);
+#endif
+        return 1;
+}
+
+static void qte_release(struct query_tran_entry *qte)
+{
+        qt_free_obj_data(qte, 1);
+        qt_remove(&dcg->qt, qte);
+        qte_free(qte);
+}
+
+/*
+  Start a get for 'od' without waiting for it; '*pqte' is the handle
+  to pass to dcg_obj_test() or dcg_obj_wait(), which fill 'od->data'.
+  The queries of several gets in flight complete in any order.
+*/
+int dcg_obj_iget(struct obj_data *od, struct query_tran_entry **pqte)
+{
+        struct query_tran_entry *qte;
+#ifndef SHMEM_OBJECTS
+        struct query_cache_entry *qce;
+#endif
+        int err = -ENOMEM;
+
+        qte = qte_alloc(od, 1);
+        if (!qte)
+                goto err_out;
+        qte->od_ref = od;
+
+#ifdef SHMEM_OBJECTS
+        /* Shared memory gets are served in place. */
+        qte->rc = dcg_obj_get(od);
+        qt_add(&dcg->qt, qte);
+#else
+        qt_add(&dcg->qt, qte);
+
+        /* The layout seen for an earlier version is likely still good;
+           ask the owners for the pieces directly. */
+        qce = qc_find(&dcg->qc, &od->obj_desc, &od->gdim);
+        if (qce)
+                err = obj_get_cached(qte, qce);
+        else    err = obj_get_route(qte);
+        if (err < 0) {
+                qt_remove(&dcg->qt, qte);
+                qte_free(qte);
+                goto err_out;
+        }
+#endif
+        *pqte = qte;
+        return 0;
+ err_out:
+        ERROR_TRACE();
+}
+
+/*
+  Check a get started by dcg_obj_iget() without blocking. If it is
+  done or fails, '*done' is set, the handle is released and the result
+  of the get is returned.
+*/
+int dcg_obj_test(struct query_tran_entry *qte, int *done)
+{
+        int err;
+
+        *done = 0;
+#ifndef SHMEM_OBJECTS
+        err = dc_process(dcg->dc);
+        if (err < 0)
+                goto err_out;
+#endif
+        if (!qte_progress(qte))
+                return 0;
+
+        *done = 1;
+        err = qte->rc;
+        qte_release(qte);
+        return err;
+#ifndef SHMEM_OBJECTS
+ err_out:
+        *done = 1;
+        qte_release(qte);
+        ERROR_TRACE();
+#endif
+}
+
+/*
+  Wait for a get started by dcg_obj_iget(), release the handle and
+  return the result of the get. The handle is released on failure too;
+  replies that arrive for it later are dropped.
+*/
+int dcg_obj_wait(struct query_tran_entry *qte)
+{
+        int err;
+
+        while (!qte_progress(qte)) {
+                err = dc_process(dcg->dc);
+                if (err < 0) {
+                        qte_release(qte);
+                        uloga("'%s()': failed with %d.\n", __func__, err);
+                        return err;
+                }
+        }
+
+        err = qte->rc;
+        qte_release(qte);
+        return err;
+}
+
 int dcg_obj_get(struct obj_data *od)
 {
+#ifndef SHMEM_OBJECTS
+    struct query_tran_entry *qte;
+    int err;
+#ifdef TIMING_PERF
+    double tm_st, tm_end;
+    tm_st = timer_read(&tm_perf);
+#endif
 
-#ifdef SHMEM_OBJECTS    
+    versions_reset();
+
+    err = dcg_obj_iget(od, &qte);
+    if (err < 0)
+        return err;
+    err = dcg_obj_wait(qte);
+#ifdef TIMING_PERF
+    tm_end = timer_read(&tm_perf);
+    uloga("TIMING_PERF fetch_data ts %d peer %d time %lf %s\n",
+        od->obj_desc.version, dcg_get_rank(dcg), tm_end-tm_st, log_header);
+#endif
+    return err;
+#else
     char name[200];
     convert_to_string(&od->obj_desc, name);
     int shm_fd;
@@ -1886,10 +2871,7 @@ int dcg_obj_get(struct obj_data *od)
         return 0;
     }
 
-#endif
-
     struct query_tran_entry *qte;
-    const struct query_cache_entry *qce;
     int err = -ENOMEM;
 #ifdef TIMING_PERF
     double tm_st, tm_end;
@@ -1904,31 +2886,18 @@ int dcg_obj_get(struct obj_data *od)
 
     versions_reset();
 
-        // TODO:  I have  intentionately  disabled the  cache here.  I
-        // should reconsider.
-        // qce = qc_find(&dcg->qc, &od->obj_desc);
-    qce = 0;
-    if (qce) {
-        err = qte_set_odsc_from_cache(qte, qce);
-        if (err < 0) {
-            free(qte);
-            goto err_out;
-        }
-    }
-    else {
-        err = get_dht_peers(qte);
-        if (err < 0)
-            goto err_qt_free;
-        DC_WAIT_COMPLETION(qte->f_peer_received == 1);
+    err = get_dht_peers(qte);
+    if (err < 0)
+        goto err_qt_free;
+    DC_WAIT_COMPLETION(qte->f_peer_received == 1);
 
-        err = get_obj_descriptors(qte);
-        if (err < 0) {
-            if (err == -EAGAIN)
-                goto out_no_data;
-            else	goto err_qt_free;
-        }
-        DC_WAIT_COMPLETION(qte->f_odsc_recv == 1);
+    err = get_obj_descriptors(qte);
+    if (err < 0) {
+        if (err == -EAGAIN)
+            goto out_no_data;
+        else	goto err_qt_free;
     }
+    DC_WAIT_COMPLETION(qte->f_odsc_recv == 1);
 
     if (qte->f_err != 0) {
         err = -EAGAIN;
@@ -1942,7 +2911,8 @@ int dcg_obj_get(struct obj_data *od)
     tm_st = tm_end;
 #endif
 
-    err = dcg_obj_data_get(qte);
+    if (!qte->f_complete)
+        err = dcg_obj_data_get(qte);
     if (err < 0) {
                 // FIXME: should I jump to err_qt_free ?
         qt_free_obj_data(qte, 1);
@@ -1973,12 +2943,7 @@ int dcg_obj_get(struct obj_data *od)
                 od->obj_desc.version, dcg_get_rank(dcg), tm_end-tm_st, log_header);
 #endif 
 out_no_data:
-#ifdef SHMEM_OBJECTS
     qt_free_obj_data_shmem(qte, 1);
-#endif
-#ifndef SHMEM_OBJECTS
-    qt_free_obj_data(qte, 1);
-#endif
     if(err == -ENODATA) {
     	printf("got nothing in dspaces_get\n");
     }
@@ -1992,14 +2957,128 @@ err_qt_free:
     free(qte);
 err_out:
     ERROR_TRACE();
+#endif
 }
 
 
+/*
+  Get a batch of objects. The queries run concurrently: those with a
+  cached layout go to the owners, the others share one request per DHT
+  peer. Returns -EAGAIN if an object is not (yet) in the space.
+*/
+int dcg_obj_get_batch(struct obj_data *od_tab[], int num_obj)
+{
+#ifdef SHMEM_OBJECTS
+    int i, err = 0;
+
+    for (i = 0; i < num_obj && err >= 0; i++)
+        err = dcg_obj_get(od_tab[i]);
+
+    return err;
+#else
+    struct query_tran_entry **qte_tab, **route_tab, *qte;
+    struct query_cache_entry *qce;
+    int num_qte = 0, num_route = 0, i, rc = 0;
+    int err = -ENOMEM;
+
+    qte_tab = malloc(sizeof(*qte_tab) * num_obj);
+    route_tab = malloc(sizeof(*route_tab) * num_obj);
+    if (!qte_tab || !route_tab)
+        goto out;
+
+    for (num_qte = 0; num_qte < num_obj; num_qte++) {
+        qte_tab[num_qte] = qte_alloc(od_tab[num_qte], 1);
+        if (!qte_tab[num_qte])
+            goto out;
+        qt_add(&dcg->qt, qte_tab[num_qte]);
+    }
+
+    versions_reset();
+
+    for (i = 0; i < num_qte; i++) {
+        qce = qc_find(&dcg->qc, &qte_tab[i]->q_obj, &qte_tab[i]->gdim);
+        if (!qce) {
+            route_tab[num_route++] = qte_tab[i];
+            continue;
+        }
+        err = obj_get_cached(qte_tab[i], qce);
+        if (err < 0)
+            goto err_wait;
+    }
+    if (num_route > 0) {
+        err = obj_get_route_batch(route_tab, num_route);
+        if (err < 0)
+            goto err_wait;
+    }
+    for (i = 0; i < num_qte; i++)
+        DC_WAIT_COMPLETION(qte_tab[i]->f_complete == 1);
+
+    /* Stale cached layouts start over through the DHT. */
+    num_route = 0;
+    for (i = 0; i < num_qte; i++) {
+        qte = qte_tab[i];
+        if (!qte->f_cached || !qte->f_err)
+            continue;
+
+        qce = qc_find(&dcg->qc, &qte->q_obj, &qte->gdim);
+        if (qce) {
+            qc_del_entry(&dcg->qc, qce);
+            qce_free(qce);
+        }
+        qte_reset(qte);
+        route_tab[num_route++] = qte;
+    }
+    if (num_route > 0) {
+        err = obj_get_route_batch(route_tab, num_route);
+        if (err < 0)
+            goto err_wait;
+        for (i = 0; i < num_route; i++)
+            DC_WAIT_COMPLETION(route_tab[i]->f_complete == 1);
+    }
+
+    for (i = 0; i < num_qte; i++) {
+        qte = qte_tab[i];
+        if (qte->f_err) {
+            rc = -EAGAIN;
+            continue;
+        }
+        if (!qte->f_cached && !qte->f_no_cache)
+            qc_add_query(&dcg->qc, qte);
+
+        err = dcg_obj_assemble(qte, od_tab[i]);
+        if (err < 0 && rc == 0)
+            rc = err;
+    }
+    err = rc;
+ out:
+    for (i = 0; i < num_qte; i++) {
+        qt_free_obj_data(qte_tab[i], 1);
+        qt_remove(&dcg->qt, qte_tab[i]);
+        qte_free(qte_tab[i]);
+    }
+    free(qte_tab);
+    free(route_tab);
+    if (err < 0 && err != -EAGAIN)
+        uloga("'%s()': failed with %d.\n", __func__, err);
+    return err;
+ err_wait:
+    /* Let the requests in flight finish before dropping the queries. */
+    rc = err;
+    for (i = 0; i < num_qte; i++)
+        if (qte_tab[i]->f_peer_received)
+            DC_WAIT_COMPLETION(qte_tab[i]->f_complete == 1);
+    err = rc;
+    goto out;
+ err_out:
+    ERROR_TRACE();
+#endif
+}
+
 static int nvars_get_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
 {
     	int *var = (int*)(msg->private);
 	*var = 0;
-	free(msg);
+	msg_buf_free(msg);
         return 0;
 }
 
@@ -2036,7 +3115,7 @@ int dcg_obj_get_nvars(int type, int ver, char *name, int *var_array, int *comp)
     err = rpc_receive(dcg->dc->rpc_s, peer, msg);
 
     if(err < 0){
-        free(msg);
+        msg_buf_free(msg);
         goto err_out;
     }
     if(err == 0)
@@ -2078,7 +3157,7 @@ int dcg_obj_get_varBuffer(int ver, int length, char* data, char* name, int* comp
     err = rpc_receive(dcg->dc->rpc_s, peer, msg);
 
     if(err < 0){
-        free(msg);
+        msg_buf_free(msg);
         goto err_out;
     }
     if(err == 0)
@@ -2187,7 +3266,6 @@ int dcg_get_versions(int **p_version)
 int dcg_obj_filter(struct obj_data *od)
 {
         struct query_tran_entry *qte;
-        const struct query_cache_entry *qce;
         int err = -ENOMEM;
 
         qte = qte_alloc(od, 1);
@@ -2196,25 +3274,17 @@ int dcg_obj_filter(struct obj_data *od)
         // DELETE: qt_set(qte, od);
         qt_add(&dcg->qt, qte);
 
-        qce = qc_find(&dcg->qc, &od->obj_desc);
-        if (qce) {
-                err = qte_set_odsc_from_cache(qte, qce);
-                if (err < 0) {
-                        free(qte);
-                        goto err_out;
-                }
-        }
-        else {
-                err = get_dht_peers(qte);
-                if (err < 0)
-                        goto err_out;
-                DC_WAIT_COMPLETION(qte->f_peer_received == 1);
+        /* The filter has no way to recover from a stale cached
+           layout, so it always asks the DHT. */
+        err = get_dht_peers(qte);
+        if (err < 0)
+                goto err_out;
+        DC_WAIT_COMPLETION(qte->f_peer_received == 1);
 
-                err = get_obj_descriptors(qte);
-                if (err < 0)
-                        goto err_out;
-                DC_WAIT_COMPLETION(qte->f_odsc_recv == 1);
-        }
+        err = get_obj_descriptors(qte);
+        if (err < 0)
+                goto err_out;
+        DC_WAIT_COMPLETION(qte->f_odsc_recv == 1);
 
         err = obj_filter_init(qte);
         if (err < 0)
@@ -2250,6 +3320,7 @@ int dcg_ss_info(struct dcg_space *dcg, int *num_dims)
 
 	msg->msg_rpc->cmd = ss_info;
 	msg->msg_rpc->id = DCG_ID;
+	((struct hdr_ss_info *) msg->msg_rpc->pad)->split_op = ss_split_none;
 
 	err = rpc_send(dcg->dc->rpc_s, peer, msg);
 	if (err < 0)
@@ -2355,7 +3426,7 @@ int dcg_remove(const char *var_name, unsigned int ver)
 
 	        err = rpc_send(dcg->dc->rpc_s, peer, msg);
 	        if (err < 0) {
-        	        free(msg);
+        	        msg_buf_free(msg);
                 	goto err_out;
 	        }
 	}
@@ -2617,7 +3688,7 @@ dcg_code_rexec_at_peers(const void *fn_addr, int size, int off,
 
 		err = rpc_send(dcg->dc->rpc_s, peer, msg);
 		if (err < 0) {
-			free(msg);
+			msg_buf_free(msg);
 			goto err_out;
 		}
 	}
@@ -40,6 +40,7 @@
 #include "dart.h"
 #include "ds_gspace.h"
 #include "ss_data.h"
+#include "mempool.h"
 #ifdef DS_HAVE_ACTIVESPACE
 #include "rexec.h"
 #endif
@@ -64,6 +65,19 @@ struct req_pending {
         struct rpc_cmd          cmd;
 };
 
+/*
+  Request waiting for the DHT split of 'epoch': an RPC replayed with
+  'fn', or a descriptor update if 'fn' is NULL.
+*/
+struct split_wait {
+        struct list_head        entry;
+        int                     epoch;
+        rpc_service             fn;
+        struct rpc_cmd          cmd;
+        struct obj_descriptor   odsc;
+        struct global_dimension gdim;
+};
+
 enum lock_service {
         lock_unknown = 0,
         lock_generic,
@@ -111,6 +125,38 @@ struct dsg_lock {
         int                     (*service)(struct dsg_lock *, struct rpc_server *, struct rpc_cmd *);
 };
 
+/*
+  Request handed to a worker thread. The worker only prepares the
+  reply message; the reply is posted from the RPC thread.
+*/
+struct dsg_work {
+        struct list_head        work_entry;
+        struct rpc_cmd          cmd;
+
+        int                     (*prepare)(struct rpc_cmd *, struct msg_buf **);
+        /* Reply is raw data (rpc_send_direct) or an RPC (rpc_send). */
+        int                     f_direct;
+        /* Reply is a vector of buffers (rpc_send_directv). */
+        int                     f_vec;
+        struct msg_buf          *msg;
+};
+
+#if HAVE_TCP_SOCKET
+/* Replies to  'ss_obj_get' are gathered from  at most this many runs
+   of a stored object ... */
+#define DSG_GET_MAX_IOV         1024
+#else
+/* ... the other transports only send contiguous runs without a copy. */
+#define DSG_GET_MAX_IOV         1
+#endif
+/* ... of at least this many bytes each; they are copied otherwise. */
+#define DSG_GET_MIN_RUN         4096
+
+static struct mem_pool req_pending_pool =
+        MEM_POOL_INIT("req_pending", sizeof(struct req_pending), 64);
+static struct mem_pool dsg_work_pool =
+        MEM_POOL_INIT("dsg_work", sizeof(struct dsg_work), 256);
+
 static struct ds_gspace *dsg;
 
 /* Server configuration parameters */
@@ -120,7 +166,13 @@ static struct {
         int max_versions;
         int max_readers;
         int lock_type;		/* 1 - generic, 2 - custom */
-        int hash_version;   /* 1 - ssd_hash_version_v1, 2 - ssd_hash_version_v2 */
+        int hash_version;   /* 1 - ssd_hash_version_v1, 2 - ssd_hash_version_v2,
+                               3 - ssd_hash_version_v3 */
+        int num_workers;    /* 0 - process requests on the RPC thread */
+        int data_placement; /* 0 - ds_place_writer, 1 - ds_place_domain */
+        int mem_budget;     /* MB of object data kept in memory, 0 - no limit */
+        int payload_arena;  /* MB per payload arena mapping, 0 - use malloc */
+        int dht_rebalance;  /* versions per DHT split epoch, 0 - static split */
 } ds_conf;
 
 static struct {
@@ -133,6 +185,11 @@ static struct {
         {"max_readers",         &ds_conf.max_readers},
         {"lock_type",           &ds_conf.lock_type},
         {"hash_version",        &ds_conf.hash_version}, 
+        {"num_workers",         &ds_conf.num_workers},
+        {"data_placement",      &ds_conf.data_placement},
+        {"memory_budget",       &ds_conf.mem_budget},
+        {"payload_arena",       &ds_conf.payload_arena},
+        {"dht_rebalance",       &ds_conf.dht_rebalance},
 };
 
 static void eat_spaces(char *line)
@@ -246,6 +303,13 @@ static int init_sspace(struct bbox *default_domain, struct ds_gspace *dsg_l)
     if (err < 0)
         goto err_out;
 
+    if (ds_conf.dht_rebalance > 0) {
+        err = ssd_split_init(dsg_l->ssd, ds_conf.dht_rebalance,
+                             ds_get_rank(dsg_l->ds) == 0);
+        if (err < 0)
+            goto err_out;
+    }
+
     dsg_l->default_gdim.ndim = ds_conf.ndim;
     int i;
     for (i = 0; i < ds_conf.ndim; i++) {
@@ -274,7 +338,7 @@ static int free_sspace(struct ds_gspace *dsg_l)
     return 0;
 }
 
-static struct sspace* lookup_sspace(struct ds_gspace *dsg_l, const char* var_name, const struct global_dimension* gd)
+static struct sspace* __lookup_sspace(struct ds_gspace *dsg_l, const char* var_name, const struct global_dimension* gd)
 {
     struct global_dimension gdim;
     memcpy(&gdim, gd, sizeof(struct global_dimension));
@@ -336,6 +400,18 @@ static struct sspace* lookup_sspace(struct ds_gspace *dsg_l, const char* var_nam
     return ssd_entry->ssd;
 }
 
+static struct sspace* lookup_sspace(struct ds_gspace *dsg_l, const char* var_name, const struct global_dimension* gd)
+{
+    struct sspace *ssd;
+
+    /* Workers may add a shared space concurrently. */
+    pthread_mutex_lock(&dsg_l->sspace_lock);
+    ssd = __lookup_sspace(dsg_l, var_name, gd);
+    pthread_mutex_unlock(&dsg_l->sspace_lock);
+
+    return ssd;
+}
+
 #ifdef DS_HAVE_ACTIVESPACE
 static int bin_code_local_bind(void *pbuf, int offset)
 {
@@ -440,7 +516,7 @@ static int bin_code_return_result(struct rexec_args *rargs, struct node_id *peer
 	if (err == 0)
 		return 0;
 
-	free(msg);
+	msg_buf_free(msg);
  err_out:
 	ERROR_TRACE();
 }
@@ -480,6 +556,7 @@ static int bin_code_put_completion(struct rpc_server *rpc_s, struct msg_buf *msg
 
 	struct obj_data *from_obj;
 
+	pthread_rwlock_rdlock(&dsg->ls_lock);
     from_obj = ls_find(dsg->ls, &hc->odsc);
 	// TODO: what if you can not find it ?!
 
@@ -487,6 +564,7 @@ static int bin_code_put_completion(struct rpc_server *rpc_s, struct msg_buf *msg
 
 	err = bin_code_local_exec((bin_code_fn_t) msg->msg_data, 
 			from_obj, &hc->odsc, &rargs);
+	pthread_rwlock_unlock(&dsg->ls_lock);
 
 	peer = ds_get_peer(dsg->ds, msg->peer->ptlmap.id);
 	// TODO:  write the error  path here  ... msg->peer  is const;
@@ -503,7 +581,7 @@ static int bin_code_put_completion(struct rpc_server *rpc_s, struct msg_buf *msg
 	*/
 
 	free(msg->private);
-	free(msg);
+	msg_buf_free(msg);
 
 	r_exit++;
 
@@ -538,7 +616,7 @@ static int dsgrpc_bin_code_put(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 		return 0;
 
 	free(msg->private);
-	free(msg);
+	msg_buf_free(msg);
  err_out:
 	ERROR_TRACE();
 }
@@ -595,7 +673,7 @@ static int dsg_lock_put_on_wait(struct dsg_lock *dl, struct rpc_cmd *cmd)
         struct req_pending *rr;
         int err = -ENOMEM;
 
-        rr = malloc(sizeof(*rr));
+        rr = mem_pool_alloc(&req_pending_pool);
         if (!rr)
                 goto err_out;
 
@@ -630,7 +708,7 @@ static int dsg_lock_grant(struct node_id *peer, struct lockhdr *lhr)
         err = rpc_send(dsg->ds->rpc_s, peer, msg);
         if (err == 0)
                 return 0;
-        free(msg);
+        msg_buf_free(msg);
  err_out:
         ERROR_TRACE();
 }
@@ -708,7 +786,7 @@ static int lock_process_wait_list(struct dsg_lock *dl)
                 }
 
                 list_del(&rr->req_entry);
-                free(rr);
+                mem_pool_free(&req_pending_pool, rr);
         }
 
         return 0;
@@ -788,7 +866,7 @@ static int sem_process_wait_list(struct dsg_lock *dl)
                                 goto err_out;
 
                         list_del(&rr->req_entry);
-                        free(rr);
+                        mem_pool_free(&req_pending_pool, rr);
 
                         /* I can  only grant one lock now;  it is safe
                            to break here. */
@@ -884,7 +962,7 @@ static int lock_process_wait_list_v3(struct dsg_lock *dl)
                 }
 
                 list_del(&rr->req_entry);
-                free(rr);
+                mem_pool_free(&req_pending_pool, rr);
         }
 
         return 0;
@@ -1090,19 +1168,17 @@ static int dsgrpc_remove_service(struct rpc_server *rpc, struct rpc_cmd *cmd)
 
 	if (!dsg->ls) return 0;
 
-	struct obj_data *od, *t;
-	struct list_head *list;
-	int i;
+	struct obj_data *od;
 
-	for (i = 0; i < dsg->ls->size_hash; i++) {
-        	list = &(dsg->ls)->obj_hash[i];
-	        list_for_each_entry_safe(od, t, list, struct obj_data, obj_entry ) {
-			if (od->obj_desc.version == lh->lock_num && !strcmp(od->obj_desc.name,lh->name) ) {
-				ls_remove(dsg->ls, od);
-				obj_data_free(od);
-			}
-		}
+	pthread_rwlock_wrlock(&dsg->ls_lock);
+	while ((od = ls_lookup_version(dsg->ls, lh->name, lh->lock_num))) {
+		ls_remove(dsg->ls, od);
+		/* A worker still copies from it, see dsg_obj_unpin(). */
+		if (od->refcnt > 0)
+			od->f_free = 1;
+		else	obj_data_free(od);
 	}
+	pthread_rwlock_unlock(&dsg->ls_lock);
 
         
 	return 0;
@@ -1239,6 +1315,148 @@ static char *obj_desc_sprint(const struct obj_descriptor *odsc)
 	return str;
 }
 
+/*
+  Clients that looked up  the layout of a variable here and may cache
+  it; they are told when a writer changes the decomposition.
+*/
+struct layout_watch {
+        struct list_head        lw_entry;
+        char                    name[sizeof(((struct obj_descriptor *) 0)->name)];
+
+        /* Bitmap of the client ranks. */
+        unsigned char           *rank_map;
+        int                     size_map;
+};
+
+static struct layout_watch *layout_watch_find(struct ds_gspace *dsg,
+                                              const char *name)
+{
+        struct layout_watch *lw;
+
+        list_for_each_entry(lw, &dsg->layout_watch_list, struct layout_watch, lw_entry) {
+                if (strcmp(lw->name, name) == 0)
+                        return lw;
+        }
+
+        return NULL;
+}
+
+static int layout_watch_add(struct ds_gspace *dsg, const char *name, int rank)
+{
+        struct layout_watch *lw;
+        unsigned char *map;
+        int size;
+
+        lw = layout_watch_find(dsg, name);
+        if (!lw) {
+                lw = calloc(1, sizeof(*lw));
+                if (!lw)
+                        return -ENOMEM;
+                strncpy(lw->name, name, sizeof(lw->name) - 1);
+                lw->name[sizeof(lw->name) - 1] = '\0';
+                list_add(&lw->lw_entry, &dsg->layout_watch_list);
+        }
+
+        if (rank / 8 >= lw->size_map) {
+                size = rank / 8 + 1;
+                if (size < dsg->ds->peer_size / 8 + 1)
+                        size = dsg->ds->peer_size / 8 + 1;
+                map = realloc(lw->rank_map, size);
+                if (!map)
+                        return -ENOMEM;
+                memset(map + lw->size_map, 0, size - lw->size_map);
+                lw->rank_map = map;
+                lw->size_map = size;
+        }
+        lw->rank_map[rank / 8] |= 1 << (rank % 8);
+
+        return 0;
+}
+
+/*
+  The layout of 'odsc' is new: tell the clients watching its variable
+  to drop their cached layouts, and forget them until they look again.
+*/
+static int layout_watch_notify(struct ds_gspace *dsg,
+                               const struct obj_descriptor *odsc)
+{
+        struct layout_watch *lw;
+        struct hdr_obj_get *oh;
+        struct msg_buf *msg;
+        struct node_id *peer;
+        int i, err = 0;
+
+        lw = layout_watch_find(dsg, odsc->name);
+        if (!lw)
+                return 0;
+
+        for (i = 0; i < lw->size_map * 8; i++) {
+                if (!(lw->rank_map[i / 8] & (1 << (i % 8))))
+                        continue;
+
+                peer = ds_get_peer(dsg->ds, i);
+                msg = msg_buf_alloc(dsg->ds->rpc_s, peer, 1);
+                if (!msg) {
+                        err = -ENOMEM;
+                        continue;
+                }
+
+                msg->msg_rpc->cmd = ss_obj_cache_inval;
+                msg->msg_rpc->id = DSG_ID;
+
+                oh = (struct hdr_obj_get *) msg->msg_rpc->pad;
+                oh->u.o.odsc = *odsc;
+
+                if (rpc_send(dsg->ds->rpc_s, peer, msg) < 0) {
+                        msg_buf_free(msg);
+                        err = -EIO;
+                }
+        }
+
+        list_del(&lw->lw_entry);
+        free(lw->rank_map);
+        free(lw);
+
+        if (err < 0)
+                uloga("'%s()': failed with %d.\n", __func__, err);
+        return err;
+}
+
+static void layout_watch_free(struct ds_gspace *dsg)
+{
+        struct layout_watch *lw, *t;
+
+        list_for_each_entry_safe(lw, t, &dsg->layout_watch_list, struct layout_watch, lw_entry) {
+                list_del(&lw->lw_entry);
+                free(lw->rank_map);
+                free(lw);
+        }
+}
+
+/*
+  Add an object descriptor to our part of the DHT; the lowest ranked
+  DHT peer of the object ('f_cq') also checks the continuous queries.
+*/
+static int obj_update_dht_local(struct sspace *ssd, struct obj_descriptor *odsc,
+                                int f_cq)
+{
+        int f_new_layout, err;
+
+        pthread_rwlock_wrlock(&dsg->dht_lock);
+        f_new_layout = !dht_find_layout(ssd->ent_self, odsc);
+        err = dht_add_entry(ssd->ent_self, odsc);
+        pthread_rwlock_unlock(&dsg->dht_lock);
+        if (err < 0)
+                return err;
+
+        if (f_new_layout)
+                layout_watch_notify(dsg, odsc);
+        if (f_cq)
+                return cq_check_match(odsc);
+
+        return 0;
+}
+
 /*
   Rpc routine to update (add or insert) an object descriptor in the
   dht table.
@@ -1247,7 +1465,6 @@ static int dsgrpc_obj_update(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 {
         struct hdr_obj_get *oh = (struct hdr_obj_get *) cmd->pad;
         struct sspace* ssd = lookup_sspace(dsg, oh->u.o.odsc.name, &oh->gdim); 
-        struct dht_entry *de = ssd->ent_self;
         int err;
 
 #ifdef DEBUG
@@ -1261,38 +1478,153 @@ static int dsgrpc_obj_update(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 	free(str);
 #endif
         oh->u.o.odsc.owner = cmd->id;
-        err = dht_add_entry(de, &oh->u.o.odsc);
+        err = obj_update_dht_local(ssd, &oh->u.o.odsc, DSG_ID == oh->rank);
         if (err < 0)
                 goto err_out;
 
-        if (DSG_ID == oh->rank) {
-                err = cq_check_match(&oh->u.o.odsc);
-                if (err == 0)
-                        return 0;
-        }
         return 0;
  err_out:
         ERROR_TRACE();
 }
 
-/* 
-   Update the DHT metadata with the new obj_descriptor information.
+/*
+  Return 1 if the DHT split for objects of 'version' is set in 'ssd';
+  server 0 sets it here from the load reported so far, and returns the
+  error if it fails to.
 */
-static int obj_put_update_dht(struct ds_gspace *dsg, struct obj_data *od)
+static int dsg_split_ready(struct sspace *ssd, unsigned int version)
+{
+        uint16_t w_tab[SSD_SPLIT_BUCKETS];
+        int epoch, err;
+
+        if (!ssd->split_period)
+                return 1;
+
+        epoch = ssd_split_epoch(ssd, version);
+        if (ssd_split_find(ssd, epoch))
+                return 1;
+        if (DSG_ID != 0)
+                return 0;
+
+        ssd_split_decide(ssd, w_tab);
+        err = ssd_split_set(ssd, epoch, w_tab);
+        if (err < 0)
+                return err;
+        return 1;
+}
+
+/*
+  Ask server 0 for the DHT split of 'epoch', and report the load we
+  have seen since the last request.
+*/
+static int dsg_split_request(int epoch)
+{
+        struct node_id *peer = ds_get_peer(dsg->ds, 0);
+        uint16_t w_tab[SSD_SPLIT_BUCKETS];
+        struct hdr_ss_info *hsi;
+        struct msg_buf *msg;
+        int err = -ENOMEM;
+
+        msg = msg_buf_alloc(dsg->ds->rpc_s, peer, 1);
+        if (!msg)
+                goto err_out;
+
+        msg->msg_rpc->cmd = ss_info;
+        msg->msg_rpc->id = DSG_ID;
+
+        hsi = (struct hdr_ss_info *) msg->msg_rpc->pad;
+        hsi->split_op = ss_split_get;
+        hsi->split_epoch = epoch;
+        hsi->split_shift = ssd_split_take_load(dsg->ssd, w_tab);
+        memcpy(hsi->split_w, w_tab, sizeof(w_tab));
+
+        err = rpc_send(dsg->ds->rpc_s, peer, msg);
+        if (err == 0)
+                return 0;
+
+        msg_buf_free(msg);
+ err_out:
+        ERROR_TRACE();
+}
+
+/*
+  Queue 'sw' until the split of its epoch arrives; the first waiter of
+  an epoch sends the request.
+*/
+static int dsg_split_wait(struct split_wait *sw)
+{
+        struct split_wait *w;
+        int err;
+
+        list_for_each_entry(w, &dsg->split_wait_list, struct split_wait, entry) {
+                if (w->epoch == sw->epoch) {
+                        list_add_tail(&sw->entry, &dsg->split_wait_list);
+                        return 0;
+                }
+        }
+
+        err = dsg_split_request(sw->epoch);
+        if (err < 0) {
+                free(sw);
+                return err;
+        }
+
+        list_add_tail(&sw->entry, &dsg->split_wait_list);
+        return 0;
+}
+
+/* Replay the RPC 'cmd' with 'fn' once the split of 'version' is set. */
+static int dsg_split_wait_cmd(unsigned int version, rpc_service fn,
+                              const struct rpc_cmd *cmd)
+{
+        struct split_wait *sw;
+
+        sw = malloc(sizeof(*sw));
+        if (!sw)
+                return -ENOMEM;
+
+        sw->epoch = ssd_split_epoch(dsg->ssd, version);
+        sw->fn = fn;
+        sw->cmd = *cmd;
+
+        return dsg_split_wait(sw);
+}
+
+/*
+  Update the DHT metadata of the peers indexing 'odsc', or queue the
+  update until the split of its version is set.
+*/
+static int obj_update_dht(struct sspace *ssd, struct obj_descriptor *odsc,
+                          const struct global_dimension *gdim)
 {
-    struct obj_descriptor *odsc = &od->obj_desc;
-    struct sspace* ssd = lookup_sspace(dsg, odsc->name, &od->gdim);
 	struct dht_entry *dht_tab[ssd->dht->num_entries];
 	/* TODO: create a separate header structure for object
 	   updates; for now just abuse the hdr_obj_get. */
 	struct hdr_obj_get *oh;
+	struct split_wait *sw;
 	struct msg_buf *msg;
 	struct node_id *peer;
 	int num_de, i, min_rank, err;
 
+	if (!dsg_split_ready(ssd, odsc->version)) {
+		sw = malloc(sizeof(*sw));
+		if (!sw)
+			return -ENOMEM;
+
+		sw->epoch = ssd_split_epoch(ssd, odsc->version);
+		sw->fn = NULL;
+		sw->odsc = *odsc;
+		sw->gdim = *gdim;
+		return dsg_split_wait(sw);
+	}
+
 	/* Compute object distribution to nodes in the space. */
 	ulog("server %d determining object hash.", DSG_ID);
-	num_de = ssd_hash(ssd, &odsc->bb, dht_tab);
+	num_de = ssd_hash_ver(ssd, &odsc->bb, odsc->version, dht_tab);
+	if (num_de < 0) {
+		err = num_de;
+		goto err_out;
+	}
 	if (num_de == 0) {
 		uloga("'%s()': this should not happen, num_de == 0 ?!\n",
 			__func__);
@@ -1313,12 +1645,10 @@ static int obj_put_update_dht(struct ds_gspace *dsg, struct obj_data *od)
 			uloga("'%s()': %s\n", __func__, str);
 			free(str);
 #endif
-			dht_add_entry(ssd->ent_self, odsc);
-			if (peer->ptlmap.id == min_rank) {
-				err = cq_check_match(odsc);
-				if (err < 0)
-					goto err_out;
-			}
+			err = obj_update_dht_local(ssd, odsc,
+					peer->ptlmap.id == min_rank);
+			if (err < 0)
+				goto err_out;
 			continue;
 
 #ifdef DEBUG
@@ -1346,11 +1676,11 @@ static int obj_put_update_dht(struct ds_gspace *dsg, struct obj_data *od)
 		oh = (struct hdr_obj_get *) msg->msg_rpc->pad;
 		oh->u.o.odsc = *odsc;
 		oh->rank = min_rank;
-        memcpy(&oh->gdim, &od->gdim, sizeof(struct global_dimension));
+        memcpy(&oh->gdim, gdim, sizeof(struct global_dimension));
 
 		err = rpc_send(dsg->ds->rpc_s, peer, msg);
 		if (err < 0) {
-			free(msg);
+			msg_buf_free(msg);
 			goto err_out;
 		}
 	}
@@ -1360,34 +1690,37 @@ static int obj_put_update_dht(struct ds_gspace *dsg, struct obj_data *od)
 	ERROR_TRACE();
 }
 
+/* 
+   Update the DHT metadata with the new obj_descriptor information.
+*/
+static int obj_put_update_dht(struct ds_gspace *dsg, struct obj_data *od)
+{
+        struct sspace* ssd = lookup_sspace(dsg, od->obj_desc.name, &od->gdim);
+
+        ssd_split_add_load(ssd, &od->obj_desc.bb, od->obj_desc.size);
+        return obj_update_dht(ssd, &od->obj_desc, &od->gdim);
+}
+
 /*
     obj_put synchronization completion
     Remove msg_ds buffer after obj_put_completion() send back rpc call
 */
 #ifdef DS_SYNC_MSG
 static int obj_put_sync_completion(struct rpc_server *rpc_s, struct msg_buf *msg){
-    free(msg);
+    msg_buf_free(msg);
     return 0;
 }
-#endif
 
 /*
+    Tell the client that the put of 'sync_op_id' is complete.
 */
-static int obj_put_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+static void obj_put_sync_reply(struct rpc_server *rpc_s, struct node_id *peer_ds,
+                               int *sync_op_id)
 {
-    struct obj_data *od = msg->private;
-    ls_add_obj(dsg->ls, od);
-
-#ifdef DS_SYNC_MSG
     struct msg_buf *msg_ds;
-    struct node_id *peer_ds;
     struct hdr_obj_put *hdr_ds;
     int err = -ENOMEM;
 
-
-
-
-    peer_ds = (struct node_id*)msg->peer;
     msg_ds = msg_buf_alloc(rpc_s, peer_ds, 1);
 
     msg_ds->msg_rpc->cmd = ds_put_completion;
@@ -1395,19 +1728,34 @@ static int obj_put_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
     msg_ds->cb = obj_put_sync_completion;
 
     hdr_ds = (struct hdr_obj_put *)msg_ds->msg_rpc->pad;
-    hdr_ds->sync_op_id_ptr = msg->sync_op_id;
+    hdr_ds->sync_op_id_ptr = sync_op_id;
 
     err = rpc_send(rpc_s, peer_ds, msg_ds);
 
 
     if (err < 0){
-        free(msg_ds);
+        msg_buf_free(msg_ds);
         uloga("%s(): rpc_send fail from ds_put_completion\n",__func__);
 
     }
+}
+#endif
+
+/*
+*/
+static int obj_put_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+    struct obj_data *od = msg->private;
+
+    pthread_rwlock_wrlock(&dsg->ls_lock);
+    ls_add_obj(dsg->ls, od);
+    pthread_rwlock_unlock(&dsg->ls_lock);
+
+#ifdef DS_SYNC_MSG
+    obj_put_sync_reply(rpc_s, (struct node_id*)msg->peer, msg->sync_op_id);
 #endif
     
-    free(msg);
+    msg_buf_free(msg);
 #ifdef DEBUG
     uloga("'%s()': server %d finished receiving  %s, version %d.\n",
         __func__, DSG_ID, od->obj_desc.name, od->obj_desc.version);
@@ -1416,6 +1764,85 @@ static int obj_put_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
     return 0;
 }
 
+static int dsg_work_post(struct rpc_cmd *cmd, 
+        int (*prepare)(struct rpc_cmd *, struct msg_buf **), int f_direct);
+
+static void dsg_obj_unpin(struct obj_data *od);
+static int obj_get_ref_completion(struct rpc_server *rpc_s, struct msg_buf *msg);
+
+/* Victims picked at once to make room for a put. */
+#define DSG_SPILL_MAX           16
+
+/*
+  Spill a stored object picked by ls_spill_pick(); the file is written
+  without the storage lock, which is taken again only to switch the
+  object to the mapping.
+*/
+static int dsg_obj_spill(struct obj_data *od)
+{
+        void *map = NULL;
+        int err;
+
+        err = ls_spill_write(dsg->ls, od, &map);
+        if (err < 0)
+                uloga("'%s()': failed with %d.\n", __func__, err);
+
+        pthread_rwlock_wrlock(&dsg->ls_lock);
+        ls_spill_done(dsg->ls, od, map);
+        pthread_rwlock_unlock(&dsg->ls_lock);
+        dsg_obj_unpin(od);
+
+        return err;
+}
+
+/*
+  Worker side of dsg_obj_spill(); 'cmd' carries the object, there is
+  no reply.
+*/
+static int obj_spill_prepare(struct rpc_cmd *cmd, struct msg_buf **pmsg)
+{
+        struct obj_data *od;
+
+        memcpy(&od, cmd->pad, sizeof(od));
+        return dsg_obj_spill(od);
+}
+
+/*
+  Make room for 'size' bytes of incoming object data within the
+  memory budget; if nothing can be spilled the put still proceeds.
+  The victims are written by the workers, if any, so the put does not
+  wait for them.
+*/
+static void dsg_mem_reserve(uint64_t size)
+{
+        struct obj_data *od_tab[DSG_SPILL_MAX];
+        struct rpc_cmd cmd;
+        int i, n;
+
+        if (!dsg->ls->mem_budget)
+                return;
+
+        do {
+                pthread_rwlock_wrlock(&dsg->ls_lock);
+                n = ls_spill_pick(dsg->ls, size, od_tab, DSG_SPILL_MAX);
+                pthread_rwlock_unlock(&dsg->ls_lock);
+
+                for (i = 0; i < n; i++) {
+                        if (dsg->num_workers > 0) {
+                                memset(&cmd, 0, sizeof(cmd));
+                                memcpy(cmd.pad, &od_tab[i], sizeof(od_tab[i]));
+                                if (dsg_work_post(&cmd, obj_spill_prepare, 0) == 0)
+                                        continue;
+                        }
+                        dsg_obj_spill(od_tab[i]);
+                }
+        } while (n == DSG_SPILL_MAX);
+
+        if (n < 0)
+                uloga("'%s()': server %d over memory budget (%d).\n",
+                        __func__, DSG_ID, n);
+}
+
 /*
 */
 static int dsgrpc_obj_put(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
@@ -1431,6 +1858,7 @@ static int dsgrpc_obj_put(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 
         err = -ENOMEM;
         peer = ds_get_peer(dsg->ds, cmd->id);
+        dsg_mem_reserve(obj_data_size(odsc));
         
         #ifdef SHMEM_OBJECTS
             od = shmem_obj_data_alloc(odsc, DSG_ID);
@@ -1481,7 +1909,7 @@ static int dsgrpc_obj_put(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 	        return 0;
         }
  err_free_msg:
-        free(msg);
+        msg_buf_free(msg);
  err_free_data:
         free(od);
  err_out:
@@ -1489,51 +1917,296 @@ static int dsgrpc_obj_put(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
         return err;
 }
 
-static int obj_meta_get_completion_data(struct rpc_server *rpc_s, struct msg_buf *msg)
+static int obj_batch_send_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
 {
-		free(msg->msg_data);
-        free(msg);
+        free(msg->msg_data);
+        msg_buf_free(msg);
         return 0;
 }
 
-static int obj_meta_get_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+/*
+  Send a batched request 'cmd' with 'num_obj' entries in 'buf'; the
+  buffer is released once sent.
+*/
+static int obj_batch_send(struct rpc_server *rpc_s, int peer_id, int cmd,
+                          int num_obj, void *buf, uint64_t size)
 {
-        free(msg);
-        return 0;
-}
-
-static int dsgrpc_obj_get_next_meta(struct rpc_server *rpc_s, struct rpc_cmd *cmd){
-    struct msg_buf *msg;
-    struct hdr_nvars_get *oh = (struct hdr_nvars_get *) cmd->pad;
-    struct node_id *peer = ds_get_peer(dsg->ds, cmd->id);
-    int curr_version = oh->current_version;
-    enum storage_type st = column_major;
-    struct obj_data *od, *from_obj;
-    int latest_v;
-    int *var_data;
-	var_data=malloc(sizeof(int)*2);
-	var_data[0]=-3;
-	var_data[1]=-3;
+        struct node_id *peer = ds_get_peer(dsg->ds, peer_id);
+        struct hdr_obj_batch *hb;
+        struct msg_buf *msg;
+        int err = -ENOMEM;
 
-    struct obj_descriptor *pref_odsc;
-    pref_odsc= (struct obj_descriptor *) malloc(sizeof(struct obj_descriptor));
-    pref_odsc->version = curr_version;
-    pref_odsc->owner = -1;
-    pref_odsc->st = st;
-    pref_odsc->size = sizeof(char);
-    pref_odsc->bb.num_dims = 1;
+        msg = msg_buf_alloc(rpc_s, peer, 1);
+        if (!msg)
+                goto err_out;
 
-    memset(pref_odsc->bb.lb.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
-    memset(pref_odsc->bb.ub.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+        msg->msg_rpc->cmd = cmd;
+        msg->msg_rpc->id = DSG_ID;
 
-    sprintf(pref_odsc->name, "VARMETA@%s", oh->f_name);
-    int err = -ENOMEM;
+        hb = (struct hdr_obj_batch *) msg->msg_rpc->pad;
+        hb->num_obj = num_obj;
+        hb->size = size;
 
-    from_obj = ls_find_next(dsg->ls, pref_odsc);
-    if (!from_obj) {
-        uloga("End of stream. Current step is the maximum\n");
-        goto send_data;
-    }
+        msg->msg_data = buf;
+        msg->size = size;
+        msg->cb = obj_batch_send_completion;
+
+        err = rpc_send(rpc_s, peer, msg);
+        if (err == 0)
+                return 0;
+
+        msg_buf_free(msg);
+ err_out:
+        ERROR_TRACE();
+}
+
+/*
+  Receive the payload of a batched request; 'cb' finds a copy of the
+  header in front of it, in 'msg->private'.
+*/
+static int obj_batch_receive(struct rpc_server *rpc_s, struct rpc_cmd *cmd,
+        int (*cb)(struct rpc_server *, struct msg_buf *))
+{
+        struct hdr_obj_batch *hb = (struct hdr_obj_batch *) cmd->pad;
+        struct node_id *peer = ds_get_peer(dsg->ds, cmd->id);
+        struct msg_buf *msg;
+        void *buf;
+        int err = -ENOMEM;
+
+        buf = malloc(sizeof(*hb) + hb->size);
+        if (!buf)
+                goto err_out;
+        memcpy(buf, hb, sizeof(*hb));
+
+        msg = msg_buf_alloc(rpc_s, peer, 0);
+        if (!msg) {
+                free(buf);
+                goto err_out;
+        }
+
+        msg->msg_data = (struct hdr_obj_batch *) buf + 1;
+        msg->size = hb->size;
+        msg->private = buf;
+        msg->cb = cb;
+
+        rpc_mem_info_cache(peer, msg, cmd);
+        err = rpc_receive_direct(rpc_s, peer, msg);
+        rpc_mem_info_reset(peer, msg, cmd);
+        if (err == 0)
+                return 0;
+
+        free(buf);
+        msg_buf_free(msg);
+ err_out:
+        ERROR_TRACE();
+}
+
+/*
+  Update the DHT for a batch of objects: each remote DHT peer gets one
+  update with all the descriptors it indexes.
+*/
+static int obj_put_update_dht_batch(struct ds_gspace *dsg,
+                                    struct obj_data *od_tab[], int num_obj)
+{
+        int num_sp = dsg->ds->size_sp;
+        struct obj_batch_ent *ent_tab[num_sp], *ent;
+        int num_ent[num_sp];
+        struct sspace *ssd;
+        int num_de, min_rank, rank, i, j, err = 0;
+
+        memset(ent_tab, 0, sizeof(ent_tab));
+        memset(num_ent, 0, sizeof(num_ent));
+
+        for (i = 0; i < num_obj; i++) {
+                ssd = lookup_sspace(dsg, od_tab[i]->obj_desc.name, &od_tab[i]->gdim);
+                struct dht_entry *de_tab[ssd->dht->num_entries];
+
+                ssd_split_add_load(ssd, &od_tab[i]->obj_desc.bb,
+                                   od_tab[i]->obj_desc.size);
+                if (!dsg_split_ready(ssd, od_tab[i]->obj_desc.version)) {
+                        /* Updated on its own when the split is set. */
+                        err = obj_update_dht(ssd, &od_tab[i]->obj_desc,
+                                             &od_tab[i]->gdim);
+                        if (err < 0)
+                                goto err_out;
+                        continue;
+                }
+
+                num_de = ssd_hash_ver(ssd, &od_tab[i]->obj_desc.bb,
+                                      od_tab[i]->obj_desc.version, de_tab);
+                if (num_de < 0) {
+                        err = num_de;
+                        goto err_out;
+                }
+                min_rank = de_tab[0]->rank;
+                for (j = 0; j < num_de; j++) {
+                        rank = de_tab[j]->rank;
+                        if (rank == DSG_ID) {
+                                err = obj_update_dht_local(ssd,
+                                        &od_tab[i]->obj_desc, rank == min_rank);
+                                if (err < 0)
+                                        goto err_out;
+                                continue;
+                        }
+
+                        err = -ENOMEM;
+                        if (!ent_tab[rank]) {
+                                ent_tab[rank] = malloc(sizeof(*ent) * num_obj);
+                                if (!ent_tab[rank])
+                                        goto err_out;
+                        }
+                        ent = &ent_tab[rank][num_ent[rank]++];
+                        ent->odsc = od_tab[i]->obj_desc;
+                        memcpy(&ent->gdim, &od_tab[i]->gdim, sizeof(struct global_dimension));
+                        ent->rank = min_rank;
+                }
+        }
+
+        for (rank = 0; rank < num_sp; rank++) {
+                if (!num_ent[rank])
+                        continue;
+
+                err = obj_batch_send(dsg->ds->rpc_s, rank, ss_obj_update_batch,
+                                     num_ent[rank], ent_tab[rank],
+                                     sizeof(*ent) * num_ent[rank]);
+                if (err < 0)
+                        goto err_out;
+                ent_tab[rank] = NULL;
+        }
+
+        return 0;
+ err_out:
+        for (rank = 0; rank < num_sp; rank++)
+                free(ent_tab[rank]);
+        ERROR_TRACE();
+}
+
+static int obj_update_batch_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+        struct hdr_obj_batch *hb = msg->private;
+        struct obj_batch_ent *ent = (struct obj_batch_ent *) (hb + 1);
+        struct sspace *ssd;
+        int i, err;
+
+        for (i = 0; i < hb->num_obj; i++, ent++) {
+                ssd = lookup_sspace(dsg, ent->odsc.name, &ent->gdim);
+                err = obj_update_dht_local(ssd, &ent->odsc, ent->rank == DSG_ID);
+                if (err < 0)
+                        uloga("'%s()': failed with %d.\n", __func__, err);
+        }
+
+        free(hb);
+        msg_buf_free(msg);
+        return 0;
+}
+
+/*
+  Rpc routine to add a batch of object descriptors to the DHT.
+*/
+static int dsgrpc_obj_update_batch(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        return obj_batch_receive(rpc_s, cmd, obj_update_batch_completion);
+}
+
+static int obj_put_batch_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+        struct hdr_obj_batch *hb = msg->private;
+        struct obj_batch_ent *ent = (struct obj_batch_ent *) (hb + 1);
+        char *data = (char *) (ent + hb->num_obj);
+        struct obj_data **od_tab;
+        int num_od = 0, i, err = -ENOMEM;
+
+        od_tab = malloc(sizeof(*od_tab) * hb->num_obj);
+        if (!od_tab)
+                goto err_out;
+
+        for (i = 0; i < hb->num_obj; i++) {
+                ent[i].odsc.owner = DSG_ID;
+#ifdef SHMEM_OBJECTS
+                od_tab[i] = shmem_obj_data_alloc(&ent[i].odsc, DSG_ID);
+#else
+                od_tab[i] = obj_data_alloc(&ent[i].odsc);
+#endif
+                if (!od_tab[i])
+                        break;
+
+                memcpy(&od_tab[i]->gdim, &ent[i].gdim, sizeof(struct global_dimension));
+                memcpy(od_tab[i]->data, data, obj_data_size(&ent[i].odsc));
+                data += obj_data_size(&ent[i].odsc);
+        }
+        num_od = i;
+
+        pthread_rwlock_wrlock(&dsg->ls_lock);
+        for (i = 0; i < num_od; i++)
+                ls_add_obj(dsg->ls, od_tab[i]);
+        pthread_rwlock_unlock(&dsg->ls_lock);
+
+        err = obj_put_update_dht_batch(dsg, od_tab, num_od);
+        if (num_od < hb->num_obj)
+                err = -ENOMEM;
+        free(od_tab);
+ err_out:
+        if (err < 0)
+                uloga("'%s()': failed with %d.\n", __func__, err);
+#ifdef DS_SYNC_MSG
+        obj_put_sync_reply(rpc_s, (struct node_id*)msg->peer, hb->sync_op_id_ptr);
+#endif
+        free(hb);
+        msg_buf_free(msg);
+        return 0;
+}
+
+/*
+  Rpc routine to store a batch of objects from one client; one DHT
+  update goes to each DHT peer of the batch.
+*/
+static int dsgrpc_obj_put_batch(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        struct hdr_obj_batch *hb = (struct hdr_obj_batch *) cmd->pad;
+
+        dsg_mem_reserve(hb->size);
+        return obj_batch_receive(rpc_s, cmd, obj_put_batch_completion);
+}
+
+static int obj_meta_get_completion_data(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+		free(msg->msg_data);
+        msg_buf_free(msg);
+        return 0;
+}
+
+static int dsgrpc_obj_get_next_meta(struct rpc_server *rpc_s, struct rpc_cmd *cmd){
+    struct msg_buf *msg;
+    struct hdr_nvars_get *oh = (struct hdr_nvars_get *) cmd->pad;
+    struct node_id *peer = ds_get_peer(dsg->ds, cmd->id);
+    int curr_version = oh->current_version;
+    enum storage_type st = column_major;
+    struct obj_data *od, *from_obj;
+    int latest_v;
+    int *var_data;
+	var_data=malloc(sizeof(int)*2);
+	var_data[0]=-3;
+	var_data[1]=-3;
+
+    struct obj_descriptor *pref_odsc;
+    pref_odsc= (struct obj_descriptor *) malloc(sizeof(struct obj_descriptor));
+    pref_odsc->version = curr_version;
+    pref_odsc->owner = -1;
+    pref_odsc->st = st;
+    pref_odsc->size = sizeof(char);
+    pref_odsc->bb.num_dims = 1;
+
+    memset(pref_odsc->bb.lb.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+    memset(pref_odsc->bb.ub.c, 0, sizeof(uint64_t)*BBOX_MAX_NDIM);
+
+    sprintf(pref_odsc->name, "VARMETA@%s", oh->f_name);
+    int err = -ENOMEM;
+
+    from_obj = ls_find_next(dsg->ls, pref_odsc);
+    if (!from_obj) {
+        uloga("End of stream. Current step is the maximum\n");
+        goto send_data;
+    }
 
     var_data[0] = (from_obj->obj_desc.bb.ub.c[0]+1)*sizeof(char);
     var_data[1] = from_obj->obj_desc.version;
@@ -1551,7 +2224,7 @@ static int dsgrpc_obj_get_next_meta(struct rpc_server *rpc_s, struct rpc_cmd *cm
     	rpc_mem_info_reset(peer, msg, cmd);
     	if (err == 0)
             return 0;
-    	free(msg);
+    	msg_buf_free(msg);
     err_out:
         uloga("'%s()': failed with %d.\n", __func__, err);
         return err;
@@ -1606,7 +2279,7 @@ static int dsgrpc_obj_get_latest_meta(struct rpc_server *rpc_s, struct rpc_cmd *
         rpc_mem_info_reset(peer, msg, cmd);
         if (err == 0)
             return 0;
-        free(msg);
+        msg_buf_free(msg);
     err_out:
         uloga("'%s()': failed with %d.\n", __func__, err);
         return err;
@@ -1635,18 +2308,25 @@ static int dsgrpc_obj_get_var_meta(struct rpc_server *rpc_s, struct rpc_cmd *cmd
   	//  pref_odsc->bb.ub.c[0] = oh->length + pref_odsc->bb.lb.c[0]-1;
     sprintf(pref_odsc->name, "VARMETA@%s", oh->f_name);
     int err = -ENOMEM;
+    /* A worker may spill the object, pin it for the transfer. */
+    pthread_rwlock_rdlock(&dsg->ls_lock);
     from_obj = ls_find(dsg->ls, pref_odsc);
+    if (from_obj)
+            __sync_fetch_and_add(&from_obj->refcnt, 1);
+    pthread_rwlock_unlock(&dsg->ls_lock);
     if (!from_obj) {
         uloga("'%s()': Metdata Object not found. Should not happen\n", __func__);
         goto err_out;
     }
     msg = msg_buf_alloc(rpc_s, peer, 0);
     if (!msg) {
+            dsg_obj_unpin(from_obj);
             goto err_out;
     }
     msg->msg_data = from_obj->data;
     msg->size = oh->length;
-    msg->cb = obj_meta_get_completion;
+    msg->cb = obj_get_ref_completion;
+    msg->private = from_obj;
 
     rpc_mem_info_cache(peer, msg, cmd);
     err = rpc_send_direct(rpc_s, peer, msg);
@@ -1654,7 +2334,8 @@ static int dsgrpc_obj_get_var_meta(struct rpc_server *rpc_s, struct rpc_cmd *cmd
     if (err == 0)
             return 0;
 
-    free(msg);
+    dsg_obj_unpin(from_obj);
+    msg_buf_free(msg);
     err_out:
         uloga("'%s()': failed with %d.\n", __func__, err);
         return err;
@@ -1696,7 +2377,7 @@ static int obj_info_reply_descriptor(
         if (err == 0)
                 return 0;
 
-        free(msg);
+        msg_buf_free(msg);
         return err;
 }
 
@@ -1720,7 +2401,7 @@ static int obj_query_reply_num_de(struct node_id *peer, int num_de)
         if (err == 0)
                 return 0;
 
-        free(msg);
+        msg_buf_free(msg);
         return err;
 }
 
@@ -1753,7 +2434,7 @@ static int obj_query_forward_obj_info(struct dht_entry *de_tab[], int num_de,
 
                 err = rpc_send(dsg->ds->rpc_s, peer, msg);
                 if (err < 0) {
-                        free(msg);
+                        msg_buf_free(msg);
                         break;
                 }
         }
@@ -1768,7 +2449,7 @@ static int obj_query_forward_obj_info(struct dht_entry *de_tab[], int num_de,
 static int obj_send_dht_peers_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
 {
         free(msg->msg_data);
-        free(msg);
+        msg_buf_free(msg);
 
         return 0;
 }
@@ -1787,9 +2468,17 @@ static int dsgrpc_obj_send_dht_peers(struct rpc_server *rpc_s, struct rpc_cmd *c
         int *peer_id_tab, peer_num, i;
         int err = -ENOMEM;
 
+        if (!dsg_split_ready(ssd, oh->u.o.odsc.version))
+                return dsg_split_wait_cmd(oh->u.o.odsc.version,
+                                          dsgrpc_obj_send_dht_peers, cmd);
+
         peer = ds_get_peer(dsg->ds, cmd->id);
 
-        peer_num = ssd_hash(ssd, &oh->u.o.odsc.bb, de_tab);
+        peer_num = ssd_hash_ver(ssd, &oh->u.o.odsc.bb, oh->u.o.odsc.version, de_tab);
+        if (peer_num < 0) {
+                err = peer_num;
+                goto err_out;
+        }
         peer_id_tab = malloc(sizeof(int) * (peer_num+1));
         if (!peer_id_tab)
                 goto err_out;
@@ -1817,7 +2506,7 @@ static int dsgrpc_obj_send_dht_peers(struct rpc_server *rpc_s, struct rpc_cmd *c
                 return 0;
 
         free(peer_id_tab);
-        free(msg);
+        msg_buf_free(msg);
  err_out:
         ERROR_TRACE();
 }
@@ -1833,7 +2522,15 @@ static int dsgrpc_obj_query(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
         struct node_id *peer;
         int num_de, err = -ENOMEM;
 
-        num_de = ssd_hash(dsg->ssd, &oh->u.o.odsc.bb, de_tab);
+        if (!dsg_split_ready(dsg->ssd, oh->u.o.odsc.version))
+                return dsg_split_wait_cmd(oh->u.o.odsc.version,
+                                          dsgrpc_obj_query, cmd);
+
+        num_de = ssd_hash_ver(dsg->ssd, &oh->u.o.odsc.bb, oh->u.o.odsc.version, de_tab);
+        if (num_de < 0) {
+                err = num_de;
+                goto err_out;
+        }
         peer = ds_get_peer(dsg->ds, cmd->id);
 
         err = obj_query_reply_num_de(peer, num_de);
@@ -1892,18 +2589,17 @@ static int obj_desc_req_add_pending(struct rpc_cmd *cmd)
 }
 
 /*
-  Send an  object not  found erorr message  to the  requesting compute
+  Build an  object not  found erorr message  for the  requesting compute
   peer, and a list of object versions available in the space.
 */
-static int obj_desc_not_found(struct node_id *peer, int qid, int num_vers, int *versions)
+static struct msg_buf *obj_desc_not_found(struct node_id *peer, int qid, int num_vers, int *versions)
 {
         struct msg_buf *msg;
         struct hdr_obj_get *oh;
-        int err = -ENOMEM;
 
         msg = msg_buf_alloc(dsg->ds->rpc_s, peer, 1);
         if (!msg)
-                goto err_out;
+                return NULL;
 
         msg->msg_rpc->id = DSG_ID; // dsg->ds->self->id;
         msg->msg_rpc->cmd = ss_obj_get_desc;
@@ -1914,39 +2610,73 @@ static int obj_desc_not_found(struct node_id *peer, int qid, int num_vers, int *
 	oh->u.v.num_vers = num_vers;
 	memcpy(oh->u.v.versions, versions, num_vers * sizeof(int));
 
-        err = rpc_send(dsg->ds->rpc_s, peer, msg);
-        if (err == 0)
-                return 0;
- err_out:
-        ERROR_TRACE();
+        return msg;
+}
+
+/*
+  Build an empty reply to an 'ss_obj_get_desc' request: no object
+  descriptors follow.
+*/
+static struct msg_buf *obj_desc_none(struct node_id *peer, int qid)
+{
+        struct msg_buf *msg;
+        struct hdr_obj_get *oh;
+
+        msg = msg_buf_alloc(dsg->ds->rpc_s, peer, 1);
+        if (!msg)
+                return NULL;
+
+        msg->msg_rpc->id = DSG_ID;
+        msg->msg_rpc->cmd = ss_obj_get_desc;
+
+        oh = (struct hdr_obj_get *) msg->msg_rpc->pad;
+        oh->rc = 0;
+        oh->qid = qid;
+        oh->u.o.num_de = 0;
+
+        return msg;
 }
 
 static int obj_get_desc_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
 {
         free(msg->msg_data);
-        free(msg);
+        msg_buf_free(msg);
         return 0;
 }
 
 /*
-  RPC  routine to  send the  object  descriptors that  match the  data
-  object being queried.
+  Build the reply  to an 'ss_obj_get_desc' request: the object descriptors
+  that match the data object being queried.
   //RPC request changed such that original request descriptor in server and intersection is 
   //both sent to the client.
 */
-static int dsgrpc_obj_get_desc(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+static int obj_get_desc_prepare(struct rpc_cmd *cmd, struct msg_buf **pmsg)
 {
         struct hdr_obj_get *oh = (struct hdr_obj_get *) cmd->pad;
         struct node_id *peer = ds_get_peer(dsg->ds, cmd->id);
         struct obj_descriptor odsc, *odsc_tab;
         struct sspace* ssd = lookup_sspace(dsg, oh->u.o.odsc.name, &oh->gdim);
-        const struct obj_descriptor *podsc[ssd->ent_self->odsc_num];
-        int obj_versions[ssd->ent_self->odsc_size];
+        const struct obj_descriptor **podsc = NULL;
+        int *obj_versions = NULL;
         int num_odsc, i;
         struct msg_buf *msg;
-        int err = -ENOENT;
+        int err = -ENOMEM;
 
+        pthread_rwlock_rdlock(&dsg->dht_lock);
+        podsc = malloc(sizeof(*podsc) * (ssd->ent_self->odsc_num + 1));
+        if (!podsc)
+                goto err_unlock;
         num_odsc = dht_find_entry_all(ssd->ent_self, &oh->u.o.odsc, podsc);
+        if (!num_odsc && !ssd_hash_self(ssd, &oh->u.o.odsc.bb, oh->u.o.odsc.version)) {
+                /* A coarsely hashed query we index no part of; reply
+                   with no descriptors. */
+                pthread_rwlock_unlock(&dsg->dht_lock);
+                free(podsc);
+                *pmsg = obj_desc_none(peer, oh->qid);
+                if (!*pmsg)
+                        goto err_out;
+                return 0;
+        }
         if (!num_odsc) {
 #ifdef DEBUG
 		char *str = 0;
@@ -1957,15 +2687,20 @@ static int dsgrpc_obj_get_desc(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 		uloga("'%s()': %s\n", __func__, str);
 		free(str);
 #endif
+                obj_versions = malloc(sizeof(int) * ssd->ent_self->odsc_size);
+                if (!obj_versions)
+                        goto err_unlock;
 		i = dht_find_versions(ssd->ent_self, &oh->u.o.odsc, obj_versions);
-                err = obj_desc_not_found(peer, oh->qid, i, obj_versions);
-                if (err < 0)
-                        goto err_out;
+                pthread_rwlock_unlock(&dsg->dht_lock);
 
+                *pmsg = obj_desc_not_found(peer, oh->qid, i, obj_versions);
+                free(obj_versions);
+                free(podsc);
+                if (!*pmsg)
+                        goto err_out;
                 return 0;
         }
 
-        err = -ENOMEM;
         #ifdef SHMEM_OBJECTS
             odsc_tab = malloc(sizeof(*odsc_tab) * num_odsc*2);
         #endif
@@ -1974,7 +2709,7 @@ static int dsgrpc_obj_get_desc(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
             odsc_tab = malloc(sizeof(*odsc_tab) * num_odsc);
         #endif
         if (!odsc_tab)
-                goto err_out;
+                goto err_unlock;
 
         for (i = 0; i < num_odsc; i++) {
             odsc = *podsc[i];
@@ -1991,8 +2726,10 @@ static int dsgrpc_obj_get_desc(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
             //uloga("Asked from obj from server %d in current server %d for object owner %d\n", ds_get_peer(dsg->ds, odsc.owner)->ptlmap.id, DSG_ID, odsc.owner);
 
         }
+        pthread_rwlock_unlock(&dsg->dht_lock);
+        free(podsc);
 
-        msg = msg_buf_alloc(rpc_s, peer, 1);
+        msg = msg_buf_alloc(dsg->ds->rpc_s, peer, 1);
         if (!msg) {
                 free(odsc_tab);
                 goto err_out;
@@ -2019,38 +2756,101 @@ static int dsgrpc_obj_get_desc(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
         #endif
         oh->qid = i;
 
+        *pmsg = msg;
+        return 0;
+
+ err_unlock:
+        pthread_rwlock_unlock(&dsg->dht_lock);
+        free(podsc);
+ err_out:
+        uloga("'%s()': failed with %d.\n", __func__, err);
+        return err;
+}
+
+/*
+  RPC  routine to  send the  object  descriptors that  match the  data
+  object being queried.
+*/
+static int dsgrpc_obj_get_desc(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        struct node_id *peer = ds_get_peer(dsg->ds, cmd->id);
+        struct msg_buf *msg = NULL;
+        int err;
+
+        if (dsg->num_workers > 0)
+                return dsg_work_post(cmd, obj_get_desc_prepare, 0);
+
+        err = obj_get_desc_prepare(cmd, &msg);
+        if (err < 0)
+                goto err_out;
+
         err = rpc_send(rpc_s, peer, msg);
         if (err == 0)
                 return 0;
 
-        free(odsc_tab);
-        free(msg);
+        free(msg->msg_data);
+        msg_buf_free(msg);
  err_out:
         uloga("'%s()': failed with %d.\n", __func__, err);
         return err;
 }
 
+/*
+  Release a reference taken on a stored object by a worker; free the
+  object if it was evicted or removed meanwhile.
+*/
+static void dsg_obj_unpin(struct obj_data *od)
+{
+        pthread_rwlock_wrlock(&dsg->ls_lock);
+        if (--od->refcnt == 0 && od->f_free) {
+                /* list_del() clears the links of removed objects. */
+                if (od->obj_entry.next)
+                        ls_remove(dsg->ls, od);
+                obj_data_free(od);
+        }
+        pthread_rwlock_unlock(&dsg->ls_lock);
+}
+
 static int obj_get_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
 {
         struct obj_data *od = msg->private;
 
-        free(msg);
+        msg_buf_free(msg);
         obj_data_free(od);
 
         return 0;
 }
 
 /*
-  Rpc routine  to respond to  an 'ss_obj_get' request; we  assume that
-  the requesting peer knows we have the data.
+  Completion of a reply sent straight from a stored object.
 */
-static int dsgrpc_obj_get(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+static int obj_get_ref_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+        dsg_obj_unpin(msg->private);
+        msg_buf_free(msg);
+
+        return 0;
+}
+
+static int obj_get_refv_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+        free(msg->msg_data);
+        return obj_get_ref_completion(rpc_s, msg);
+}
+
+/*
+  Build the reply to an 'ss_obj_get' request; we  assume that
+  the requesting peer knows we have the data. Return 1 if the reply
+  is a vector of buffers.
+*/
+static int obj_get_prepare(struct rpc_cmd *cmd, struct msg_buf **pmsg)
 {
         struct hdr_obj_get *oh = (struct hdr_obj_get *) cmd->pad;
         struct node_id *peer;
         struct msg_buf *msg;
         struct obj_data *od, *from_obj;
-        int err = -ENOENT; 
+        iovec_t *iov;
+        int num_iov, err = -ENOENT; 
 
         peer = ds_get_peer(dsg->ds, cmd->id);
 
@@ -2068,7 +2868,11 @@ static int dsgrpc_obj_get(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 #endif
 
         // CRITICAL: use version here !!!
+        pthread_rwlock_rdlock(&dsg->ls_lock);
         from_obj = ls_find(dsg->ls, &oh->u.o.odsc);
+        if (from_obj)
+                __sync_fetch_and_add(&from_obj->refcnt, 1);
+        pthread_rwlock_unlock(&dsg->ls_lock);
         if (!from_obj) {
             char *str;
             str = obj_desc_sprint(&oh->u.o.odsc);
@@ -2089,16 +2893,48 @@ static int dsgrpc_obj_get(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
         // Update (oh->odsc.st == from_obj->obj_desc.st);
 
         err = -ENOMEM;
+        /* Send  straight from the  stored object if the  region is
+           contiguous in it, or made of a few long runs; the object
+           stays pinned until the send completes. */
+        num_iov = ssd_data_iov(from_obj, &oh->u.o.odsc, 
+                               DSG_GET_MIN_RUN, DSG_GET_MAX_IOV, &iov);
+        if (num_iov > 0) {
+                msg = msg_buf_alloc(dsg->ds->rpc_s, peer, 0);
+                if (!msg) {
+                        free(iov);
+                        dsg_obj_unpin(from_obj);
+                        goto err_out;
+                }
+                msg->private = from_obj;
+                *pmsg = msg;
+
+                if (num_iov == 1) {
+                        msg->msg_data = iov[0].iov_base;
+                        msg->size = iov[0].iov_len;
+                        msg->cb = obj_get_ref_completion;
+                        free(iov);
+                        return 0;
+                }
+
+                msg->msg_data = iov;
+                msg->size = num_iov;
+                msg->cb = obj_get_refv_completion;
+                return 1;
+        }
+
         // CRITICAL:     experimental    stuff,     assumption    data
         // representation is the same on both ends.
         // od = obj_data_alloc(&oh->odsc);
         od = obj_data_alloc(&oh->u.o.odsc);
-        if (!od)
+        if (!od) {
+                dsg_obj_unpin(from_obj);
                 goto err_out;
+        }
         ssd_copy(od, from_obj);
         od->obj_ref = from_obj;
+        dsg_obj_unpin(from_obj);
 
-        msg = msg_buf_alloc(rpc_s, peer, 0);
+        msg = msg_buf_alloc(dsg->ds->rpc_s, peer, 0);
         if (!msg) {
                 obj_data_free(od);
                 goto err_out;
@@ -2109,36 +2945,523 @@ static int dsgrpc_obj_get(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
         msg->cb = obj_get_completion;
         msg->private = od;
 
+        *pmsg = msg;
+        return 0;
+
+ err_out:
+        uloga("'%s()': failed with %d.\n", __func__, err);
+        return err;
+}
+
+/*
+  Rpc routine  to respond to  an 'ss_obj_get' request.
+*/
+static int dsgrpc_obj_get(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        struct node_id *peer = ds_get_peer(dsg->ds, cmd->id);
+        struct msg_buf *msg = NULL;
+        int err;
+
+        if (dsg->num_workers > 0)
+                return dsg_work_post(cmd, obj_get_prepare, 1);
+
+        err = obj_get_prepare(cmd, &msg);
+        if (err < 0)
+                goto err_out;
 
         rpc_mem_info_cache(peer, msg, cmd); 
-        err = rpc_send_direct(rpc_s, peer, msg);
+        if (err > 0)
+                err = rpc_send_directv(rpc_s, peer, msg);
+        else    err = rpc_send_direct(rpc_s, peer, msg);
         rpc_mem_info_reset(peer, msg, cmd);
         if (err == 0)
                 return 0;
 
-        obj_data_free(od);
-        free(msg);
+        (*msg->cb)(rpc_s, msg);
  err_out:
         uloga("'%s()': failed with %d.\n", __func__, err);
         return err;
 }
 
+static int dsgrpc_obj_get_fwd(struct rpc_server *rpc_s, struct rpc_cmd *cmd);
+
 /*
-  Routine to execute "custom" application filters.
+  Pass a routed 'ss_obj_get' request on to the next step at 'peer_id';
+  our own part is handled in place.
 */
-static int dsgrpc_obj_filter(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+static int obj_get_fwd_send(struct rpc_server *rpc_s, int peer_id,
+                            const struct hdr_obj_get_fwd *hf, int step)
 {
-        struct hdr_obj_filter *hf = (struct hdr_obj_filter *) cmd->pad;
-        struct node_id *peer = ds_get_peer(dsg->ds, cmd->id);
+        struct node_id *peer = ds_get_peer(dsg->ds, peer_id);
+        struct hdr_obj_get_fwd *hfo;
         struct msg_buf *msg;
-        struct obj_data *from;
+        struct rpc_cmd cmd;
+        int err = -ENOMEM;
+
+        if (peer == dsg->ds->self) {
+                memset(&cmd, 0, sizeof(cmd));
+                cmd.cmd = ss_obj_get_fwd;
+                cmd.id = DSG_ID;
+                hfo = (struct hdr_obj_get_fwd *) cmd.pad;
+                *hfo = *hf;
+                hfo->step = step;
+                return dsgrpc_obj_get_fwd(rpc_s, &cmd);
+        }
+
+        msg = msg_buf_alloc(rpc_s, peer, 1);
+        if (!msg)
+                goto err_out;
+
+        msg->msg_rpc->cmd = ss_obj_get_fwd;
+        msg->msg_rpc->id = DSG_ID;
+
+        hfo = (struct hdr_obj_get_fwd *) msg->msg_rpc->pad;
+        *hfo = *hf;
+        hfo->step = step;
+
+        err = rpc_send(rpc_s, peer, msg);
+        if (err == 0)
+                return 0;
+
+        msg_buf_free(msg);
+ err_out:
+        ERROR_TRACE();
+}
+
+/*
+  Return the rank of the DHT peer that routes the piece 'odsc' of a
+  query indexed by the peers in 'de_tab': the lowest ranked one that
+  also indexes 'odsc', so that each piece is fetched once.
+*/
+static int obj_get_fwd_router(struct sspace *ssd, const struct obj_descriptor *odsc,
+                              struct dht_entry *de_tab[], int num_de)
+{
+        struct dht_entry *do_tab[ssd->dht->num_entries];
+        int num_do, i, j, rank = -1;
+
+        num_do = ssd_hash_ver(ssd, &odsc->bb, odsc->version, do_tab);
+        if (num_do < 0)
+                return num_do;
+        for (i = 0; i < num_do; i++)
+                for (j = 0; j < num_de; j++)
+                        if (do_tab[i] == de_tab[j] &&
+                            (rank < 0 || do_tab[i]->rank < rank))
+                                rank = do_tab[i]->rank;
+
+        return rank;
+}
+
+/*
+  Step 1: route the pieces of the query we index to their owners, and
+  tell the client how many pieces to expect from us.
+*/
+static int obj_get_fwd_lookup(struct rpc_server *rpc_s, struct hdr_obj_get_fwd *hf)
+{
+        struct sspace *ssd = lookup_sspace(dsg, hf->odsc.name, &hf->gdim);
+        struct dht_entry *de_tab[ssd->dht->num_entries];
+        const struct obj_descriptor **podsc = NULL;
+        struct obj_descriptor *odsc_tab = NULL;
+        struct node_id *peer = ds_get_peer(dsg->ds, hf->rank);
+        struct hdr_obj_get_ack *ha;
+        struct hdr_obj_get_fwd hfo;
+        struct msg_buf *msg;
+        int *obj_versions;
+        struct rpc_cmd cmd;
+        int num_de, num_odsc, num_obj = 0, i, err = -ENOMEM;
+
+        if (!dsg_split_ready(ssd, hf->odsc.version)) {
+                memset(&cmd, 0, sizeof(cmd));
+                cmd.cmd = ss_obj_get_fwd;
+                cmd.id = DSG_ID;
+                hfo = *hf;
+                hfo.step = fwd_lookup;
+                memcpy(cmd.pad, &hfo, sizeof(hfo));
+                return dsg_split_wait_cmd(hf->odsc.version, dsgrpc_obj_get_fwd, &cmd);
+        }
+
+        num_de = ssd_hash_ver(ssd, &hf->odsc.bb, hf->odsc.version, de_tab);
+        if (num_de < 0) {
+                err = num_de;
+                goto err_out;
+        }
+
+        msg = msg_buf_alloc(rpc_s, peer, 1);
+        if (!msg)
+                goto err_out;
+
+        msg->msg_rpc->cmd = ss_obj_get_ack;
+        msg->msg_rpc->id = DSG_ID;
+
+        ha = (struct hdr_obj_get_ack *) msg->msg_rpc->pad;
+        ha->qid = hf->qid;
+
+        pthread_rwlock_rdlock(&dsg->dht_lock);
+        podsc = malloc(sizeof(*podsc) * (ssd->ent_self->odsc_num + 1));
+        odsc_tab = malloc(sizeof(*odsc_tab) * (ssd->ent_self->odsc_num + 1));
+        obj_versions = malloc(sizeof(int) * ssd->ent_self->odsc_size);
+        if (!podsc || !odsc_tab || !obj_versions) {
+                pthread_rwlock_unlock(&dsg->dht_lock);
+                free(podsc);
+                free(odsc_tab);
+                free(obj_versions);
+                msg_buf_free(msg);
+                goto err_out;
+        }
+
+        num_odsc = dht_find_entry_all(ssd->ent_self, &hf->odsc, podsc);
+        /* The client hashes large queries coarsely, and may ask us for
+           a query we index no part of: nothing is missing then. */
+        if (!num_odsc && ssd_hash_self(ssd, &hf->odsc.bb, hf->odsc.version) != 0) {
+                ha->rc = -ENOENT;
+                i = dht_find_versions(ssd->ent_self, &hf->odsc, obj_versions);
+                ha->num_vers = (i < HDR_GET_MAX_VERS) ? i : HDR_GET_MAX_VERS;
+                memcpy(ha->versions, obj_versions, ha->num_vers * sizeof(int));
+        }
+
+        for (i = 0; i < num_odsc; i++) {
+                if (obj_get_fwd_router(ssd, podsc[i], de_tab, num_de) !=
+                    ssd->ent_self->rank)
+                        continue;
+
+                odsc_tab[num_obj] = *podsc[i];
+                /* Preserve storage type at the destination. */
+                odsc_tab[num_obj].st = hf->odsc.st;
+                bbox_intersect(&hf->odsc.bb, &odsc_tab[num_obj].bb,
+                               &odsc_tab[num_obj].bb);
+                num_obj++;
+        }
+        pthread_rwlock_unlock(&dsg->dht_lock);
+        free(podsc);
+        free(obj_versions);
+
+        /* The client will cache what it finds. */
+        if (num_odsc > 0)
+                layout_watch_add(dsg, hf->odsc.name, hf->rank);
+
+        hfo = *hf;
+        for (i = 0; i < num_obj; i++) {
+                hfo.odsc = odsc_tab[i];
+                err = obj_get_fwd_send(rpc_s, odsc_tab[i].owner, &hfo, fwd_fetch);
+                if (err < 0) {
+                        /* The client should not wait for the others. */
+                        ha->rc = err;
+                        break;
+                }
+        }
+        ha->num_obj = i;
+        free(odsc_tab);
+
+        err = rpc_send(rpc_s, peer, msg);
+        if (err == 0)
+                return 0;
+
+        msg_buf_free(msg);
+ err_out:
+        ERROR_TRACE();
+}
+
+/*
+  Build the reply of a data owner to a routed 'ss_obj_get': an RPC to
+  the requesting client 'cmd->id' with the piece as payload.
+*/
+static int obj_get_fwd_prepare(struct rpc_cmd *cmd, struct msg_buf **pmsg)
+{
+        struct hdr_obj_get_fwd *hf = (struct hdr_obj_get_fwd *) cmd->pad;
+        struct node_id *peer = ds_get_peer(dsg->ds, cmd->id);
+        struct hdr_obj_get *oh;
+        struct msg_buf *msg;
+        struct obj_data *od, *from_obj;
+        iovec_t *iov;
+        int err = -ENOMEM;
+
+        msg = msg_buf_alloc(dsg->ds->rpc_s, peer, 1);
+        if (!msg)
+                goto err_out;
+
+        msg->msg_rpc->cmd = ss_obj_get_data;
+        msg->msg_rpc->id = DSG_ID;
+
+        oh = (struct hdr_obj_get *) msg->msg_rpc->pad;
+        oh->qid = hf->qid;
+        oh->u.o.odsc = hf->odsc;
+        *pmsg = msg;
+
+        pthread_rwlock_rdlock(&dsg->ls_lock);
+        from_obj = ls_find_cover(dsg->ls, &hf->odsc);
+        if (from_obj)
+                __sync_fetch_and_add(&from_obj->refcnt, 1);
+        pthread_rwlock_unlock(&dsg->ls_lock);
+        if (!from_obj) {
+                /* The client waits for every piece, send an empty one. */
+                oh->rc = -ENOENT;
+                return 0;
+        }
+
+        /* Send straight from the stored object if the piece is
+           contiguous in it. */
+        if (ssd_data_iov(from_obj, &hf->odsc, 0, 1, &iov) == 1) {
+                msg->msg_data = iov[0].iov_base;
+                msg->size = iov[0].iov_len;
+                msg->cb = obj_get_ref_completion;
+                msg->private = from_obj;
+                free(iov);
+                return 0;
+        }
+
+        od = obj_data_alloc(&hf->odsc);
+        if (!od) {
+                dsg_obj_unpin(from_obj);
+                msg_buf_free(msg);
+                goto err_out;
+        }
+        ssd_copy(od, from_obj);
+        od->obj_ref = from_obj;
+        dsg_obj_unpin(from_obj);
+
+        msg->msg_data = od->data;
+        msg->size = obj_data_size(&od->obj_desc);
+        msg->cb = obj_get_completion;
+        msg->private = od;
+
+        return 0;
+ err_out:
+        ERROR_TRACE();
+}
+
+/*
+  Step 2: send the piece to the client.
+*/
+static int obj_get_fwd_fetch(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        struct hdr_obj_get_fwd *hf = (struct hdr_obj_get_fwd *) cmd->pad;
+        struct node_id *peer = ds_get_peer(dsg->ds, hf->rank);
+        struct msg_buf *msg = NULL;
+        struct rpc_cmd rcmd = *cmd;
+        int err;
+
+        /* Workers reply to 'cmd.id'. */
+        rcmd.id = hf->rank;
+        if (dsg->num_workers > 0)
+                return dsg_work_post(&rcmd, obj_get_fwd_prepare, 0);
+
+        err = obj_get_fwd_prepare(&rcmd, &msg);
+        if (err < 0)
+                goto err_out;
+
+        err = rpc_send(rpc_s, peer, msg);
+        if (err == 0)
+                return 0;
+
+        (*msg->cb)(rpc_s, msg);
+ err_out:
+        ERROR_TRACE();
+}
+
+/*
+  Rpc routine for routed 'ss_obj_get' requests: the client sends one
+  request and the data owners reply with the pieces.
+*/
+static int dsgrpc_obj_get_fwd(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        struct hdr_obj_get_fwd *hf = (struct hdr_obj_get_fwd *) cmd->pad;
+
+        switch (hf->step) {
+        case fwd_lookup:
+                return obj_get_fwd_lookup(rpc_s, hf);
+        case fwd_fetch:
+                return obj_get_fwd_fetch(rpc_s, cmd);
+        }
+
+        uloga("'%s()': unknown step %d.\n", __func__, hf->step);
+        return -EINVAL;
+}
+
+static int obj_get_batch_completion(struct rpc_server *rpc_s, struct msg_buf *msg)
+{
+        struct hdr_obj_batch *hb = msg->private;
+        struct hdr_obj_get_fwd *hf = (struct hdr_obj_get_fwd *) (hb + 1);
+        int i;
+
+        for (i = 0; i < hb->num_obj; i++)
+                obj_get_fwd_lookup(rpc_s, hf + i);
+
+        free(hb);
+        msg_buf_free(msg);
+        return 0;
+}
+
+/*
+  Rpc routine for the lookups of a batch of routed 'ss_obj_get'
+  requests from one client; each is handled as a 'fwd_lookup' step.
+*/
+static int dsgrpc_obj_get_batch(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        return obj_batch_receive(rpc_s, cmd, obj_get_batch_completion);
+}
+
+/*
+  Worker pool. Requests are queued by the RPC handlers, prepared by the
+  workers and the replies are sent back from dsg_process().
+*/
+static int dsg_work_post(struct rpc_cmd *cmd, 
+        int (*prepare)(struct rpc_cmd *, struct msg_buf **), int f_direct)
+{
+        struct dsg_work *work;
+
+        work = mem_pool_alloc(&dsg_work_pool);
+        if (!work) {
+                uloga("'%s()': failed with %d.\n", __func__, -ENOMEM);
+                return -ENOMEM;
+        }
+
+        work->cmd = *cmd;
+        work->prepare = prepare;
+        work->f_direct = f_direct;
+        work->f_vec = 0;
+        work->msg = NULL;
+
+        pthread_mutex_lock(&dsg->work_lock);
+        list_add_tail(&work->work_entry, &dsg->work_list);
+        pthread_cond_signal(&dsg->work_cond);
+        pthread_mutex_unlock(&dsg->work_lock);
+
+        return 0;
+}
+
+static void *dsg_worker_run(void *arg)
+{
+        struct dsg_work *work;
+        int err;
+
+        while (1) {
+                pthread_mutex_lock(&dsg->work_lock);
+                while (list_empty(&dsg->work_list) && !dsg->f_workers_stop)
+                        pthread_cond_wait(&dsg->work_cond, &dsg->work_lock);
+                if (list_empty(&dsg->work_list)) {
+                        pthread_mutex_unlock(&dsg->work_lock);
+                        break;
+                }
+                work = list_entry(dsg->work_list.next, struct dsg_work, work_entry);
+                list_del(&work->work_entry);
+                pthread_mutex_unlock(&dsg->work_lock);
+
+                err = work->prepare(&work->cmd, &work->msg);
+                if (err < 0)
+                        work->msg = NULL;
+                work->f_vec = (err > 0);
+
+                pthread_mutex_lock(&dsg->work_lock);
+                list_add_tail(&work->work_entry, &dsg->work_done_list);
+                pthread_mutex_unlock(&dsg->work_lock);
+        }
+
+        return NULL;
+}
+
+/*
+  Send the replies prepared by the workers; called on the RPC thread.
+*/
+static int dsg_work_complete(struct ds_gspace *dsg_l)
+{
+        struct dsg_work *work, *t;
+        struct node_id *peer;
+        LIST_HEAD(done);
+        int err;
+
+        pthread_mutex_lock(&dsg_l->work_lock);
+        list_for_each_entry_safe(work, t, &dsg_l->work_done_list, struct dsg_work, work_entry) {
+                list_del(&work->work_entry);
+                list_add_tail(&work->work_entry, &done);
+        }
+        pthread_mutex_unlock(&dsg_l->work_lock);
+
+        list_for_each_entry_safe(work, t, &done, struct dsg_work, work_entry) {
+                list_del(&work->work_entry);
+                if (work->msg) {
+                        peer = ds_get_peer(dsg_l->ds, work->cmd.id);
+                        if (work->f_vec)
+                                err = rpc_send_directv(dsg_l->ds->rpc_s, peer, work->msg);
+                        else if (work->f_direct)
+                                err = rpc_send_direct(dsg_l->ds->rpc_s, peer, work->msg);
+                        else    err = rpc_send(dsg_l->ds->rpc_s, peer, work->msg);
+                        if (err < 0) {
+                                uloga("'%s()': failed with %d.\n", __func__, err);
+                                (*work->msg->cb)(dsg_l->ds->rpc_s, work->msg);
+                        }
+                }
+                mem_pool_free(&dsg_work_pool, work);
+        }
+
+        return 0;
+}
+
+static void dsg_workers_stop(struct ds_gspace *dsg_l);
+
+static int dsg_workers_start(struct ds_gspace *dsg_l, int num_workers)
+{
+        int i, err = -ENOMEM;
+
+        dsg_l->num_workers = 0;
+        dsg_l->f_workers_stop = 0;
+        if (num_workers <= 0)
+                return 0;
+
+        dsg_l->workers = malloc(sizeof(*dsg_l->workers) * num_workers);
+        if (!dsg_l->workers)
+                goto err_out;
+
+        for (i = 0; i < num_workers; i++) {
+                err = pthread_create(&dsg_l->workers[i], NULL, dsg_worker_run, NULL);
+                if (err != 0) {
+                        err = -err;
+                        goto err_out;
+                }
+                dsg_l->num_workers++;
+        }
+
+        return 0;
+ err_out:
+        dsg_workers_stop(dsg_l);
+        ERROR_TRACE();
+}
+
+static void dsg_workers_stop(struct ds_gspace *dsg_l)
+{
+        int i;
+
+        pthread_mutex_lock(&dsg_l->work_lock);
+        dsg_l->f_workers_stop = 1;
+        pthread_cond_broadcast(&dsg_l->work_cond);
+        pthread_mutex_unlock(&dsg_l->work_lock);
+
+        for (i = 0; i < dsg_l->num_workers; i++)
+                pthread_join(dsg_l->workers[i], NULL);
+        dsg_l->num_workers = 0;
+        free(dsg_l->workers);
+        dsg_l->workers = NULL;
+
+        /* Flush the replies of the last requests. */
+        dsg_work_complete(dsg_l);
+}
+
+/*
+  Routine to execute "custom" application filters.
+*/
+static int dsgrpc_obj_filter(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
+{
+        struct hdr_obj_filter *hf = (struct hdr_obj_filter *) cmd->pad;
+        struct node_id *peer = ds_get_peer(dsg->ds, cmd->id);
+        struct msg_buf *msg;
+        struct obj_data *from;
 	double *dval;
         int err = -ENOENT;
 
         // BUG: when using version numbers here.
+        pthread_rwlock_rdlock(&dsg->ls_lock);
         from = ls_find(dsg->ls, &hf->odsc);
         if (!from) {
 		char *str;
+                pthread_rwlock_unlock(&dsg->ls_lock);
                 str = obj_desc_sprint(&hf->odsc);
 		uloga("'%s()': %s\n", __func__, str);
 		free(str);
@@ -2148,10 +3471,13 @@ static int dsgrpc_obj_filter(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 
         err = -ENOMEM;
         dval = malloc(sizeof(*dval));
-        if (!dval)
+        if (!dval) {
+                pthread_rwlock_unlock(&dsg->ls_lock);
                 goto err_out;
+        }
 
         ssd_filter(from, &hf->odsc, dval);
+        pthread_rwlock_unlock(&dsg->ls_lock);
 
         // TODO: process the filter ... and return the result
         msg = msg_buf_alloc(rpc_s, peer, 0);
@@ -2174,15 +3500,62 @@ static int dsgrpc_obj_filter(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 }
 
 /*
-  Routine to return the space info, e.g., number of dimenstions.
+  Set the DHT split of 'epoch' from server 0 and replay the requests
+  that were waiting for it.
+*/
+static int dsg_split_set(int epoch, const uint16_t *w_tab)
+{
+        struct split_wait *sw, *t;
+        struct list_head wait_list;
+        int err;
+
+        err = ssd_split_set(dsg->ssd, epoch, w_tab);
+        if (err < 0)
+                return err;
+
+        INIT_LIST_HEAD(&wait_list);
+        list_for_each_entry_safe(sw, t, &dsg->split_wait_list, struct split_wait, entry) {
+                if (sw->epoch != epoch)
+                        continue;
+                list_del(&sw->entry);
+                list_add_tail(&sw->entry, &wait_list);
+        }
+
+        list_for_each_entry_safe(sw, t, &wait_list, struct split_wait, entry) {
+                list_del(&sw->entry);
+                if (sw->fn)
+                        err = (*sw->fn)(dsg->ds->rpc_s, &sw->cmd);
+                else    err = obj_update_dht(dsg->ssd, &sw->odsc, &sw->gdim);
+                if (err < 0)
+                        uloga("'%s()': failed with %d.\n", __func__, err);
+                free(sw);
+        }
+
+        return 0;
+}
+
+/*
+  Routine to return the space info, e.g., number of dimenstions. It
+  also carries the DHT splits: server 0 answers 'ss_split_get' requests
+  with the split of an epoch, and merges the load the servers report.
 */
 static int dsgrpc_ss_info(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 {
+	struct hdr_ss_info *hi = (struct hdr_ss_info *) cmd->pad;
 	struct node_id *peer = ds_get_peer(dsg->ds, cmd->id);
+	uint16_t w_tab[SSD_SPLIT_BUCKETS];
 	struct hdr_ss_info *hsi;
 	struct msg_buf *msg;
 	int err = -ENOMEM;
 
+	if (hi->split_op == ss_split_reply) {
+		memcpy(w_tab, hi->split_w, sizeof(w_tab));
+		err = dsg_split_set(hi->split_epoch, w_tab);
+		if (err < 0)
+			goto err_out;
+		return 0;
+	}
+
 	msg = msg_buf_alloc(rpc_s, peer, 1);
 	if (!msg)
 		goto err_out;
@@ -2199,10 +3572,35 @@ static int dsgrpc_ss_info(struct rpc_server *rpc_s, struct rpc_cmd *cmd)
 	hsi->num_space_srv = dsg->ds->size_sp;
     hsi->hash_version = ds_conf.hash_version;
     hsi->max_versions = ds_conf.max_versions;
+    hsi->data_placement = ds_conf.data_placement;
+    hsi->split_period = ds_conf.dht_rebalance;
+    hsi->split_op = ss_split_none;
+
+    if (hi->split_op == ss_split_get && dsg->ssd->split_period) {
+        if (cmd->id < dsg->ds->size_sp) {
+            memcpy(w_tab, hi->split_w, sizeof(w_tab));
+            ssd_split_merge_load(dsg->ssd, w_tab, hi->split_shift);
+        }
+
+        if (!ssd_split_find(dsg->ssd, hi->split_epoch)) {
+            ssd_split_decide(dsg->ssd, w_tab);
+            ssd_split_set(dsg->ssd, hi->split_epoch, w_tab);
+        }
+        if (ssd_split_get(dsg->ssd, hi->split_epoch, w_tab) < 0) {
+            msg_buf_free(msg);
+            err = -ENOMEM;
+            goto err_out;
+        }
+
+        hsi->split_op = ss_split_reply;
+        hsi->split_epoch = hi->split_epoch;
+        memcpy(hsi->split_w, w_tab, sizeof(w_tab));
+    }
 
 	err = rpc_send(rpc_s, peer, msg);
 	if (err == 0)
 		return 0;
+	msg_buf_free(msg);
  err_out:
 	ERROR_TRACE();
 }
@@ -2234,6 +3632,11 @@ struct ds_gspace *dsg_alloc(int num_sp, int num_cp, char *conf_name, void *comm)
         ds_conf.max_readers = 1;
         ds_conf.lock_type = 1;
         ds_conf.hash_version = ssd_hash_version_v1;
+        ds_conf.num_workers = 0;
+        ds_conf.data_placement = ds_place_writer;
+        ds_conf.mem_budget = 0;
+        ds_conf.payload_arena = 0;
+        ds_conf.dht_rebalance = 0;
 
         err = parse_conf(conf_name);
         if (err < 0) {
@@ -2258,6 +3661,44 @@ struct ds_gspace *dsg_alloc(int num_sp, int num_cp, char *conf_name, void *comm)
             goto err_out;
         }
 
+        if (ds_conf.num_workers < 0) {
+            uloga("%s(): ERROR invalid number of workers %d in file '%s'\n",
+                __func__, ds_conf.num_workers, conf_name);
+            err = -EINVAL;
+            goto err_out;
+        }
+
+        if ((ds_conf.data_placement < ds_place_writer) ||
+            (ds_conf.data_placement >= _ds_place_count)) {
+            uloga("%s(): ERROR unknown data placement %d in file '%s'\n",
+                __func__, ds_conf.data_placement, conf_name);
+            err = -EINVAL;
+            goto err_out;
+        }
+
+        if (ds_conf.mem_budget < 0) {
+            uloga("%s(): ERROR invalid memory budget %d in file '%s'\n",
+                __func__, ds_conf.mem_budget, conf_name);
+            err = -EINVAL;
+            goto err_out;
+        }
+
+        if (ds_conf.payload_arena < 0) {
+            uloga("%s(): ERROR invalid payload arena size %d in file '%s'\n",
+                __func__, ds_conf.payload_arena, conf_name);
+            err = -EINVAL;
+            goto err_out;
+        }
+
+        if (ds_conf.dht_rebalance < 0 || (ds_conf.dht_rebalance > 0 &&
+            ds_conf.hash_version == ssd_hash_version_v2)) {
+            uloga("%s(): ERROR invalid dht_rebalance %d for hash version %d "
+                "in file '%s'\n", __func__, ds_conf.dht_rebalance,
+                ds_conf.hash_version, conf_name);
+            err = -EINVAL;
+            goto err_out;
+        }
+
        if((ds_conf.lock_type < lock_generic) ||
             (ds_conf.lock_type >= _lock_type_count)) {
             uloga("%s(): ERROR unknown lock type %d in file '%s'\n",
@@ -2282,7 +3723,11 @@ struct ds_gspace *dsg_alloc(int num_sp, int num_cp, char *conf_name, void *comm)
         rpc_add_service(ss_obj_get_dht_peers, dsgrpc_obj_send_dht_peers);
         rpc_add_service(ss_obj_get_desc, dsgrpc_obj_get_desc);
         rpc_add_service(ss_obj_get, dsgrpc_obj_get);
+        rpc_add_service(ss_obj_get_fwd, dsgrpc_obj_get_fwd);
         rpc_add_service(ss_obj_put, dsgrpc_obj_put);
+        rpc_add_service(ss_obj_put_batch, dsgrpc_obj_put_batch);
+        rpc_add_service(ss_obj_update_batch, dsgrpc_obj_update_batch);
+        rpc_add_service(ss_obj_get_batch, dsgrpc_obj_get_batch);
        	rpc_add_service(ss_obj_get_next_meta, dsgrpc_obj_get_next_meta);
         rpc_add_service(ss_obj_get_latest_meta, dsgrpc_obj_get_latest_meta);
         rpc_add_service(ss_obj_get_var_meta, dsgrpc_obj_get_var_meta);
@@ -2299,6 +3744,17 @@ struct ds_gspace *dsg_alloc(int num_sp, int num_cp, char *conf_name, void *comm)
         INIT_LIST_HEAD(&dsg_l->obj_desc_req_list);
         INIT_LIST_HEAD(&dsg_l->obj_data_req_list);
         INIT_LIST_HEAD(&dsg_l->locks_list);
+        INIT_LIST_HEAD(&dsg_l->layout_watch_list);
+        INIT_LIST_HEAD(&dsg_l->split_wait_list);
+        INIT_LIST_HEAD(&dsg_l->work_list);
+        INIT_LIST_HEAD(&dsg_l->work_done_list);
+        pthread_mutex_init(&dsg_l->work_lock, NULL);
+        pthread_cond_init(&dsg_l->work_cond, NULL);
+        pthread_rwlock_init(&dsg_l->ls_lock, NULL);
+        pthread_rwlock_init(&dsg_l->dht_lock, NULL);
+        pthread_mutex_init(&dsg_l->sspace_lock, NULL);
+        dsg_l->num_workers = 0;
+        dsg_l->workers = NULL;
 
         dsg_l->ds = ds_alloc(num_sp, num_cp, dsg_l, comm);
         if (!dsg_l->ds)
@@ -2315,6 +3771,25 @@ struct ds_gspace *dsg_alloc(int num_sp, int num_cp, char *conf_name, void *comm)
             goto err_free;
         }
 
+#ifndef SHMEM_OBJECTS
+        if (ds_conf.mem_budget > 0) {
+            const char *spill_dir = getenv("DATASPACES_SPILL_DIR");
+
+            err = ls_set_mem_budget(dsg_l->ls,
+                        (uint64_t) ds_conf.mem_budget << 20,
+                        spill_dir ? spill_dir : "/tmp");
+            if (err < 0)
+                goto err_free;
+        }
+
+        if (ds_conf.payload_arena > 0)
+            obj_data_arena_init((size_t) ds_conf.payload_arena << 20);
+#endif
+
+        err = dsg_workers_start(dsg_l, ds_conf.num_workers);
+        if (err < 0)
+            goto err_free;
+
         dsg->kill = 0;
 
         return dsg_l;
@@ -2348,10 +3823,20 @@ void dsg_dht_print_descriptors(const struct obj_descriptor *odsc_tab[], int n)
 
 void dsg_free(struct ds_gspace *dsg)
 {
+        dsg_workers_stop(dsg);
         ds_free(dsg->ds);
         free_sspace(dsg);
         ls_free(dsg->ls);
+        layout_watch_free(dsg);
+        pthread_mutex_destroy(&dsg->work_lock);
+        pthread_cond_destroy(&dsg->work_cond);
+        pthread_rwlock_destroy(&dsg->ls_lock);
+        pthread_rwlock_destroy(&dsg->dht_lock);
+        pthread_mutex_destroy(&dsg->sspace_lock);
         free(dsg);
+
+        if (getenv("DATASPACES_POOL_STATS"))
+                mem_pool_print_stats();
 }
 
 
@@ -2363,6 +3848,9 @@ int dsg_process(struct ds_gspace *dsg)
 	if (err < 0)
 		rpc_report_md_usage(dsg->ds->rpc_s);
 
+	if (dsg->num_workers > 0)
+		dsg_work_complete(dsg);
+
 	return err;
 }
 
@@ -33,14 +33,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <math.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "debug.h"
 #include "ss_data.h"
-#include "queue.h"
+#include "mempool.h"
 
 #ifdef TIMING_SSD
 #include "timer.h"
@@ -49,6 +56,14 @@
 // TODO: I should  import the header file with  the definition for the
 // iovec_t data type.
 
+/* Object headers and DHT descriptor nodes churn with every put. */
+static struct mem_pool obj_data_pool =
+        MEM_POOL_INIT("obj_data", sizeof(struct obj_data), 1024);
+static struct mem_pool odsc_list_pool =
+        MEM_POOL_INIT("obj_desc_list", sizeof(struct obj_desc_list), 1024);
+
+static void obj_data_free_payload(struct obj_data *od);
+
 /*
   A view in  the matrix allows to extract any subset  of values from a
   matrix.
@@ -74,15 +89,20 @@ struct matrix_desc {
 */
 struct sfc_hash_cache {
         struct list_head                sh_entry;
+        struct list_head                sh_lru_entry;
 
         struct bbox                     sh_bb;
+        /* Epoch split the result is for, -1 for the base one. */
+        int                             sh_epoch;
 
         struct dht_entry                **sh_de_tab;
         int                             sh_nodes;
 };
 
-static LIST_HEAD(sfc_hash_list);
-static int is_sfc_hash_list_free = 0;
+/* Default bound on the cached bounding boxes of a shared space. */
+#ifndef SFC_HASH_CACHE_SIZE
+#define SFC_HASH_CACHE_SIZE     4096
+#endif
 
 static uint64_t next_pow_2_v2(uint64_t n)
 {
@@ -120,23 +140,77 @@ static int compute_bits(uint64_t n)
         return nr_bits;
 }
 
-int sh_add(const struct bbox *bb, struct dht_entry *de_tab[], int n)
+static uint64_t sh_bbox_hash(const struct bbox *bb)
+{
+        uint64_t h = 14695981039346656037ULL;
+        int i;
+
+        for (i = 0; i < bb->num_dims; i++) {
+                h = (h ^ bb->lb.c[i]) * 1099511628211ULL;
+                h = (h ^ bb->ub.c[i]) * 1099511628211ULL;
+        }
+
+        return h ^ (h >> 32);
+}
+
+static void sh_del(struct sfc_hash_tab *sht, struct sfc_hash_cache *shc)
+{
+        list_del(&shc->sh_entry);
+        list_del(&shc->sh_lru_entry);
+        free(shc);
+        sht->num_ent--;
+}
+
+static int sh_init(struct sfc_hash_tab *sht)
+{
+        int i;
+
+        sht->max_ent = SFC_HASH_CACHE_SIZE;
+        sht->size_hash = next_pow_2(SFC_HASH_CACHE_SIZE / 4 + 1);
+        sht->sh_hash = malloc(sizeof(struct list_head) * sht->size_hash);
+        if (!sht->sh_hash) {
+                sht->size_hash = 0;
+                return -ENOMEM;
+        }
+
+        for (i = 0; i < sht->size_hash; i++)
+                INIT_LIST_HEAD(&sht->sh_hash[i]);
+        INIT_LIST_HEAD(&sht->sh_lru);
+
+        return 0;
+}
+
+static int sh_add(struct sspace *ss, const struct bbox *bb, int epoch,
+                  struct dht_entry *de_tab[], int n)
 {
+        struct sfc_hash_tab *sht = &ss->sh_tab;
         struct sfc_hash_cache *shc;
         int i, err = -ENOMEM;
 
+        if (!sht->sh_hash && sh_init(sht) < 0)
+                goto err_out;
+
+        /* Make room by evicting the least recently used entry. */
+        if (sht->num_ent >= sht->max_ent)
+                sh_del(sht, list_entry(sht->sh_lru.prev, 
+                                       struct sfc_hash_cache, sh_lru_entry));
+
         shc = malloc(sizeof(*shc) + sizeof(de_tab[0]) * n);
         if (!shc)
                 goto err_out;
 
         shc->sh_bb = *bb;
+        shc->sh_epoch = epoch;
         shc->sh_nodes = n;
 
         shc->sh_de_tab = (struct dht_entry **) (shc+1);
         for (i = 0; i < n; i++)
                 shc->sh_de_tab[i] = de_tab[i];
 
-        list_add_tail(&shc->sh_entry, &sfc_hash_list);
+        list_add(&shc->sh_entry, 
+                 &sht->sh_hash[sh_bbox_hash(bb) & (sht->size_hash - 1)]);
+        list_add(&shc->sh_lru_entry, &sht->sh_lru);
+        sht->num_ent++;
 
         return 0;
  err_out:
@@ -144,38 +218,54 @@ int sh_add(const struct bbox *bb, struct dht_entry *de_tab[], int n)
         return err;
 }
 
-int sh_find(const struct bbox *bb, struct dht_entry *de_tab[])
+static int sh_find(struct sspace *ss, const struct bbox *bb, int epoch,
+                   struct dht_entry *de_tab[])
 {
+        struct sfc_hash_tab *sht = &ss->sh_tab;
         struct sfc_hash_cache *shc;
+        struct list_head *list;
         int i;
 
-        list_for_each_entry(shc, &sfc_hash_list, struct sfc_hash_cache, sh_entry) {
-                if (bbox_equals(bb, &shc->sh_bb)) {
+        if (!sht->sh_hash) {
+                sht->num_miss++;
+                return -1;
+        }
+
+        list = &sht->sh_hash[sh_bbox_hash(bb) & (sht->size_hash - 1)];
+        list_for_each_entry(shc, list, struct sfc_hash_cache, sh_entry) {
+                if (shc->sh_epoch == epoch && bbox_equals(bb, &shc->sh_bb)) {
                         for (i = 0; i < shc->sh_nodes; i++)
                                 de_tab[i] = shc->sh_de_tab[i];
+
+                        list_del(&shc->sh_lru_entry);
+                        list_add(&shc->sh_lru_entry, &sht->sh_lru);
+                        sht->num_hit++;
                         return shc->sh_nodes;
                 }
         }
 
+        sht->num_miss++;
         return -1;
 }
 
-void sh_free(void)
+static void sh_free(struct sspace *ss)
 {
-        if (is_sfc_hash_list_free) return;
-
+        struct sfc_hash_tab *sht = &ss->sh_tab;
         struct sfc_hash_cache *l, *t;
-        int n = 0;
 
-        list_for_each_entry_safe(l, t, &sfc_hash_list, struct sfc_hash_cache, sh_entry) {
-                free(l);
-                n++;
-        }
+        if (!sht->sh_hash)
+                return;
+
 #ifdef DEBUG
-        uloga("'%s()': SFC cached %d object descriptors, size = %zu.\n", 
-            __func__, n, sizeof(*l) *n);
+        uloga("'%s()': SFC cached %d bounding boxes, %" PRIu64 " hits, "
+              "%" PRIu64 " misses.\n", __func__, sht->num_ent, 
+              sht->num_hit, sht->num_miss);
 #endif
-        is_sfc_hash_list_free = 1;
+        list_for_each_entry_safe(l, t, &sht->sh_lru, struct sfc_hash_cache, sh_lru_entry)
+                sh_del(sht, l);
+
+        free(sht->sh_hash);
+        sht->sh_hash = 0;
 }
 
 static void matrix_init(struct matrix_desc *mat, enum storage_type st,
@@ -197,108 +287,137 @@ static void matrix_init(struct matrix_desc *mat, enum storage_type st,
     mat->size_elem = se;
 }
 
-static void matrix_copy(struct matrix_desc *a, char *A, const struct matrix_desc *b, const char *B)
+/* Contiguous runs of at least this size are copied with streaming
+   stores, which do not pull the destination into the cache. */
+#define MATRIX_COPY_NT_MIN      (1 << 20)
+
+static void matrix_copy_stream(char *dst, const char *src, uint64_t len)
 {
+#ifdef __SSE2__
+        uint64_t head = (16 - ((uintptr_t) dst & 15)) & 15;
+
+        memcpy(dst, src, head);
+        dst += head;
+        src += head;
+        len -= head;
+
+        for (; len >= 64; len -= 64, dst += 64, src += 64) {
+                __m128i x0 = _mm_loadu_si128((const __m128i *) src);
+                __m128i x1 = _mm_loadu_si128((const __m128i *) (src + 16));
+                __m128i x2 = _mm_loadu_si128((const __m128i *) (src + 32));
+                __m128i x3 = _mm_loadu_si128((const __m128i *) (src + 48));
+
+                _mm_stream_si128((__m128i *) dst, x0);
+                _mm_stream_si128((__m128i *) (dst + 16), x1);
+                _mm_stream_si128((__m128i *) (dst + 32), x2);
+                _mm_stream_si128((__m128i *) (dst + 48), x3);
+        }
+        _mm_sfence();
+#endif
+        memcpy(dst, src, len);
+}
 
-    uint64_t a0, a1, a2, a3, a4, a5, a6, a7, a8, a9;
-    uint64_t aloc=0, aloc1=0, aloc2=0, aloc3=0, aloc4=0, aloc5=0, aloc6=0, aloc7=0, aloc8=0, aloc9=0;
-    uint64_t b0, b1, b2, b3, b4, b5, b6, b7, b8, b9;
-    uint64_t bloc=0, bloc1=0, bloc2=0, bloc3=0, bloc4=0, bloc5=0, bloc6=0, bloc7=0, bloc8=0, bloc9=0;
-    uint64_t numelem;
-
-    switch(a->num_dims){
-        case(1):    
-            goto dim1;
-            break;
-        case(2):
-            goto dim2;
-            break;
-        case(3):
-            goto dim3;
-            break;
-        case(4):
-            goto dim4;
-            break;
-        case(5):
-            goto dim5;
-            break;
-        case(6):
-            goto dim6;
-            break;
-        case(7):
-            goto dim7;
-            break;
-        case(8):
-            goto dim8;
-            break;
-        case(9):
-            goto dim9;
-            break;
-        case(10):
-            goto dim10;
-            break;
+/*
+  Copy one contiguous run; the common element sizes are inlined.
+*/
+static inline void matrix_copy_run(char *dst, const char *src, uint64_t len)
+{
+        switch (len) {
+        case 4:
+                memcpy(dst, src, 4);
+                break;
+        case 8:
+                memcpy(dst, src, 8);
+                break;
+        case 16:
+                memcpy(dst, src, 16);
+                break;
         default:
-            break;
-    }
-    
-dim10:        for(a9 = a->mat_view.lb[9], b9 = b->mat_view.lb[9];   //TODO-Q
-            a9 <= a->mat_view.ub[9]; a9++, b9++){
-            aloc9 = a9 * a->dist[8];
-            bloc9 = a9 * b->dist[8];
-dim9:        for(a8 = a->mat_view.lb[8], b8 = b->mat_view.lb[8];    //TODO-Q
-            a8 <= a->mat_view.ub[8]; a8++, b8++){
-            aloc8 = (aloc9 + a8) * a->dist[7];
-            bloc8 = (bloc9 + b8) * b->dist[7];
-dim8:        for(a7 = a->mat_view.lb[7], b7 = b->mat_view.lb[7];    //TODO-Q
-            a7 <= a->mat_view.ub[7]; a7++, b7++){
-            aloc7 = (aloc8 + a7) * a->dist[6];
-            bloc7 = (bloc8 + b7) * b->dist[6];
-dim7:        for(a6 = a->mat_view.lb[6], b6 = b->mat_view.lb[6];    //TODO-Q
-            a6 <= a->mat_view.ub[6]; a6++, b6++){
-            aloc6 = (aloc7 + a6) * a->dist[5];
-            bloc6 = (bloc7 + b6) * b->dist[5];
-dim6:        for(a5 = a->mat_view.lb[5], b5 = b->mat_view.lb[5];    //TODO-Q
-            a5 <= a->mat_view.ub[5]; a5++, b5++){
-            aloc5 = (aloc6 + a5) * a->dist[4];
-            bloc5 = (bloc6 + b5) * b->dist[4];
-dim5:        for(a4 = a->mat_view.lb[4], b4 = b->mat_view.lb[4];
-            a4 <= a->mat_view.ub[4]; a4++, b4++){
-            aloc4 = (aloc5 + a4) * a->dist[3];
-            bloc4 = (bloc5 + b4) * b->dist[3];
-dim4:        for(a3 = a->mat_view.lb[3], b3 = b->mat_view.lb[3];
-            a3 <= a->mat_view.ub[3]; a3++, b3++){
-            aloc3 = (aloc4 + a3) * a->dist[2];
-            bloc3 = (bloc4 + b3) * b->dist[2];
-dim3:            for(a2 = a->mat_view.lb[2], b2 = b->mat_view.lb[2];
-                a2 <= a->mat_view.ub[2]; a2++, b2++){
-                aloc2 = (aloc3 + a2) * a->dist[1];
-                bloc2 = (bloc3 + b2) * b->dist[1];
-dim2:                for(a1 = a->mat_view.lb[1], b1 = b->mat_view.lb[1];
-                    a1 <= a->mat_view.ub[1]; a1++, b1++){
-                    aloc1 = (aloc2 + a1) * a->dist[0];
-                    bloc1 = (bloc2 + b1) * b->dist[0];
-dim1:               numelem = (a->mat_view.ub[0] - a->mat_view.lb[0]) + 1;
-                    aloc = aloc1 + a->mat_view.lb[0];
-                    bloc = bloc1 + b->mat_view.lb[0];
-                    memcpy(&A[aloc*a->size_elem], &B[bloc*a->size_elem], (a->size_elem * numelem));     
-            if(a->num_dims == 1)    return;
+                if (len >= MATRIX_COPY_NT_MIN)
+                        matrix_copy_stream(dst, src, len);
+                else    memcpy(dst, src, len);
+        }
+}
+
+static inline void matrix_copy_2d(char *A, const char *B, uint64_t run,
+                                  uint64_t n0, uint64_t sa0, uint64_t sb0,
+                                  uint64_t n1, uint64_t sa1, uint64_t sb1)
+{
+        uint64_t i, j;
+
+        for (j = 0; j < n1; j++, A += sa1, B += sb1)
+                for (i = 0; i < n0; i++)
+                        matrix_copy_run(A + i * sa0, B + i * sb0, run);
+}
+
+/*
+  Copy the view of matrix 'b' into the view of matrix 'a'. Dimension 0
+  varies fastest. The leading dimensions that are copied in full in
+  both matrices are merged into one contiguous run, and the remaining
+  ones are walked by the 1D, 2D or the generic N-d loop.
+*/
+static void matrix_copy(struct matrix_desc *a, char *A, const struct matrix_desc *b, const char *B)
+{
+        uint64_t cnt[BBOX_MAX_NDIM], sa[BBOX_MAX_NDIM], sb[BBOX_MAX_NDIM];
+        uint64_t idx[BBOX_MAX_NDIM];
+        uint64_t stride_a, stride_b, run, i;
+        int num_dims, d, k, n;
+
+        /* Bounded so that the walk provably stays in the tables. */
+        num_dims = min(a->num_dims, BBOX_MAX_NDIM);
+        memset(cnt, 0, sizeof(cnt));
+
+        /* Offset of the views, and the stride of each dimension in bytes. */
+        stride_a = stride_b = a->size_elem;
+        for (d = 0; d < num_dims; d++) {
+                A += a->mat_view.lb[d] * stride_a;
+                B += b->mat_view.lb[d] * stride_b;
+
+                cnt[d] = a->mat_view.ub[d] - a->mat_view.lb[d] + 1;
+                sa[d] = stride_a;
+                sb[d] = stride_b;
+
+                stride_a *= a->dist[d];
+                stride_b *= b->dist[d];
+        }
+
+        run = cnt[0] * a->size_elem;
+        for (d = 1; d < num_dims && run == sa[d] && run == sb[d]; d++)
+                run *= cnt[d];
+
+        /* Dimensions [d, num_dims) are left to walk. */
+        n = num_dims - d;
+        switch (n) {
+        case 0:
+                matrix_copy_run(A, B, run);
+                return;
+        case 1:
+                for (i = 0; i < cnt[d]; i++)
+                        matrix_copy_run(A + i * sa[d], B + i * sb[d], run);
+                return;
+        case 2:
+                matrix_copy_2d(A, B, run, cnt[d], sa[d], sb[d],
+                               cnt[d+1], sa[d+1], sb[d+1]);
+                return;
+        }
+
+        memset(idx, 0, sizeof(idx));
+        while (1) {
+                matrix_copy_2d(A, B, run, cnt[d], sa[d], sb[d],
+                               cnt[d+1], sa[d+1], sb[d+1]);
+
+                for (k = d + 2; k < num_dims; k++) {
+                        A += sa[k];
+                        B += sb[k];
+                        if (++idx[k] < cnt[k])
+                                break;
+                        A -= sa[k] * cnt[k];
+                        B -= sb[k] * cnt[k];
+                        idx[k] = 0;
                 }
-        if(a->num_dims == 2)    return;
-            }
-        if(a->num_dims == 3)    return; 
+                if (k == num_dims)
+                        return;
         }
-    if(a->num_dims == 4)    return;
-    }
-    if(a->num_dims == 5)    return;
-    }
-    if(a->num_dims == 6)    return;
-    }
-    if(a->num_dims == 7)    return;
-    }
-    if(a->num_dims == 8)    return;
-    }
-    if(a->num_dims == 9)    return;
-    }
 }
 
 static void get_bbox_max_dim(const struct bbox *bb, uint64_t *out_max_dim,
@@ -334,9 +453,8 @@ static void get_bbox_max_dim_size(const struct bbox *bb, uint64_t *out_max_dim_s
 static struct dht_entry * dht_entry_alloc(struct sspace *ssd, int size_hash)
 {
 	struct dht_entry *de;
-	int i;
 
-	de = malloc(sizeof(*de) + sizeof(struct obj_desc_list)*(size_hash-1));
+	de = malloc(sizeof(*de));
 	if (!de) {
 		errno = ENOMEM;
 		return de;
@@ -346,8 +464,13 @@ static struct dht_entry * dht_entry_alloc(struct sspace *ssd, int size_hash)
 	de->ss = ssd;
 	de->odsc_size = size_hash;
 
-	for (i = 0; i < size_hash; i++)
-		INIT_LIST_HEAD(&de->odsc_hash[i]);
+	if (spv_init(&de->odsc_vars, size_hash,
+		     offsetof(struct obj_desc_list, odsc.bb) -
+		     offsetof(struct obj_desc_list, odsc_entry)) < 0) {
+		free(de);
+		errno = ENOMEM;
+		return NULL;
+	}
 
     de->num_bbox = 0;
     de->size_bb_tab = 0;
@@ -357,15 +480,23 @@ static struct dht_entry * dht_entry_alloc(struct sspace *ssd, int size_hash)
 
 static void dht_entry_free(struct dht_entry *de)
 {
-	struct obj_desc_list *l, *t;
-	int i;
+	struct sp_var *var, *tv;
+	struct list_head *e, *t;
+	int i, j;
 
 	//TODO: free the *intv and other resources.
 	free(de->i_tab);
-	for (i = 0; i < de->odsc_size; i++) {
-		list_for_each_entry_safe(l, t, &de->odsc_hash[i], struct obj_desc_list, odsc_entry) 
-			free(l);
+	for (i = 0; i < de->odsc_vars.size_hash; i++) {
+		list_for_each_entry_safe(var, tv, &de->odsc_vars.var_hash[i], struct sp_var, var_entry) {
+			for (j = 0; j < var->spi.size_hash; j++) {
+				list_for_each_safe(e, t, &var->spi.obj_hash[j])
+					mem_pool_free(&odsc_list_pool,
+						list_entry(e, struct obj_desc_list, odsc_entry));
+			}
+			spv_del(&de->odsc_vars, var);
+		}
 	}
+	spv_free(&de->odsc_vars);
 
 	free(de);
 }
@@ -394,8 +525,8 @@ dht_alloc(struct sspace *ssd, const struct bbox *bb_domain, int num_nodes, int s
 
 	if (i != num_nodes) {
 		errno = ENOMEM;
-		while (--i > 0)
-			free(dht->ent_tab[i]);
+		while (--i >= 0)
+			dht_entry_free(dht->ent_tab[i]);
 		free(dht);
 		dht = 0;
 	}
@@ -408,8 +539,9 @@ static void dht_free(struct dht *dht)
 	int i;
 
 	for (i = 0; i < dht->num_entries; i++)
-		free(dht->ent_tab[i]);
+		dht_entry_free(dht->ent_tab[i]);
 
+	free(dht->seg_tab);
 	free(dht);
 }
 
@@ -421,25 +553,67 @@ static void dht_free_v2(struct dht *dht)
         if (dht->ent_tab[i]->bb_tab) {
             free(dht->ent_tab[i]->bb_tab);
         }
-        free(dht->ent_tab[i]);
+        dht_entry_free(dht->ent_tab[i]);
     }
 
     free(dht);
 }
 
-static int dht_intersect(struct dht_entry *de, struct intv *itv)
+/*
+  Flatten the intervals of the DHT entries into one table; the entries
+  hold consecutive parts of the index space, so it is sorted.
+*/
+static int dht_construct_seg(struct dht *dht)
 {
-        int i;
+        struct dht_entry *de;
+        int i, j, n = 0;
 
-        if (de->i_virt.lb > itv->ub || de->i_virt.ub < itv->lb)
-                return 0;
+        for (i = 0; i < dht->num_entries; i++)
+                n += dht->ent_tab[i]->num_intv;
+
+        dht->seg_tab = malloc(sizeof(*dht->seg_tab) * n);
+        if (!dht->seg_tab)
+                return -ENOMEM;
+
+        for (i = 0; i < dht->num_entries; i++) {
+                de = dht->ent_tab[i];
+                for (j = 0; j < de->num_intv; j++) {
+                        dht->seg_tab[dht->num_seg].intv = de->i_tab[j];
+                        dht->seg_tab[dht->num_seg].rank = i;
+                        dht->seg_tab[dht->num_seg].next = 
+                                dht->num_seg - j + de->num_intv;
+                        dht->num_seg++;
+                }
+        }
 
-        for (i = 0; i < de->num_intv; i++)
-                if (intv_do_intersect(&de->i_tab[i], itv))
-                        return 1;
         return 0;
 }
 
+/*
+  Index of the first interval in 'seg_tab' that ends at or after 'lb',
+  or 'num_seg' if there is none.
+*/
+static int dht_seg_search(const struct dht_seg *seg_tab, int num_seg, uint64_t lb)
+{
+        int lo = 0, hi = num_seg, mid;
+
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (seg_tab[mid].intv.ub < lb)
+                        lo = mid + 1;
+                else    hi = mid;
+        }
+
+        return lo;
+}
+
+/* SFC the index space of a v1 or v3 shared space is built on. */
+static inline enum sfc_curve ssd_get_curve(const struct sspace *ss)
+{
+        return (ss->hash_version == ssd_hash_version_v3) ? 
+                sfc_morton : sfc_hilbert;
+}
+
 static uint64_t ssd_get_max_dim(struct sspace *ss)
 {
         return ss->max_dim;
@@ -463,8 +637,8 @@ static int dht_construct_hash(struct dht *dht, struct sspace *ssd)
         int num_intv, i, j;
         int err = -ENOMEM;
 
-        bbox_to_intv(&dht->bb_glb_domain, ssd->max_dim, ssd->bpd, 
-                     &i_tab, &num_intv);
+        bbox_to_intv_sfc(&dht->bb_glb_domain, ssd->max_dim, 
+                         ssd_get_curve(ssd), &i_tab, &num_intv);
 
         for (i = 0, j = 0; i < dht->num_entries; i++) {
                 len = sn;
@@ -498,14 +672,19 @@ static int dht_construct_hash(struct dht *dht, struct sspace *ssd)
 
         free(i_tab);
 
-        if (i == dht->num_entries)
+        if (i == dht->num_entries && dht_construct_seg(dht) == 0)
                 return 0;
 
         uloga("'%s()': failed at entry %d.\n", __func__, i);
         return err;
 }
 
-static struct sspace *ssd_alloc_v1(const struct bbox *bb_domain, int num_nodes, int max_versions)
+/*
+  Shared space linearized with a SFC: 'hash_version' is
+  ssd_hash_version_v1 (Hilbert) or ssd_hash_version_v3 (Z-order).
+*/
+static struct sspace *ssd_alloc_v1(const struct bbox *bb_domain, int num_nodes, int max_versions,
+    enum sspace_hash_version hash_version)
 {
         struct sspace *ssd;
         uint64_t max_dim;
@@ -515,7 +694,7 @@ static struct sspace *ssd_alloc_v1(const struct bbox *bb_domain, int num_nodes,
         if (!ssd)
                 goto err_out;
         memset(ssd, 0, sizeof(*ssd));
-
+        ssd->hash_version = hash_version;
 
         ssd->dht = dht_alloc(ssd, bb_domain, num_nodes, max_versions);
         if (!ssd->dht) {
@@ -540,104 +719,112 @@ static struct sspace *ssd_alloc_v1(const struct bbox *bb_domain, int num_nodes,
                 goto err_out;
         }
 
-        ssd->hash_version = ssd_hash_version_v1;
         return ssd;
  err_out:
         uloga("'%s()': failed with %d\n", __func__, err);
         return NULL;
 }
 
+static void ssd_split_free(struct sspace *ss)
+{
+        int i;
+
+        for (i = 0; i < ss->num_split; i++)
+                free(ss->split_tab[i].seg_tab);
+        free(ss->split_tab);
+        free(ss->dom_tab);
+        free(ss->dom_pos);
+}
+
 static void ssd_free_v1(struct sspace *ssd)
 {
         dht_free(ssd->dht);
+        sh_free(ssd);
+        ssd_split_free(ssd);
         free(ssd);
-        sh_free();
+}
+
+/* Max number of SFC intervals a box is hashed with; larger sets are
+   coarsened, which can only add DHT entries that index no part of the
+   box to the result, see ssd_hash_self(). */
+#define SSD_HASH_MAX_INTV       256
+
+/*
+  Find the DHT entries whose intervals in 'seg_tab' intersect 'bb'.
+*/
+static int ssd_hash_seg(struct sspace *ss, const struct dht_seg *seg_tab,
+                        int num_seg, const struct bbox *bb,
+                        struct dht_entry *de_tab[])
+{
+        struct intv i_tab[SSD_HASH_MAX_INTV];
+        struct coord c_tab[2 * SSD_HASH_MAX_INTV];
+        struct dht *dht = ss->dht;
+        const struct dht_seg *seg;
+        int i, k, n, num_nodes = 0;
+
+        n = bbox_to_intv_cap(bb, ss->max_dim, ssd_get_curve(ss), 
+                             i_tab, SSD_HASH_MAX_INTV, c_tab);
+
+        /* The query intervals are sorted and so are the DHT intervals,
+           so the entries come out in rank order; once an entry matches,
+           skip the rest of its intervals. */
+        for (i = 0; i < n; i++) {
+                k = dht_seg_search(seg_tab, num_seg, i_tab[i].lb);
+                while (k < num_seg && seg_tab[k].intv.lb <= i_tab[i].ub) {
+                        seg = &seg_tab[k];
+                        if (num_nodes == 0 || 
+                            de_tab[num_nodes-1] != dht->ent_tab[seg->rank])
+                                de_tab[num_nodes++] = dht->ent_tab[seg->rank];
+                        k = seg->next;
+                }
+        }
+
+        return num_nodes;
 }
 
 static int ssd_hash_v1(struct sspace *ss, const struct bbox *bb, struct dht_entry *de_tab[])
 {
-        struct intv *i_tab;
-        int i, k, n, num_nodes;
+        int num_nodes;
 
-        num_nodes = sh_find(bb, de_tab);
+        num_nodes = sh_find(ss, bb, -1, de_tab);
         if (num_nodes > 0)
                 /* This is great, I hit the cache. */
                 return num_nodes;
 
-        num_nodes = 0;
-
-        bbox_to_intv2(bb, ss->max_dim, ss->bpd, &i_tab, &n);
-
-        for (k = 0; k < ss->dht->num_entries; k++){
-                for (i = 0; i < n; i++) {
-                        if (dht_intersect(ss->dht->ent_tab[k], &i_tab[i])) {
-                                de_tab[num_nodes++] = ss->dht->ent_tab[k];
-                                break;
-                        }
-                }
-        }
+        num_nodes = ssd_hash_seg(ss, ss->dht->seg_tab, ss->dht->num_seg, 
+                                 bb, de_tab);
 
         /* Cache the results for later use. */
-        sh_add(bb, de_tab, num_nodes);
+        sh_add(ss, bb, -1, de_tab, num_nodes);
 
-        free(i_tab);
         return num_nodes;
 }
 
+/*
+  Rank of the DHT entry that owns leaf 'leaf' of the bisection tree.
+  Each entry owns a run of consecutive leaves, i.e., a compact part of
+  the domain, so neighboring regions map to few servers.
+*/
+static inline int kd_leaf_rank(const struct sspace *ssd, int leaf)
+{
+        return (int) ((uint64_t) leaf * ssd->dht->num_entries / 
+                      ssd->total_num_bbox);
+}
+
 struct sspace *ssd_alloc_v2(const struct bbox *bb_domain, int num_nodes, int max_versions)
 {
         struct sspace *ssd = NULL;
+        struct dht_entry *de;
         int err = -ENOMEM;
-        int i, j, k;
-        int dim;
+        int i, k, n;
+        int dim = 0;
         int nbits_max_dim = 0;
         uint64_t max_dim = 0;
+        uint64_t max_dim_size;
         get_bbox_max_dim(bb_domain, &max_dim, &dim);
         max_dim = next_pow_2_v2(max_dim);
         nbits_max_dim = compute_bits_v2(max_dim);
 
-        // decompose the global bbox       
-        int num_divide_iteration = compute_bits_v2(next_pow_2_v2(num_nodes));
-        struct bbox *bb, *b1, *b2;
-        struct queue q1, q2;
-        queue_init(&q1);
-        queue_init(&q2);
-
-        bb = malloc(sizeof(struct bbox));
-        memcpy(bb, bb_domain, sizeof(struct bbox));
-        queue_enqueue(&q1, bb);
-        for (i = 0; i < num_divide_iteration; i++) {
-            struct queue *src_q, *dst_q;
-            if (!queue_is_empty(&q1) && queue_is_empty(&q2)) {
-                src_q = &q1;
-                dst_q = &q2;
-            } else if (!queue_is_empty(&q2) && queue_is_empty(&q1)) {
-                src_q = &q2;
-                dst_q = &q1;
-            } else {
-                printf("%s(): error, both q1 and q2 is (non)empty.\n", __func__);
-            }
-            while (!queue_is_empty(src_q)) {
-                uint64_t max_dim_size;
-                struct bbox b_tab[2];
-
-                bb = queue_dequeue(src_q);
-                get_bbox_max_dim_size(bb, &max_dim_size, &dim);
-                bbox_divide_in2_ondim(bb, b_tab, dim);
-                free(bb); bb = NULL;
-                b1 = malloc(sizeof(struct bbox));
-                b2 = malloc(sizeof(struct bbox));
-                *b1 = b_tab[0];
-                *b2 = b_tab[1];
-                queue_enqueue(dst_q, b1);
-                queue_enqueue(dst_q, b2);
-            }
-        }
-
-        struct queue *q;
-        if (!queue_is_empty(&q1)) q = &q1;
-        else if (!queue_is_empty(&q2)) q = &q2;
-
         ssd = malloc(sizeof(*ssd));
         if (!ssd)
                 goto err_out;
@@ -646,9 +833,24 @@ struct sspace *ssd_alloc_v2(const struct bbox *bb_domain, int num_nodes, int max
         ssd->max_dim = max_dim;
         ssd->bpd = nbits_max_dim;
 
-        ssd->total_num_bbox = queue_size(q);
+        // decompose the global bbox by recursive bisection of the
+        // longest dimension, keeping the tree for ssd_hash_v2()
+        ssd->total_num_bbox = next_pow_2_v2(num_nodes);
+        ssd->kd_tab = malloc(sizeof(struct bbox) * (2 * ssd->total_num_bbox - 1));
+        if (!ssd->kd_tab) {
+            free(ssd);
+            goto err_out;
+        }
+
+        ssd->kd_tab[0] = *bb_domain;
+        for (i = 0; i < ssd->total_num_bbox - 1; i++) {
+            get_bbox_max_dim_size(&ssd->kd_tab[i], &max_dim_size, &dim);
+            bbox_divide_in2_ondim(&ssd->kd_tab[i], &ssd->kd_tab[2*i+1], dim);
+        }
+
         ssd->dht = dht_alloc(ssd, bb_domain, num_nodes, max_versions);
         if (!ssd->dht) {
+            free(ssd->kd_tab);
             free(ssd);
             goto err_out;
         }
@@ -656,36 +858,17 @@ struct sspace *ssd_alloc_v2(const struct bbox *bb_domain, int num_nodes, int max
             ssd->dht->ent_tab[i]->rank = i;
         }
 
-        int n = ceil(ssd->total_num_bbox*1.0 / ssd->dht->num_entries);
+        n = ceil(ssd->total_num_bbox*1.0 / ssd->dht->num_entries);
         for (i = 0; i < ssd->dht->num_entries; i++) {
             ssd->dht->ent_tab[i]->size_bb_tab = n;
             ssd->dht->ent_tab[i]->bb_tab = malloc(sizeof(struct bbox)*n);
         }
-        //printf("%s(): ssd->total_num_bbox= %d ssd->dht->num_entries= %d"
-        //    " max_num_bbox_per_dht_entry= %d\n",
-        //    __func__, ssd->total_num_bbox, ssd->dht->num_entries, n);
-
-        // simple round-robing mapping of decomposed bbox to dht entries
-        i = 0;
-        while (! queue_is_empty(q)) {
-            bb = queue_dequeue(q);
-            j = i++ % ssd->dht->num_entries;
-            k = ssd->dht->ent_tab[j]->num_bbox++;
-            ssd->dht->ent_tab[j]->bb_tab[k] = *bb;
-            free(bb);
-        }
 
-/*
-        for (i = 0; i < ssd->dht->num_entries; i++) {
-            printf("dht entry %d size_bb_tab= %d num_bbox= %d\n", i,
-                ssd->dht->ent_tab[i]->size_bb_tab,
-                ssd->dht->ent_tab[i]->num_bbox);
-            for (j = 0; j < ssd->dht->ent_tab[i]->num_bbox; j++) {
-                bbox_print(&ssd->dht->ent_tab[i]->bb_tab[j]);
-            }        
-            printf("\n");
+        for (i = 0; i < ssd->total_num_bbox; i++) {
+            de = ssd->dht->ent_tab[kd_leaf_rank(ssd, i)];
+            k = de->num_bbox++;
+            de->bb_tab[k] = ssd->kd_tab[ssd->total_num_bbox - 1 + i];
         }
-*/
 
         ssd->hash_version = ssd_hash_version_v2;        
         return ssd;
@@ -697,34 +880,49 @@ struct sspace *ssd_alloc_v2(const struct bbox *bb_domain, int num_nodes, int max
 void ssd_free_v2(struct sspace *ssd)
 {
         dht_free_v2(ssd->dht);
+        sh_free(ssd);
+        free(ssd->kd_tab);
         free(ssd);
-        sh_free();
+}
+
+/*
+  Collect the entries of the leaves under tree node 'node' that
+  intersect 'bb'; leaves are visited left to right, so the entries come
+  in rank order.
+*/
+static void kd_search(struct sspace *ss, int node, const struct bbox *bb,
+                      struct dht_entry *de_tab[], int *num_nodes)
+{
+        struct dht_entry *de;
+
+        if (!bbox_does_intersect(bb, &ss->kd_tab[node]))
+                return;
+
+        if (node < ss->total_num_bbox - 1) {
+                kd_search(ss, 2*node+1, bb, de_tab, num_nodes);
+                kd_search(ss, 2*node+2, bb, de_tab, num_nodes);
+                return;
+        }
+
+        de = ss->dht->ent_tab[kd_leaf_rank(ss, node - (ss->total_num_bbox - 1))];
+        if (*num_nodes == 0 || de_tab[*num_nodes-1] != de)
+                de_tab[(*num_nodes)++] = de;
 }
 
 int ssd_hash_v2(struct sspace *ss, const struct bbox *bb, struct dht_entry *de_tab[])
 {
-        int i, j, num_nodes;
+        int num_nodes;
 
-        num_nodes = sh_find(bb, de_tab);
+        num_nodes = sh_find(ss, bb, -1, de_tab);
         if (num_nodes > 0)
                 /* This is great, I hit the cache. */
                 return num_nodes;
 
         num_nodes = 0;
-        for (i = 0; i < ss->dht->num_entries; i++) {
-            for (j = 0; j < ss->dht->ent_tab[i]->num_bbox; j++) {
-                if (bbox_does_intersect(bb, &ss->dht->ent_tab[i]->bb_tab[j])) {
-                    //bbox_print(bb);
-                    //bbox_print(&ss->dht->ent_tab[i]->bb_tab[j]);
-                    //printf(" i= %d rank= %d\n", i, ss->dht->ent_tab[i]->rank);
-                    de_tab[num_nodes++] = ss->dht->ent_tab[i];
-                    break;
-                }
-            }
-        }
+        kd_search(ss, 0, bb, de_tab, &num_nodes);
 
         /* Cache the results for later use. */
-        sh_add(bb, de_tab, num_nodes);
+        sh_add(ss, bb, -1, de_tab, num_nodes);
 
         return num_nodes;
 }
@@ -737,6 +935,8 @@ int ssd_hash_v2(struct sspace *ss, const struct bbox *bb, struct dht_entry *de_t
  ssd hashing function v1: uses Hilbert SFC to linearize the global data domain
     and bounding box passed by put()/get().
  ssd hashing function v2: NOT use Hilbert SFC for linearization.
+ ssd hashing function v3: same as v1 with the Z-order SFC, which is
+    cheaper to compute and has somewhat worse locality.
 */
 
 /*
@@ -763,7 +963,8 @@ struct sspace *ssd_alloc(const struct bbox *bb_domain, int num_nodes, int max_ve
 
     switch (hash_version) {
     case ssd_hash_version_v1:
-        ss = ssd_alloc_v1(bb_domain, num_nodes, max_versions);
+    case ssd_hash_version_v3:
+        ss = ssd_alloc_v1(bb_domain, num_nodes, max_versions, hash_version);
         break;
     case ssd_hash_version_v2:
         ss = ssd_alloc_v2(bb_domain, num_nodes, max_versions);
@@ -786,6 +987,7 @@ void ssd_free(struct sspace *ss)
 {
     switch (ss->hash_version) {
     case ssd_hash_version_v1:
+    case ssd_hash_version_v3:
         ssd_free_v1(ss);
         break;
     case ssd_hash_version_v2:
@@ -798,105 +1000,592 @@ void ssd_free(struct sspace *ss)
     }
 }
 
-/*
-  Hash a bounding box 'bb' to the hash entries in dht; fill in the
-  entries in the de_tab and return the number of entries.
-*/
-int ssd_hash(struct sspace *ss, const struct bbox *bb, struct dht_entry *de_tab[])
+/* Number of cells of the domain in each bucket of the load table. */
+static uint64_t ssd_split_bucket_size(const struct sspace *ss)
 {
-#ifdef TIMING_SSD
-    struct timer tm;
-    double tm_st, tm_end;
-    timer_init(&tm, 1);
-    timer_start(&tm);
-    tm_st = timer_read(&tm);
-#endif
+        return ss->dom_size / SSD_SPLIT_BUCKETS + 
+                (ss->dom_size % SSD_SPLIT_BUCKETS != 0);
+}
 
-    int ret;
+/* Index in 'split_tab' of the split of 'epoch', or -1. */
+static int ssd_split_search(const struct sspace *ss, int epoch)
+{
+        int lo = 0, hi = ss->num_split, mid;
 
-    switch (ss->hash_version) {
-    case ssd_hash_version_v1:
-        ret = ssd_hash_v1(ss, bb, de_tab);
-        break;
-    case ssd_hash_version_v2:
-        ret = ssd_hash_v2(ss, bb, de_tab);
-        break;
-    default:
-        uloga("%s(): ERROR unknown shared space hash version %u\n",
-            __func__, ss->hash_version);
-        ret = 0;
-        break;
-    }
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (ss->split_tab[mid].epoch < epoch)
+                        lo = mid + 1;
+                else    hi = mid;
+        }
 
-#ifdef TIMING_SSD
-    tm_end = timer_read(&tm);
-    uloga("%s(): hash_version v%u time %lf seconds\n", __func__, ss->hash_version, tm_end-tm_st);
-#endif
-    return ret;
+        if (lo < ss->num_split && ss->split_tab[lo].epoch == epoch)
+                return lo;
+        return -1;
 }
 
 /*
-  Initialize the dht structure.
+  Cut the domain so that each DHT entry gets an equal share of the
+  weight of split 'sp', the weight of a bucket being spread evenly over
+  its cells, and build the interval table of the split. Integer
+  arithmetic only, so that servers and clients cut at the same cells.
 */
-int ssd_init(struct sspace *ssd, int rank)
-{
-    ssd->rank = rank;
-    ssd->ent_self = ssd->dht->ent_tab[rank];
+static int ssd_split_build(struct sspace *ss, struct ssd_split *sp)
+{
+        const int n = ss->dht->num_entries;
+        const uint64_t bs = ssd_split_bucket_size(ss);
+        const int f_strict = (ss->dom_size >= (uint64_t) n);
+        uint64_t *pos, w_sum = 0, w_cum = 0, t, den, start, cells, len, off, take;
+        int nb, b, r, k, i, first;
+
+        pos = malloc(sizeof(*pos) * (n + 1));
+        sp->seg_tab = malloc(sizeof(*sp->seg_tab) * (ss->num_dom + n));
+        if (!pos || !sp->seg_tab) {
+                free(pos);
+                free(sp->seg_tab);
+                sp->seg_tab = NULL;
+                return -ENOMEM;
+        }
 
-    return 0;
+        for (nb = 0; nb < SSD_SPLIT_BUCKETS && nb * bs < ss->dom_size; nb++) {
+                if (sp->w_tab[nb] == 0)
+                        sp->w_tab[nb] = 1;
+                w_sum += sp->w_tab[nb];
+        }
+
+        /* Weights are scaled by 'n' to cut inside the buckets. */
+        pos[0] = 0;
+        pos[n] = ss->dom_size;
+        for (r = 1, b = 0; r < n; r++) {
+                t = w_sum * r;
+                while (b < nb - 1 && (w_cum + sp->w_tab[b]) * n < t)
+                        w_cum += sp->w_tab[b++];
+
+                t = t - w_cum * n;
+                den = (uint64_t) sp->w_tab[b] * n;
+                start = b * bs;
+                cells = (ss->dom_size - start < bs) ? ss->dom_size - start : bs;
+                pos[r] = start + (cells / den) * t + (cells % den) * t / den;
+
+                if (pos[r] < pos[r-1] + f_strict)
+                        pos[r] = pos[r-1] + f_strict;
+                if (f_strict && pos[r] > ss->dom_size - (n - r))
+                        pos[r] = ss->dom_size - (n - r);
+        }
+
+        /* Map the cells of each entry back to SFC intervals. */
+        sp->num_seg = 0;
+        for (r = 0, k = 0, off = 0; r < n; r++) {
+                first = sp->num_seg;
+                for (len = pos[r+1] - pos[r]; len > 0; len -= take) {
+                        take = intv_size(&ss->dom_tab[k]) - off;
+                        if (take > len)
+                                take = len;
+                        sp->seg_tab[sp->num_seg].intv.lb = ss->dom_tab[k].lb + off;
+                        sp->seg_tab[sp->num_seg].intv.ub = ss->dom_tab[k].lb + off + take - 1;
+                        sp->seg_tab[sp->num_seg].rank = r;
+                        sp->num_seg++;
+
+                        off += take;
+                        if (off == intv_size(&ss->dom_tab[k])) {
+                                k++;
+                                off = 0;
+                        }
+                }
+                for (i = first; i < sp->num_seg; i++)
+                        sp->seg_tab[i].next = sp->num_seg;
+        }
+
+        free(pos);
+        return 0;
 }
 
-/*
-*/
-int ssd_copy(struct obj_data *to_obj, struct obj_data *from_obj)
+/* Drop the cached hash results of 'epoch'. */
+static void sh_del_epoch(struct sspace *ss, int epoch)
 {
-        struct matrix_desc to_mat, from_mat;
-        struct bbox bbcom;
+        struct sfc_hash_tab *sht = &ss->sh_tab;
+        struct sfc_hash_cache *l, *t;
 
-        bbox_intersect(&to_obj->obj_desc.bb, &from_obj->obj_desc.bb, &bbcom);
+        if (!sht->sh_hash)
+                return;
 
-        matrix_init(&from_mat, from_obj->obj_desc.st,
-                    &from_obj->obj_desc.bb, &bbcom, 
-                    from_obj->obj_desc.size);
+        list_for_each_entry_safe(l, t, &sht->sh_lru, struct sfc_hash_cache, sh_lru_entry)
+                if (l->sh_epoch == epoch)
+                        sh_del(sht, l);
+}
 
-        matrix_init(&to_mat, to_obj->obj_desc.st, 
-                    &to_obj->obj_desc.bb, &bbcom,
-                    to_obj->obj_desc.size);
+/* Add 'len' cells from position 'p' to the load table. */
+static void ssd_split_add_run(struct sspace *ss, uint64_t p, uint64_t len, size_t size_elem)
+{
+        const uint64_t bs = ssd_split_bucket_size(ss);
+        uint64_t b = p / bs, cells;
 
-        matrix_copy(&to_mat, to_obj->data, &from_mat, from_obj->data);
-        return 0;
+        for (; len > 0 && b < SSD_SPLIT_BUCKETS; b++) {
+                cells = (b + 1) * bs - p;
+                if (cells > len)
+                        cells = len;
+                ss->load_tab[b] += cells * size_elem;
+                p += cells;
+                len -= cells;
+        }
 }
 
 /*
+  Enable load-aware splits of the index space for 'ss', with epochs of
+  'period' versions. Every epoch is placed by the split set for it with
+  ssd_split_set(), so all the users of the space must agree on them.
+  The node that decides the splits sets 'f_keep' so that it never
+  forgets one; the others drop old epochs and ask for them again.
 */
-int ssd_copy_list(struct obj_data *to, struct list_head *od_list)
+int ssd_split_init(struct sspace *ss, int period, int f_keep)
 {
-        struct obj_data *from;
-        struct matrix_desc to_mat, from_mat;
-        struct bbox bbcom;
-
-        list_for_each_entry(from, od_list, struct obj_data, obj_entry) {
-
-                bbox_intersect(&to->obj_desc.bb, &from->obj_desc.bb, &bbcom);
+        int i, err = -EINVAL;
 
-                matrix_init(&from_mat, from->obj_desc.st,
-                            &from->obj_desc.bb, &bbcom, 
-                            from->obj_desc.size);
+        if (period <= 0 || (ss->hash_version != ssd_hash_version_v1 &&
+                            ss->hash_version != ssd_hash_version_v3))
+                goto err_out;
 
-                matrix_init(&to_mat, to->obj_desc.st, 
-                            &to->obj_desc.bb, &bbcom, 
-                            to->obj_desc.size);
+        err = -ENOMEM;
+        bbox_to_intv_sfc(&ss->dht->bb_glb_domain, ss->max_dim, 
+                         ssd_get_curve(ss), &ss->dom_tab, &ss->num_dom);
+        ss->dom_pos = malloc(sizeof(*ss->dom_pos) * (ss->num_dom + 1));
+        ss->split_tab = malloc(sizeof(*ss->split_tab) * SSD_SPLIT_MAX);
+        if (!ss->num_dom || !ss->dom_pos || !ss->split_tab) {
+                ssd_split_free(ss);
+                ss->dom_tab = NULL;
+                ss->dom_pos = NULL;
+                ss->split_tab = NULL;
+                goto err_out;
+        }
 
-                matrix_copy(&to_mat, to->data, &from_mat, from->data);
+        ss->dom_size = 0;
+        for (i = 0; i < ss->num_dom; i++) {
+                ss->dom_pos[i] = ss->dom_size;
+                ss->dom_size += intv_size(&ss->dom_tab[i]);
         }
+        ss->num_split = 0;
+        ss->max_split = SSD_SPLIT_MAX;
+        ss->split_keep = f_keep;
+        ss->split_period = period;
+        memset(ss->load_tab, 0, sizeof(ss->load_tab));
 
         return 0;
+ err_out:
+        uloga("'%s()': failed with %d.\n", __func__, err);
+        return err;
 }
 
-int ssd_copy_list_shmem(struct obj_data *to, struct list_head *od_list, int nums)
+/* Epoch of 'version'. */
+int ssd_split_epoch(const struct sspace *ss, unsigned int version)
 {
-    struct obj_data *from;
-    struct matrix_desc to_mat, from_mat;
+        return (int) (version / ss->split_period);
+}
+
+/*
+  Return 1 if the split of 'epoch' is set, or if 'ss' does not use
+  load-aware splits.
+*/
+int ssd_split_find(const struct sspace *ss, int epoch)
+{
+        return !ss->split_period || ssd_split_search(ss, epoch) >= 0;
+}
+
+/* Copy the bucket weights of the split of 'epoch' to 'w_tab'. */
+int ssd_split_get(const struct sspace *ss, int epoch, uint16_t *w_tab)
+{
+        int i = ssd_split_search(ss, epoch);
+
+        if (i < 0)
+                return -ENOENT;
+        memcpy(w_tab, ss->split_tab[i].w_tab, sizeof(ss->split_tab[i].w_tab));
+        return 0;
+}
+
+/*
+  Set the split of 'epoch' from the bucket weights 'w_tab'; the first
+  split set for an epoch is kept. When the table is full, it grows if
+  the space keeps its splits, else the oldest epoch is dropped.
+*/
+int ssd_split_set(struct sspace *ss, int epoch, const uint16_t *w_tab)
+{
+        struct ssd_split sp, *tab;
+        int i, err;
+
+        if (!ss->split_period || ssd_split_search(ss, epoch) >= 0)
+                return 0;
+
+        sp.epoch = epoch;
+        memcpy(sp.w_tab, w_tab, sizeof(sp.w_tab));
+        err = ssd_split_build(ss, &sp);
+        if (err < 0) {
+                uloga("'%s()': failed with %d.\n", __func__, err);
+                return err;
+        }
+
+        if (ss->num_split == ss->max_split && ss->split_keep) {
+                tab = realloc(ss->split_tab, 
+                              sizeof(*tab) * ss->max_split * 2);
+                if (!tab) {
+                        free(sp.seg_tab);
+                        uloga("'%s()': failed with %d.\n", __func__, -ENOMEM);
+                        return -ENOMEM;
+                }
+                ss->split_tab = tab;
+                ss->max_split = ss->max_split * 2;
+        }
+        if (ss->num_split == ss->max_split) {
+                sh_del_epoch(ss, ss->split_tab[0].epoch);
+                free(ss->split_tab[0].seg_tab);
+                memmove(&ss->split_tab[0], &ss->split_tab[1], 
+                        sizeof(sp) * --ss->num_split);
+        }
+
+        for (i = ss->num_split; i > 0 && ss->split_tab[i-1].epoch > epoch; i--)
+                ss->split_tab[i] = ss->split_tab[i-1];
+        ss->split_tab[i] = sp;
+        ss->num_split++;
+
+        return 0;
+}
+
+/*
+  Account a put of 'bb' with elements of 'size_elem' bytes in the load
+  table.
+*/
+void ssd_split_add_load(struct sspace *ss, const struct bbox *bb, size_t size_elem)
+{
+        struct intv i_tab[SSD_HASH_MAX_INTV];
+        struct coord c_tab[2 * SSD_HASH_MAX_INTV];
+        uint64_t lb, ub;
+        int i, k, n, lo, hi;
+
+        if (!ss->split_period)
+                return;
+
+        n = bbox_to_intv_cap(bb, ss->max_dim, ssd_get_curve(ss), 
+                             i_tab, SSD_HASH_MAX_INTV, c_tab);
+        for (i = 0; i < n; i++) {
+                /* First domain interval that ends at or after the box
+                   interval. */
+                for (lo = 0, hi = ss->num_dom; lo < hi; ) {
+                        k = lo + (hi - lo) / 2;
+                        if (ss->dom_tab[k].ub < i_tab[i].lb)
+                                lo = k + 1;
+                        else    hi = k;
+                }
+
+                for (k = lo; k < ss->num_dom && ss->dom_tab[k].lb <= i_tab[i].ub; k++) {
+                        lb = max(i_tab[i].lb, ss->dom_tab[k].lb);
+                        ub = min(i_tab[i].ub, ss->dom_tab[k].ub);
+                        ssd_split_add_run(ss, ss->dom_pos[k] + lb - ss->dom_tab[k].lb,
+                                          ub - lb + 1, size_elem);
+                }
+        }
+}
+
+/*
+  Move the load table to 'w_tab' for a report to another node: bucket
+  'b' holds 'w_tab[b] << shift' bytes. Returns the shift.
+*/
+int ssd_split_take_load(struct sspace *ss, uint16_t *w_tab)
+{
+        uint64_t max_load = 0;
+        int b, shift = 0;
+
+        for (b = 0; b < SSD_SPLIT_BUCKETS; b++)
+                if (ss->load_tab[b] > max_load)
+                        max_load = ss->load_tab[b];
+        while ((max_load >> shift) > 0xffff)
+                shift++;
+
+        for (b = 0; b < SSD_SPLIT_BUCKETS; b++) {
+                w_tab[b] = ss->load_tab[b] >> shift;
+                if (w_tab[b] == 0 && ss->load_tab[b] > 0)
+                        w_tab[b] = 1;
+                ss->load_tab[b] = 0;
+        }
+
+        return shift;
+}
+
+/* Add a load report from ssd_split_take_load() to the load table. */
+void ssd_split_merge_load(struct sspace *ss, const uint16_t *w_tab, int shift)
+{
+        int b;
+
+        if (shift < 0 || shift > 48)
+                return;
+        for (b = 0; b < SSD_SPLIT_BUCKETS; b++)
+                ss->load_tab[b] += (uint64_t) w_tab[b] << shift;
+}
+
+/*
+  Compute the bucket weights of a new split from the load table, and
+  halve the load so that older epochs count less in the next one.
+*/
+void ssd_split_decide(struct sspace *ss, uint16_t *w_tab)
+{
+        uint64_t max_load = 0;
+        int b;
+
+        for (b = 0; b < SSD_SPLIT_BUCKETS; b++)
+                if (ss->load_tab[b] > max_load)
+                        max_load = ss->load_tab[b];
+
+        for (b = 0; b < SSD_SPLIT_BUCKETS; b++) {
+                w_tab[b] = 1;
+                if (max_load > 0)
+                        w_tab[b] += (uint16_t) ((double) ss->load_tab[b] / 
+                                                max_load * 65534);
+                ss->load_tab[b] = ss->load_tab[b] >> 1;
+        }
+}
+
+/*
+  Same as ssd_hash(), for an object of version 'version': with
+  load-aware splits, the entries come from the split of its epoch,
+  which must be set; returns -ENOENT if it is not.
+*/
+int ssd_hash_ver(struct sspace *ss, const struct bbox *bb, unsigned int version,
+                 struct dht_entry *de_tab[])
+{
+        struct ssd_split *sp;
+        int epoch, i, num_nodes;
+
+        if (!ss->split_period)
+                return ssd_hash(ss, bb, de_tab);
+
+        epoch = ssd_split_epoch(ss, version);
+        i = ssd_split_search(ss, epoch);
+        if (i < 0) {
+                uloga("'%s()': no split for epoch %d.\n", __func__, epoch);
+                return -ENOENT;
+        }
+        sp = &ss->split_tab[i];
+
+        num_nodes = sh_find(ss, bb, epoch, de_tab);
+        if (num_nodes > 0)
+                return num_nodes;
+
+        num_nodes = ssd_hash_seg(ss, sp->seg_tab, sp->num_seg, bb, de_tab);
+        sh_add(ss, bb, epoch, de_tab, num_nodes);
+
+        return num_nodes;
+}
+
+/* The intervals of one DHT entry, for ssd_seg_match(). */
+struct ssd_seg_range {
+        const struct dht_seg    *seg_tab;
+        int                     num_seg;
+};
+
+static int ssd_seg_match(const struct intv *itv, void *arg)
+{
+        const struct ssd_seg_range *sr = arg;
+        int k = dht_seg_search(sr->seg_tab, sr->num_seg, itv->lb);
+
+        return k < sr->num_seg && sr->seg_tab[k].intv.lb <= itv->ub;
+}
+
+/*
+  Return 1 if this node ('ss->ent_self') indexes a cell of 'bb' for
+  objects of version 'version', 0 if not, or -ENOENT if the split of
+  its epoch is not set. Unlike ssd_hash_ver(), which may return extra
+  entries for a large box, the test is exact.
+*/
+int ssd_hash_self(struct sspace *ss, const struct bbox *bb, unsigned int version)
+{
+        const struct dht_seg *seg_tab = ss->dht->seg_tab;
+        struct ssd_seg_range sr;
+        int num_seg = ss->dht->num_seg, rank = ss->ent_self->rank, i, k;
+
+        if (ss->hash_version == ssd_hash_version_v2)
+                return 1;
+
+        if (ss->split_period) {
+                i = ssd_split_search(ss, ssd_split_epoch(ss, version));
+                if (i < 0)
+                        return -ENOENT;
+                seg_tab = ss->split_tab[i].seg_tab;
+                num_seg = ss->split_tab[i].num_seg;
+        }
+
+        /* The intervals of an entry are consecutive in 'seg_tab'. */
+        for (k = 0; k < num_seg && seg_tab[k].rank != rank; k = seg_tab[k].next)
+                ;
+        if (k == num_seg)
+                return 0;
+        sr.seg_tab = &seg_tab[k];
+        sr.num_seg = seg_tab[k].next - k;
+
+        return bbox_intv_match(bb, ss->max_dim, ssd_get_curve(ss), 
+                               ssd_seg_match, &sr);
+}
+
+/*
+  Hash a bounding box 'bb' to the hash entries in dht; fill in the
+  entries in the de_tab and return the number of entries.
+*/
+int ssd_hash(struct sspace *ss, const struct bbox *bb, struct dht_entry *de_tab[])
+{
+#ifdef TIMING_SSD
+    struct timer tm;
+    double tm_st, tm_end;
+    timer_init(&tm, 1);
+    timer_start(&tm);
+    tm_st = timer_read(&tm);
+#endif
+
+    int ret;
+
+    switch (ss->hash_version) {
+    case ssd_hash_version_v1:
+    case ssd_hash_version_v3:
+        ret = ssd_hash_v1(ss, bb, de_tab);
+        break;
+    case ssd_hash_version_v2:
+        ret = ssd_hash_v2(ss, bb, de_tab);
+        break;
+    default:
+        uloga("%s(): ERROR unknown shared space hash version %u\n",
+            __func__, ss->hash_version);
+        ret = 0;
+        break;
+    }
+
+#ifdef TIMING_SSD
+    tm_end = timer_read(&tm);
+    uloga("%s(): hash_version v%u time %lf seconds\n", __func__, ss->hash_version, tm_end-tm_st);
+#endif
+    return ret;
+}
+
+/*
+  Initialize the dht structure.
+*/
+int ssd_init(struct sspace *ssd, int rank)
+{
+    ssd->rank = rank;
+    ssd->ent_self = ssd->dht->ent_tab[rank];
+
+    return 0;
+}
+
+/*
+*/
+int ssd_copy(struct obj_data *to_obj, struct obj_data *from_obj)
+{
+        struct matrix_desc to_mat, from_mat;
+        struct bbox bbcom;
+
+        bbox_intersect(&to_obj->obj_desc.bb, &from_obj->obj_desc.bb, &bbcom);
+
+        matrix_init(&from_mat, from_obj->obj_desc.st,
+                    &from_obj->obj_desc.bb, &bbcom, 
+                    from_obj->obj_desc.size);
+
+        matrix_init(&to_mat, to_obj->obj_desc.st, 
+                    &to_obj->obj_desc.bb, &bbcom,
+                    to_obj->obj_desc.size);
+
+        matrix_copy(&to_mat, to_obj->data, &from_mat, from_obj->data);
+        return 0;
+}
+
+/*
+  Describe the region 'odsc' of object 'from' as the contiguous runs of
+  'from->data' that hold it, so that it can be sent without a copy. Run
+  i is stored in (*iov_tab)[i]. Return the number of runs, or 0 if the
+  region is not fully in 'from', or it needs more than 'max_iov' runs,
+  or shorter runs than 'min_run' bytes.
+*/
+int ssd_data_iov(struct obj_data *from, const struct obj_descriptor *odsc,
+                 size_t min_run, int max_iov, iovec_t **iov_tab)
+{
+        struct bbox *bb_from = &from->obj_desc.bb;
+        const struct bbox *bb = &odsc->bb;
+        uint64_t cnt[BBOX_MAX_NDIM], stride[BBOX_MAX_NDIM];
+        uint64_t idx[BBOX_MAX_NDIM];
+        uint64_t s, run, num_run = 1;
+        char *data = from->data;
+        iovec_t *iov;
+        int d, k, i;
+
+        if (odsc->size != from->obj_desc.size ||
+            bb->num_dims != bb_from->num_dims || !bbox_include(bb_from, bb))
+                return 0;
+
+        memset(cnt, 0, sizeof(cnt));
+        s = odsc->size;
+        for (d = 0; d < bb->num_dims; d++) {
+                data += (bb->lb.c[d] - bb_from->lb.c[d]) * s;
+                cnt[d] = bb->ub.c[d] - bb->lb.c[d] + 1;
+                stride[d] = s;
+                s *= bbox_dist(bb_from, d);
+        }
+
+        /* Leading dimensions covered in full extend the run. */
+        run = cnt[0] * odsc->size;
+        for (d = 1; d < bb->num_dims && run == stride[d]; d++)
+                run *= cnt[d];
+
+        for (k = d; k < bb->num_dims && num_run <= max_iov; k++)
+                num_run *= cnt[k];
+        if (num_run > max_iov || (num_run > 1 && run < min_run))
+                return 0;
+
+        iov = malloc(sizeof(*iov) * num_run);
+        if (!iov)
+                return -ENOMEM;
+
+        memset(idx, 0, sizeof(idx));
+        for (i = 0; i < num_run; i++) {
+                iov[i].iov_base = data;
+                iov[i].iov_len = run;
+
+                for (k = d; k < bb->num_dims; k++) {
+                        data += stride[k];
+                        if (++idx[k] < cnt[k])
+                                break;
+                        data -= stride[k] * cnt[k];
+                        idx[k] = 0;
+                }
+        }
+
+        *iov_tab = iov;
+        return num_run;
+}
+
+/*
+*/
+int ssd_copy_list(struct obj_data *to, struct list_head *od_list)
+{
+        struct obj_data *from;
+        struct matrix_desc to_mat, from_mat;
+        struct bbox bbcom;
+
+        list_for_each_entry(from, od_list, struct obj_data, obj_entry) {
+
+                bbox_intersect(&to->obj_desc.bb, &from->obj_desc.bb, &bbcom);
+
+                matrix_init(&from_mat, from->obj_desc.st,
+                            &from->obj_desc.bb, &bbcom, 
+                            from->obj_desc.size);
+
+                matrix_init(&to_mat, to->obj_desc.st, 
+                            &to->obj_desc.bb, &bbcom, 
+                            to->obj_desc.size);
+
+                matrix_copy(&to_mat, to->data, &from_mat, from->data);
+        }
+
+        return 0;
+}
+
+int ssd_copy_list_shmem(struct obj_data *to, struct list_head *od_list, int nums)
+{
+    struct obj_data *from;
+    struct matrix_desc to_mat, from_mat;
     struct bbox bbcom;
     int i = 0;
 
@@ -908,48 +1597,415 @@ int ssd_copy_list_shmem(struct obj_data *to, struct list_head *od_list, int nums
                         &from->obj_desc.bb, &bbcom, 
                         from->obj_desc.size);
 
-            matrix_init(&to_mat, to->obj_desc.st, 
-                        &to->obj_desc.bb, &bbcom, 
-                        to->obj_desc.size);
+            matrix_init(&to_mat, to->obj_desc.st, 
+                        &to->obj_desc.bb, &bbcom, 
+                        to->obj_desc.size);
+
+            matrix_copy(&to_mat, to->data, &from_mat, from->data);
+        }
+        i++;
+    }
+
+    return 0;
+}
+
+int ssd_filter(struct obj_data *from, struct obj_descriptor *odsc, double *dval)
+{
+        //TODO: search the matrix to find the min
+        static int n = 1;
+
+        *dval = 2.0 * n;
+        n++;
+
+        return 0;
+}
+
+/*
+  Spatial index of objects; see 'struct sp_index'.
+*/
+#define SPI_HASH_SIZE_MIN       16
+
+static inline const struct bbox *
+spi_bbox(const struct sp_index *spi, struct list_head *e)
+{
+        return (const struct bbox *) ((char *) e + spi->bb_off);
+}
+
+static struct list_head *
+spi_bin(const struct sp_index *spi, const struct coord *c)
+{
+        uint64_t h = 14695981039346656037ULL;
+        int i;
+
+        for (i = 0; i < spi->ndim; i++)
+                h = (h ^ c->c[i]) * 1099511628211ULL;
+        h ^= h >> 32;
+
+        return &spi->obj_hash[h & (spi->size_hash - 1)];
+}
+
+static void spi_cell(const struct sp_index *spi, const struct bbox *bb, 
+                     struct coord *c)
+{
+        int i;
+
+        for (i = 0; i < spi->ndim; i++)
+                c->c[i] = bb->lb.c[i] / spi->cell.c[i];
+}
+
+static int spi_in_cell(const struct sp_index *spi, const struct bbox *bb,
+                       const struct coord *c)
+{
+        int i;
+
+        for (i = 0; i < spi->ndim; i++)
+                if (bb->lb.c[i] / spi->cell.c[i] != c->c[i])
+                        return 0;
+        return 1;
+}
+
+/*
+  Double the number of bins; on allocation failure keep the old ones.
+*/
+static void spi_grow(struct sp_index *spi)
+{
+        struct list_head *old_hash = spi->obj_hash;
+        struct list_head *e, *t;
+        struct coord c;
+        int i, old_size = spi->size_hash;
+
+        spi->obj_hash = malloc(sizeof(struct list_head) * old_size * 2);
+        if (!spi->obj_hash) {
+                spi->obj_hash = old_hash;
+                return;
+        }
+        spi->size_hash = old_size * 2;
+        for (i = 0; i < spi->size_hash; i++)
+                INIT_LIST_HEAD(&spi->obj_hash[i]);
+
+        for (i = 0; i < old_size; i++) {
+                list_for_each_safe(e, t, &old_hash[i]) {
+                        spi_cell(spi, spi_bbox(spi, e), &c);
+                        list_add_tail(e, spi_bin(spi, &c));
+                }
+        }
+        free(old_hash);
+}
+
+int spi_init(struct sp_index *spi, long bb_off)
+{
+        int i;
+
+        memset(spi, 0, sizeof(*spi));
+        spi->obj_hash = malloc(sizeof(struct list_head) * SPI_HASH_SIZE_MIN);
+        if (!spi->obj_hash)
+                return -ENOMEM;
+
+        for (i = 0; i < SPI_HASH_SIZE_MIN; i++)
+                INIT_LIST_HEAD(&spi->obj_hash[i]);
+        spi->size_hash = SPI_HASH_SIZE_MIN;
+        spi->bb_off = bb_off;
+
+        return 0;
+}
+
+/*
+  Release the bins; the objects should be removed by the caller.
+*/
+void spi_free(struct sp_index *spi)
+{
+        free(spi->obj_hash);
+        spi->obj_hash = 0;
+        spi->size_hash = 0;
+}
+
+void spi_add(struct sp_index *spi, struct list_head *e)
+{
+        const struct bbox *bb = spi_bbox(spi, e);
+        struct coord c;
+        uint64_t n;
+        int i;
+
+        if (spi->num_obj == 0) {
+                spi->ndim = bb->num_dims;
+                for (i = 0; i < spi->ndim; i++)
+                        spi->cell.c[i] = bb->ub.c[i] - bb->lb.c[i] + 1;
+                spi->ext = spi->cell;
+        }
+        for (i = 0; i < spi->ndim; i++) {
+                n = bb->ub.c[i] - bb->lb.c[i] + 1;
+                if (n > spi->ext.c[i])
+                        spi->ext.c[i] = n;
+        }
+
+        if (spi->num_obj >= 2 * spi->size_hash)
+                spi_grow(spi);
+
+        /* NOTE: new object comes first in its bin. */
+        spi_cell(spi, bb, &c);
+        list_add(e, spi_bin(spi, &c));
+        spi->num_obj++;
+}
+
+void spi_del(struct sp_index *spi, struct list_head *e)
+{
+        list_del(e);
+        spi->num_obj--;
+}
+
+/*
+  Call 'fn' on every object that intersects 'q', until it returns non
+  zero. Only the bins of the grid cells  that may hold an intersecting
+  object are visited, unless these are more than the objects.
+*/
+int spi_search(struct sp_index *spi, const struct bbox *q,
+               int (*fn)(struct list_head *, void *), void *arg)
+{
+        struct coord lo, hi, c;
+        struct list_head *e, *t;
+        uint64_t num_cells = 1;
+        int i, err;
+
+        if (spi->num_obj == 0)
+                return 0;
+
+        if (q->num_dims != spi->ndim)
+                goto scan_all;
+
+        for (i = 0; i < spi->ndim; i++) {
+                if (q->lb.c[i] + 1 > spi->ext.c[i])
+                        lo.c[i] = (q->lb.c[i] + 1 - spi->ext.c[i]) / spi->cell.c[i];
+                else    lo.c[i] = 0;
+                hi.c[i] = q->ub.c[i] / spi->cell.c[i];
+                if (hi.c[i] < lo.c[i])
+                        return 0;
+
+                num_cells *= hi.c[i] - lo.c[i] + 1;
+                if (num_cells > spi->num_obj)
+                        goto scan_all;
+        }
+
+        c = lo;
+        while (1) {
+                list_for_each_safe(e, t, spi_bin(spi, &c)) {
+                        if (!spi_in_cell(spi, spi_bbox(spi, e), &c) ||
+                            !bbox_does_intersect(q, spi_bbox(spi, e)))
+                                continue;
+                        err = fn(e, arg);
+                        if (err)
+                                return err;
+                }
+
+                for (i = 0; i < spi->ndim; i++) {
+                        if (c.c[i] < hi.c[i]) {
+                                c.c[i]++;
+                                break;
+                        }
+                        c.c[i] = lo.c[i];
+                }
+                if (i == spi->ndim)
+                        break;
+        }
+
+        return 0;
+
+ scan_all:
+        for (i = 0; i < spi->size_hash; i++) {
+                list_for_each_safe(e, t, &spi->obj_hash[i]) {
+                        if (!bbox_does_intersect(q, spi_bbox(spi, e)))
+                                continue;
+                        err = fn(e, arg);
+                        if (err)
+                                return err;
+                }
+        }
+
+        return 0;
+}
+
+/*
+  Table of variables; see 'struct sp_var_tab'.
+*/
+#define SPV_HASH_SIZE           64
+
+static unsigned int spv_name_hash(const char *name)
+{
+        unsigned int h = 2166136261u;
+
+        while (*name)
+                h = (h ^ (unsigned char) *name++) * 16777619u;
+
+        return h;
+}
+
+int spv_init(struct sp_var_tab *tab, int size_ver, long bb_off)
+{
+        int i;
+
+        memset(tab, 0, sizeof(*tab));
+        /* Keep the bins of all the versions of a name distinct. */
+        tab->size_hash = SPV_HASH_SIZE + size_ver;
+        tab->var_hash = malloc(sizeof(struct list_head) * tab->size_hash);
+        if (!tab->var_hash)
+                return -ENOMEM;
+
+        for (i = 0; i < tab->size_hash; i++)
+                INIT_LIST_HEAD(&tab->var_hash[i]);
+        tab->size_ver = size_ver;
+        tab->bb_off = bb_off;
+
+        return 0;
+}
+
+/*
+  Release the bins; the variables should be removed by the caller.
+*/
+void spv_free(struct sp_var_tab *tab)
+{
+        free(tab->var_hash);
+        tab->var_hash = 0;
+        tab->size_hash = 0;
+}
+
+/*
+  Bin of the versions of 'name' that are equal to 'version' modulo
+  'size_ver'.
+*/
+struct list_head *
+spv_bin(struct sp_var_tab *tab, const char *name, unsigned int version)
+{
+        unsigned int n;
+
+        n = spv_name_hash(name) + version % tab->size_ver;
+        return &tab->var_hash[n % tab->size_hash];
+}
+
+struct sp_var *
+spv_find(struct sp_var_tab *tab, const char *name, unsigned int version)
+{
+        struct sp_var *var;
+
+        list_for_each_entry(var, spv_bin(tab, name, version), 
+                            struct sp_var, var_entry) {
+                if (var->version == version && strcmp(var->name, name) == 0)
+                        return var;
+        }
+
+        return NULL;
+}
+
+/*
+  Find a variable, or add it if it is not in the table.
+*/
+struct sp_var *
+spv_get(struct sp_var_tab *tab, const char *name, unsigned int version)
+{
+        struct sp_var *var;
+
+        var = spv_find(tab, name, version);
+        if (var)
+                return var;
+
+        var = malloc(sizeof(*var));
+        if (!var)
+                return NULL;
+
+        if (spi_init(&var->spi, tab->bb_off) < 0) {
+                free(var);
+                return NULL;
+        }
+        strncpy(var->name, name, sizeof(var->name) - 1);
+        var->name[sizeof(var->name) - 1] = '\0';
+        var->version = version;
+
+        list_add(&var->var_entry, spv_bin(tab, name, version));
+        tab->num_var++;
+
+        return var;
+}
+
+void spv_del(struct sp_var_tab *tab, struct sp_var *var)
+{
+        list_del(&var->var_entry);
+        spi_free(&var->spi);
+        free(var);
+        tab->num_var--;
+}
+
+static int spv_match_first(struct list_head *e, void *arg)
+{
+        *(struct list_head **) arg = e;
+        return 1;
+}
+
+/*
+  Return any object of a variable.
+*/
+static struct list_head *spv_first(struct sp_var *var)
+{
+        int i;
 
-            matrix_copy(&to_mat, to->data, &from_mat, from->data);
+        for (i = 0; i < var->spi.size_hash; i++) {
+                if (!list_empty(&var->spi.obj_hash[i]))
+                        return var->spi.obj_hash[i].next;
         }
-        i++;
-    }
 
-    return 0;
+        return NULL;
 }
 
-int ssd_filter(struct obj_data *from, struct obj_descriptor *odsc, double *dval)
+/*
+  Return any object of a variable that intersects 'bb'.
+*/
+static struct list_head *spv_search(struct sp_var *var, const struct bbox *bb)
 {
-        //TODO: search the matrix to find the min
-        static int n = 1;
+        struct list_head *e = 0;
 
-        *dval = 2.0 * n;
-        n++;
+        spi_search(&var->spi, bb, spv_match_first, &e);
+        return e;
+}
 
-        return 0;
+static inline struct obj_data *ls_obj(struct list_head *e)
+{
+        return e ? list_entry(e, struct obj_data, obj_entry) : NULL;
 }
 
+/*
+  Resident objects of one version in the local storage, most recently
+  used first.
+*/
+struct ls_mem_ver {
+        struct list_head        ver_entry;
+        struct list_head        obj_list;
+        unsigned int            version;
+};
+
 /*
   Allocate and init the local storage structure.
 */
 struct ss_storage *ls_alloc(int max_versions)
 {
         struct ss_storage *ls = 0;
-        int i;
 
-        ls = malloc(sizeof(*ls) + sizeof(struct list_head) * max_versions);
+        ls = malloc(sizeof(*ls));
         if (!ls) {
                 errno = ENOMEM;
                 return ls;
         }
 
         memset(ls, 0, sizeof(*ls));
-        for (i = 0; i < max_versions; i++)
-                INIT_LIST_HEAD(&ls->obj_hash[i]);
+        INIT_LIST_HEAD(&ls->obj_hash[0]);
+        INIT_LIST_HEAD(&ls->mem_list);
+        pthread_mutex_init(&ls->mem_lock, NULL);
         ls->size_hash = max_versions;
 
+        if (spv_init(&ls->vars, max_versions, 
+                     offsetof(struct obj_data, obj_desc.bb) -
+                     offsetof(struct obj_data, obj_entry)) < 0) {
+                free(ls);
+                errno = ENOMEM;
+                return 0;
+        }
+
         return ls;
 }
 
@@ -957,40 +2013,279 @@ void ls_free(struct ss_storage *ls)
 {
     if (!ls) return;
 
-    struct obj_data *od, *t;
-    struct list_head *list;
-    int i;
-
-    for (i = 0; i < ls->size_hash; i++) {
-        list = &ls->obj_hash[i];
-        list_for_each_entry_safe(od, t, list, struct obj_data, obj_entry ) {
-            
-            #ifdef SHMEM_OBJECTS
-            shmem_obj_data_free(od);
-            ls_remove(ls, od);
-            free(od);
-            #endif
-            #ifndef SHMEM_OBJECTS
-            ls_remove(ls, od);
-            obj_data_free(od);
-            #endif
-            
+    struct sp_var *var, *tv;
+    struct obj_data *od;
+    struct list_head *e, *t;
+    int i, j;
+
+    for (i = 0; i < ls->vars.size_hash; i++) {
+        list_for_each_entry_safe(var, tv, &ls->vars.var_hash[i], struct sp_var, var_entry) {
+            for (j = 0; j < var->spi.size_hash; j++) {
+                list_for_each_safe(e, t, &var->spi.obj_hash[j]) {
+                    od = ls_obj(e);
+                    spi_del(&var->spi, e);
+                    ls->num_obj--;
+
+                    #ifdef SHMEM_OBJECTS
+                    shmem_obj_data_free(od);
+                    mem_pool_free(&obj_data_pool, od);
+                    #endif
+                    #ifndef SHMEM_OBJECTS
+                    obj_data_free(od);
+                    #endif
+                }
+            }
+            spv_del(&ls->vars, var);
         }
     }
 
     if (ls->num_obj != 0) {
         uloga("%s(): ERROR ls->num_obj is %d not 0\n", __func__, ls->num_obj);
     }
+    spv_free(&ls->vars);
+    list_for_each_safe(e, t, &ls->mem_list) {
+        list_del(e);
+        free(list_entry(e, struct ls_mem_ver, ver_entry));
+    }
+    pthread_mutex_destroy(&ls->mem_lock);
+    free(ls->spill_dir);
     free(ls);
 }
 
+/* Smaller objects are not worth a mapping of their own. */
+#define LS_SPILL_MIN_SIZE       4096
+
+/*
+  Move 'od' to the front of the resident objects of its version.
+*/
+static void ls_touch(struct ss_storage *ls, struct obj_data *od)
+{
+        /* Readers share the storage lock, 'mem_lock' orders them. */
+        if (!od || !od->mem_ver)
+                return;
+
+        pthread_mutex_lock(&ls->mem_lock);
+        if (od->mem_ver) {
+                list_del(&od->mem_entry);
+                list_add(&od->mem_entry, &od->mem_ver->obj_list);
+        }
+        pthread_mutex_unlock(&ls->mem_lock);
+}
+
+/*
+  Account the data of 'od' in the memory budget and list it to be
+  spilled if it has a buffer of its own worth a mapping.
+*/
+static void ls_mem_add(struct ss_storage *ls, struct obj_data *od)
+{
+        uint64_t size = obj_data_size(&od->obj_desc);
+        struct ls_mem_ver *mv;
+        struct list_head *e;
+
+        if (!ls->mem_budget || od->f_spilled)
+                return;
+
+        pthread_mutex_lock(&ls->mem_lock);
+        ls->mem_used += size;
+        if (!od->_data || size < LS_SPILL_MIN_SIZE)
+                goto out;
+
+        /* New objects are mostly of the newest version. */
+        list_for_each(e, &ls->mem_list) {
+                mv = list_entry(e, struct ls_mem_ver, ver_entry);
+                if (mv->version <= od->obj_desc.version)
+                        break;
+        }
+        if (e == &ls->mem_list || mv->version != od->obj_desc.version) {
+                mv = malloc(sizeof(*mv));
+                if (!mv)
+                        goto out;
+                mv->version = od->obj_desc.version;
+                INIT_LIST_HEAD(&mv->obj_list);
+                list_add_before_pos(&mv->ver_entry, e);
+        }
+        list_add(&od->mem_entry, &mv->obj_list);
+        od->mem_ver = mv;
+ out:
+        pthread_mutex_unlock(&ls->mem_lock);
+}
+
+static void ls_mem_unlist(struct obj_data *od)
+{
+        struct ls_mem_ver *mv = od->mem_ver;
+
+        list_del(&od->mem_entry);
+        od->mem_ver = NULL;
+        if (list_empty(&mv->obj_list)) {
+                list_del(&mv->ver_entry);
+                free(mv);
+        }
+}
+
+static void ls_mem_del(struct ss_storage *ls, struct obj_data *od)
+{
+        /* Spilled objects, or picked to be, are no longer accounted. */
+        if (!ls->mem_budget || od->f_spilled)
+                return;
+
+        pthread_mutex_lock(&ls->mem_lock);
+        if (od->mem_ver)
+                ls_mem_unlist(od);
+        ls->mem_used -= obj_data_size(&od->obj_desc);
+        pthread_mutex_unlock(&ls->mem_lock);
+}
+
+/*
+  Keep the data of the stored objects under 'budget' bytes; objects
+  over it are spilled to files under 'spill_dir'.
+*/
+int ls_set_mem_budget(struct ss_storage *ls, uint64_t budget,
+                      const char *spill_dir)
+{
+        if (ls->num_obj > 0)
+                return -EBUSY;
+
+        free(ls->spill_dir);
+        ls->spill_dir = strdup(spill_dir);
+        if (!ls->spill_dir)
+                return -ENOMEM;
+
+        ls->mem_budget = budget;
+        ls->mem_used = 0;
+        return 0;
+}
+
+/*
+  Pick up to 'n' stored objects to spill so that 'size' more bytes fit
+  in the memory budget: the oldest version first, then the least
+  recently used objects. The victims are pinned and no longer
+  accounted; each must be passed to ls_spill_write() and then to
+  ls_spill_done(), and unpinned. Return the number of victims, or
+  -ENOMEM if nothing is left to spill. The caller holds the storage
+  lock for writing.
+*/
+int ls_spill_pick(struct ss_storage *ls, uint64_t size, 
+                  struct obj_data *od_tab[], int n)
+{
+        struct ls_mem_ver *mv;
+        struct obj_data *od;
+        struct list_head *v, *tv, *e, *t;
+        int num_od = 0;
+
+        if (!ls->mem_budget)
+                return 0;
+
+        pthread_mutex_lock(&ls->mem_lock);
+        for (v = ls->mem_list.prev; v != &ls->mem_list; v = tv) {
+                tv = v->prev;
+                mv = list_entry(v, struct ls_mem_ver, ver_entry);
+                /* Only objects in use are passed over. */
+                for (e = mv->obj_list.prev; e != &mv->obj_list; e = t) {
+                        t = e->prev;
+                        if (num_od == n || 
+                            ls->mem_used + size <= ls->mem_budget)
+                                break;
+                        od = list_entry(e, struct obj_data, mem_entry);
+                        if (od->refcnt > 0)
+                                continue;
+
+                        list_del(&od->mem_entry);
+                        od->mem_ver = NULL;
+                        ls->mem_used -= obj_data_size(&od->obj_desc);
+                        od->f_spilled = 1;
+                        od->refcnt++;
+                        od_tab[num_od++] = od;
+                }
+                if (list_empty(&mv->obj_list)) {
+                        list_del(&mv->ver_entry);
+                        free(mv);
+                }
+                if (num_od == n || ls->mem_used + size <= ls->mem_budget)
+                        break;
+        }
+        if (num_od == 0 && ls->mem_used + size > ls->mem_budget)
+                num_od = -ENOMEM;
+        pthread_mutex_unlock(&ls->mem_lock);
+
+        return num_od;
+}
+
+/*
+  Write the data of a victim of ls_spill_pick() to a file under the
+  spill directory and map it in '*map'; the pages are read back from
+  the file on access. Called without the storage lock, the pinned
+  object is only read.
+*/
+int ls_spill_write(struct ss_storage *ls, struct obj_data *od, void **map)
+{
+        size_t size = obj_data_size(&od->obj_desc), n;
+        char path[strlen(ls->spill_dir) + 32];
+        char *p = od->data;
+        ssize_t ret;
+        int fd, err = -EIO;
+
+        sprintf(path, "%s/dspaces_spill.XXXXXX", ls->spill_dir);
+        fd = mkstemp(path);
+        if (fd < 0)
+                return -errno;
+        /* The mapping keeps the file until the object is freed. */
+        unlink(path);
+
+        for (n = 0; n < size; n += ret) {
+                ret = write(fd, p + n, size - n);
+                if (ret < 0) {
+                        if (errno == EINTR) {
+                                ret = 0;
+                                continue;
+                        }
+                        goto out;
+                }
+        }
+
+        *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (*map == MAP_FAILED) {
+                *map = NULL;
+                goto out;
+        }
+        err = 0;
+ out:
+        close(fd);
+        return err;
+}
+
+/*
+  Switch a victim of ls_spill_pick() to the mapping of its data, or
+  keep it resident if 'map' is NULL. An object found again while it
+  was written keeps its buffer too, it is in use and no longer the
+  least recently used. The caller holds the storage lock for writing.
+*/
+void ls_spill_done(struct ss_storage *ls, struct obj_data *od, void *map)
+{
+        /* list_del() clears the links of removed objects. */
+        int f_stored = (od->obj_entry.next != NULL);
+
+        if (map && od->refcnt == 1 && f_stored) {
+                obj_data_free_payload(od);
+                od->f_arena = 0;
+                od->_data = NULL;
+                od->data = map;
+                return;
+        }
+
+        if (map)
+                munmap(map, obj_data_size(&od->obj_desc));
+        od->f_spilled = 0;
+        /* Removed meanwhile, it is freed when unpinned. */
+        if (f_stored)
+                ls_mem_add(ls, od);
+}
+
 /*
   Add an object to the local storage.
 */
 void ls_add_obj(struct ss_storage *ls, struct obj_data *od)
 {
-        int index;
-        struct list_head *bin;
+        struct sp_var *var;
         struct obj_data *od_existing;
 
         od_existing = ls_find_no_version(ls, &od->obj_desc);
@@ -1004,36 +2299,70 @@ void ls_add_obj(struct ss_storage *ls, struct obj_data *od)
         	}
         }
 
-        index = od->obj_desc.version % ls->size_hash;
-        bin = &ls->obj_hash[index];
+        var = spv_get(&ls->vars, od->obj_desc.name, od->obj_desc.version);
+        if (!var) {
+                uloga("'%s()': failed with %d, object dropped.\n", 
+                      __func__, -ENOMEM);
+                obj_data_free(od);
+                return;
+        }
 
-        /* NOTE: new object comes first in the list. */
-        list_add(&od->obj_entry, bin);
+        spi_add(&var->spi, &od->obj_entry);
         ls->num_obj++;
+        ls_mem_add(ls, od);
 }
 
+/*
+  Return any object of a given name, regardless of its version.
+*/
 struct obj_data* ls_lookup(struct ss_storage *ls, char *name)
 {
-        struct obj_data *od;
-        struct list_head *list;
+        struct sp_var *var;
         int i;
 
         for (i = 0; i < ls->size_hash; i++) {
-                list = &ls->obj_hash[i];
-
-                list_for_each_entry(od, list, struct obj_data, obj_entry ) {
-                        if (strcmp(od->obj_desc.name, name) == 0)
-                                return od;
+                list_for_each_entry(var, spv_bin(&ls->vars, name, i), 
+                                    struct sp_var, var_entry) {
+                        if (strcmp(var->name, name) == 0)
+                                return ls_obj(spv_first(var));
                 }
         }
 
         return NULL;
 }
 
+/*
+  Return any object of a given name and version.
+*/
+struct obj_data* 
+ls_lookup_version(struct ss_storage *ls, const char *name, unsigned int version)
+{
+        struct sp_var *var;
+
+        var = spv_find(&ls->vars, name, version);
+        if (var)
+                return ls_obj(spv_first(var));
+
+        return NULL;
+}
+
 void ls_remove(struct ss_storage *ls, struct obj_data *od)
 {
-        list_del(&od->obj_entry);
+        struct sp_var *var;
+
+        ls_mem_del(ls, od);
+
+        var = spv_find(&ls->vars, od->obj_desc.name, od->obj_desc.version);
+        if (!var) {
+                list_del(&od->obj_entry);
+                ls->num_obj--;
+                return;
+        }
+
+        spi_del(&var->spi, &od->obj_entry);
         ls->num_obj--;
+        if (var->spi.num_obj == 0)
+                spv_del(&ls->vars, var);
 }
 
 void ls_try_remove_free(struct ss_storage *ls, struct obj_data *od)
@@ -1056,19 +2385,49 @@ void ls_try_remove_free(struct ss_storage *ls, struct obj_data *od)
 */
 struct obj_data *ls_find(struct ss_storage *ls, const struct obj_descriptor *odsc)
 {
+        struct sp_var *var;
         struct obj_data *od;
-        struct list_head *list;
-        int index;
 
-        index = odsc->version % ls->size_hash;
-        list = &ls->obj_hash[index];
+        var = spv_find(&ls->vars, odsc->name, odsc->version);
+        if (!var)
+                return NULL;
 
-        list_for_each_entry(od, list, struct obj_data, obj_entry) {
-                if (obj_desc_equals_intersect(odsc, &od->obj_desc))
-                        return od;
-        }
+        od = ls_obj(spv_search(var, &odsc->bb));
+        ls_touch(ls, od);
+        return od;
+}
 
-        return NULL;
+struct ls_match_cover {
+        const struct bbox       *bb;
+        struct list_head        *e;
+};
+
+static int ls_match_cover(struct list_head *e, void *arg)
+{
+        struct ls_match_cover *m = arg;
+
+        if (!bbox_include(&ls_obj(e)->obj_desc.bb, m->bb))
+                return 0;
+        m->e = e;
+        return 1;
+}
+
+/*
+  Find the object that holds all of 'odsc'; a piece of an older layout
+  may only intersect the objects we have.
+*/
+struct obj_data *ls_find_cover(struct ss_storage *ls, const struct obj_descriptor *odsc)
+{
+        struct ls_match_cover m = {&odsc->bb, NULL};
+        struct sp_var *var;
+
+        var = spv_find(&ls->vars, odsc->name, odsc->version);
+        if (!var)
+                return NULL;
+
+        spi_search(&var->spi, &odsc->bb, ls_match_cover, &m);
+        ls_touch(ls, ls_obj(m.e));
+        return ls_obj(m.e);
 }
 
 
@@ -1090,30 +2449,20 @@ int obj_desc_by_name_only_intersect(const struct obj_descriptor *odsc1,
 
 struct obj_data *ls_find_next(struct ss_storage *ls, const struct obj_descriptor *odsc)
 {
-        struct obj_data *od;
-        struct list_head *list;
-        int offset, index, next_ver;
-        struct obj_data *od_next = NULL;
-        next_ver = INT_MAX;
-	int curr_ver = odsc->version;
-        for(offset=1; offset <= ls->size_hash; offset++) {
-            index = (odsc->version + offset) % ls->size_hash;
-            list = &ls->obj_hash[index];
-            list_for_each_entry(od, list, struct obj_data, obj_entry) {
-                if (obj_desc_by_name_only_intersect(odsc, &od->obj_desc)){
-                    if(od->obj_desc.version >= (odsc->version+1) && 
-			od->obj_desc.version < next_ver) {
-                        od_next = od;
-                        next_ver = od_next->obj_desc.version;
-                        if(next_ver <= (odsc->version + ls->size_hash)) {
-                            return(od_next);
-                        }
-		     }
+        struct sp_var *var, *var_next = NULL;
+        int i;
+
+        for (i = 0; i < ls->size_hash; i++) {
+                list_for_each_entry(var, spv_bin(&ls->vars, odsc->name, i), 
+                                    struct sp_var, var_entry) {
+                        if (var->version > odsc->version &&
+                            (!var_next || var->version < var_next->version) &&
+                            strcmp(var->name, odsc->name) == 0)
+                                var_next = var;
                 }
-            }
         }
 
-        return(od_next);
+        return var_next ? ls_obj(spv_first(var_next)) : NULL;
 }
 
 
@@ -1123,26 +2472,20 @@ struct obj_data *ls_find_next(struct ss_storage *ls, const struct obj_descriptor
 */
 struct obj_data *ls_find_latest(struct ss_storage *ls, const struct obj_descriptor *odsc)
 {
-        struct obj_data *od;
-        struct list_head *list;
-        int index;
-        struct obj_data *od_next = NULL;
-
-        for(index=0; index <= ls->size_hash; index++){
-            list = &ls->obj_hash[index];
-            list_for_each_entry(od, list, struct obj_data, obj_entry) {
-                if (obj_desc_by_name_only_intersect(odsc, &od->obj_desc)) {
-                    if(od->obj_desc.version >= (odsc->version+1)) {
-                        if((od_next->obj_desc.version < od->obj_desc.version)
-                                || !od_next) {
-                            od_next = od;                           
-                        }
-                    }
+        struct sp_var *var, *var_next = NULL;
+        int i;
+
+        for (i = 0; i < ls->size_hash; i++) {
+                list_for_each_entry(var, spv_bin(&ls->vars, odsc->name, i), 
+                                    struct sp_var, var_entry) {
+                        if (var->version > odsc->version &&
+                            (!var_next || var->version > var_next->version) &&
+                            strcmp(var->name, odsc->name) == 0)
+                                var_next = var;
                 }
-            }
         }
 
-        return od_next;
+        return var_next ? ls_obj(spv_first(var_next)) : NULL;
 }
 
 
@@ -1154,16 +2497,19 @@ struct obj_data *ls_find_latest(struct ss_storage *ls, const struct obj_descript
 struct obj_data *
 ls_find_no_version(struct ss_storage *ls, struct obj_descriptor *odsc)
 {
-        struct obj_data *od;
-        struct list_head *list;
-        int index;
+        struct sp_var *var;
+        struct list_head *e;
+        unsigned int index = odsc->version % ls->size_hash;
 
-        index = odsc->version % ls->size_hash; 
-        list = &ls->obj_hash[index];
+        list_for_each_entry(var, spv_bin(&ls->vars, odsc->name, index),
+                            struct sp_var, var_entry) {
+                if (var->version % ls->size_hash != index ||
+                    strcmp(var->name, odsc->name) != 0)
+                        continue;
 
-        list_for_each_entry(od, list, struct obj_data, obj_entry) {
-                if (obj_desc_by_name_intersect(odsc, &od->obj_desc))
-                        return od;
+                e = spv_search(var, &odsc->bb);
+                if (e)
+                        return ls_obj(e);
         }
 
         return NULL;
@@ -1174,10 +2520,11 @@ ls_find_no_version(struct ss_storage *ls, struct obj_descriptor *odsc)
   name and coordinates, but not version, and return the matching index.
 */
 static struct obj_desc_list * 
-dht_find_match(const struct dht_entry *de, const struct obj_descriptor *odsc)
+dht_find_match(struct dht_entry *de, const struct obj_descriptor *odsc)
 {
-	struct obj_desc_list *odscl;
-        int n;
+	struct sp_var *var;
+	struct list_head *e;
+        unsigned int n;
 
 	// TODO: delete this (just an assertion for proper behaviour).
 	if (odsc->version == (unsigned int) -1) {
@@ -1187,9 +2534,13 @@ dht_find_match(const struct dht_entry *de, const struct obj_descriptor *odsc)
 	}
 
 	n = odsc->version % de->odsc_size;
-	list_for_each_entry(odscl, &de->odsc_hash[n], struct obj_desc_list, odsc_entry) {
-		if(obj_desc_by_name_intersect(odsc, &odscl->odsc))
-			return odscl;
+	list_for_each_entry(var, spv_bin(&de->odsc_vars, odsc->name, n), struct sp_var, var_entry) {
+		if (var->version % de->odsc_size != n || strcmp(var->name, odsc->name) != 0)
+			continue;
+
+		e = spv_search(var, &odsc->bb);
+		if (e)
+			return list_entry(e, struct obj_desc_list, odsc_entry);
 	}
 
 	return 0;
@@ -1200,24 +2551,34 @@ dht_find_match(const struct dht_entry *de, const struct obj_descriptor *odsc)
 int dht_add_entry(struct dht_entry *de, const struct obj_descriptor *odsc)
 {
 	struct obj_desc_list *odscl;
-        int n, err = -ENOMEM;
+	struct sp_var *var;
+        int err = -ENOMEM;
 
         odscl = dht_find_match(de, odsc);
         if (odscl) {
                 /* There  is allready  a descriptor  with  a different
 		   version in the DHT, so I will overwrite it. */
+		var = spv_find(&de->odsc_vars, odscl->odsc.name, odscl->odsc.version);
+		spi_del(&var->spi, &odscl->odsc_entry);
+		if (var->spi.num_obj == 0)
+			spv_del(&de->odsc_vars, var);
                 memcpy(&odscl->odsc, odsc, sizeof(*odsc));
-                return 0;
         }
+	else {
+		odscl = mem_pool_alloc(&odsc_list_pool);
+		if (!odscl)
+			return err;
+		memcpy(&odscl->odsc, odsc, sizeof(*odsc));
+		de->odsc_num++;
+	}
 
-	n = odsc->version % de->odsc_size;
-	odscl = malloc(sizeof(*odscl));
-	if (!odscl)
+	var = spv_get(&de->odsc_vars, odsc->name, odsc->version);
+	if (!var) {
+		mem_pool_free(&odsc_list_pool, odscl);
+		de->odsc_num--;
 		return err;
-	memcpy(&odscl->odsc, odsc, sizeof(*odsc));
-
-	list_add(&odscl->odsc_entry, &de->odsc_hash[n]);
-	de->odsc_num++;
+	}
+	spi_add(&var->spi, &odscl->odsc_entry);
 
         return 0;
 }
@@ -1241,6 +2602,21 @@ dht_find_entry(struct dht_entry *de, const struct obj_descriptor *odsc)
         return NULL;
 }
 
+struct dht_match_all {
+	const struct obj_descriptor	**odsc_tab;
+	int				num_odsc;
+};
+
+static int dht_match_all(struct list_head *e, void *arg)
+{
+	struct dht_match_all *m = arg;
+	struct obj_desc_list *odscl;
+
+	odscl = list_entry(e, struct obj_desc_list, odsc_entry);
+	m->odsc_tab[m->num_odsc++] = &odscl->odsc;
+	return 0;
+}
+
 /*
   Object descriptor 'q_odsc' can intersect multiple object descriptors
   from dht entry 'de'; find all descriptor from 'de' and return their
@@ -1249,16 +2625,14 @@ dht_find_entry(struct dht_entry *de, const struct obj_descriptor *odsc)
 int dht_find_entry_all(struct dht_entry *de, struct obj_descriptor *q_odsc, 
                 const struct obj_descriptor *odsc_tab[])
 {
-        int n, num_odsc = 0;
-	struct obj_desc_list *odscl;
+	struct dht_match_all m = {odsc_tab, 0};
+	struct sp_var *var;
 
-	n = q_odsc->version % de->odsc_size;
-	list_for_each_entry(odscl, &de->odsc_hash[n], struct obj_desc_list, odsc_entry) {
-		if (obj_desc_equals_intersect(&odscl->odsc, q_odsc))
-			odsc_tab[num_odsc++] = &odscl->odsc;
-	}
+	var = spv_find(&de->odsc_vars, q_odsc->name, q_odsc->version);
+	if (var)
+		spi_search(&var->spi, &q_odsc->bb, dht_match_all, &m);
 
-        return num_odsc;
+        return m.num_odsc;
 }
 
 /*
@@ -1266,13 +2640,15 @@ int dht_find_entry_all(struct dht_entry *de, struct obj_descriptor *q_odsc,
 */
 int dht_find_versions(struct dht_entry *de, struct obj_descriptor *q_odsc, int odsc_vers[])
 {
-	struct obj_desc_list *odscl;
+	struct sp_var *var;
 	int i, n = 0;
 
 	for (i = 0; i < de->odsc_size; i++) {
-		list_for_each_entry(odscl, &de->odsc_hash[i], struct obj_desc_list, odsc_entry)
-			if (obj_desc_by_name_intersect(&odscl->odsc, q_odsc)) {
-				odsc_vers[n++] = odscl->odsc.version;
+		list_for_each_entry(var, spv_bin(&de->odsc_vars, q_odsc->name, i), struct sp_var, var_entry)
+			if (var->version % de->odsc_size == i && 
+			    strcmp(var->name, q_odsc->name) == 0 &&
+			    spv_search(var, &q_odsc->bb)) {
+				odsc_vers[n++] = var->version;
 				break;	/* Break the list_for_each_entry loop. */
 			}
 	}
@@ -1280,10 +2656,229 @@ int dht_find_versions(struct dht_entry *de, struct obj_descriptor *q_odsc, int o
 	return n;
 }
 
+static int dht_match_layout(struct list_head *e, void *arg)
+{
+	const struct obj_descriptor *odsc = arg;
+	struct obj_desc_list *odscl;
+
+	odscl = list_entry(e, struct obj_desc_list, odsc_entry);
+	return odscl->odsc.owner == odsc->owner &&
+		bbox_equals(&odscl->odsc.bb, &odsc->bb);
+}
+
+/*
+  Test if  a descriptor with the  layout of 'odsc', i.e.,  the same
+  bounding box and owner, is indexed under another version.
+*/
+int dht_find_layout(struct dht_entry *de, const struct obj_descriptor *odsc)
+{
+	struct sp_var *var;
+	int i;
+
+	for (i = 0; i < de->odsc_size; i++) {
+		list_for_each_entry(var, spv_bin(&de->odsc_vars, odsc->name, i), struct sp_var, var_entry)
+			if (var->version % de->odsc_size == i &&
+			    var->version != odsc->version &&
+			    strcmp(var->name, odsc->name) == 0 &&
+			    spi_search(&var->spi, &odsc->bb, dht_match_layout, (void *) odsc))
+				return 1;
+	}
+
+	return 0;
+}
+
 #define ALIGN_ADDR_QUAD_BYTES(a)                                \
         unsigned long _a = (unsigned long) (a);                 \
         _a = (_a + 7) & ~7;                                     \
         (a) = (void *) _a;
+
+/*
+  Arena for the payload of stored objects. Slots are carved from large
+  mappings, backed by huge pages when the system has them, and are
+  binned by size class; a freed slot goes back to its bin and is taken
+  again by the next object of that class, e.g., the same variable at a
+  later version. The mappings are never released.
+*/
+#define ARENA_ALIGN             64
+#define ARENA_HUGE_PAGE         (2UL << 20)
+#define ARENA_NUM_CLASS         256
+
+/* Slot header, 'ARENA_ALIGN' bytes ahead of the payload. */
+struct arena_slot {
+        struct arena_slot       *next;
+        int                     cls;
+} __attribute__((aligned(ARENA_ALIGN)));
+
+static struct {
+        int                     f_enabled;
+        size_t                  region_size;
+
+        /* Unused end of the last mapping. */
+        char                    *cur, *end;
+        struct arena_slot       *bin[ARENA_NUM_CLASS];
+
+        uint64_t                size_mapped;
+        pthread_mutex_t         lock;
+} arena = {
+        .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/*
+  Size class of a slot of 'size' bytes: steps of 64 bytes up to 1KB,
+  then four classes per power of two.
+*/
+static int arena_class(size_t size, size_t *csize)
+{
+        size_t p2, step;
+        int p = 10, k;
+
+        if (size <= 1024) {
+                k = (size + ARENA_ALIGN - 1) / ARENA_ALIGN;
+                *csize = (size_t) (k ? k : 1) * ARENA_ALIGN;
+                return (k ? k : 1) - 1;
+        }
+
+        while (p < 63 && ((size_t) 1 << (p + 1)) < size)
+                p++;
+        p2 = (size_t) 1 << p;
+        step = p2 >> 2;
+        k = (size - p2 - 1) / step;
+        *csize = p2 + (k + 1) * step;
+
+        return 16 + (p - 10) * 4 + k;
+}
+
+static void *arena_map(size_t size)
+{
+        void *p;
+
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS
+#ifdef MAP_HUGETLB
+                 | MAP_HUGETLB
+#endif
+                 , -1, 0);
+        if (p != MAP_FAILED)
+                return p;
+
+        /* No huge pages reserved; ask for transparent ones. */
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+                return NULL;
+#ifdef MADV_HUGEPAGE
+        madvise(p, size, MADV_HUGEPAGE);
+#endif
+        return p;
+}
+
+/*
+  Serve the payload of stored objects from the arena, mapping
+  'region_size' bytes at a time.
+*/
+int obj_data_arena_init(size_t region_size)
+{
+        if (region_size < ARENA_HUGE_PAGE)
+                region_size = ARENA_HUGE_PAGE;
+
+        pthread_mutex_lock(&arena.lock);
+        arena.region_size = (region_size + ARENA_HUGE_PAGE - 1) & 
+                ~(ARENA_HUGE_PAGE - 1);
+        arena.f_enabled = 1;
+        pthread_mutex_unlock(&arena.lock);
+
+        return 0;
+}
+
+static void *arena_alloc(size_t size)
+{
+        struct arena_slot *slot;
+        size_t csize, msize;
+        int cls;
+
+        cls = arena_class(size + sizeof(*slot), &csize);
+
+        pthread_mutex_lock(&arena.lock);
+        slot = arena.bin[cls];
+        if (slot) {
+                arena.bin[cls] = slot->next;
+                goto out;
+        }
+
+        if ((size_t) (arena.end - arena.cur) < csize) {
+                /* Large slots get a mapping of their own. */
+                if (csize > arena.region_size / 4) {
+                        msize = (csize + ARENA_HUGE_PAGE - 1) & 
+                                ~(ARENA_HUGE_PAGE - 1);
+                        slot = arena_map(msize);
+                        if (slot)
+                                arena.size_mapped += msize;
+                        goto out;
+                }
+
+                arena.cur = arena_map(arena.region_size);
+                if (!arena.cur) {
+                        arena.end = NULL;
+                        goto out;
+                }
+                arena.end = arena.cur + arena.region_size;
+                arena.size_mapped += arena.region_size;
+        }
+
+        slot = (struct arena_slot *) arena.cur;
+        arena.cur += csize;
+ out:
+        pthread_mutex_unlock(&arena.lock);
+        if (!slot)
+                return NULL;
+
+        slot->cls = cls;
+        return slot + 1;
+}
+
+static void arena_free(void *p)
+{
+        struct arena_slot *slot = (struct arena_slot *) p - 1;
+
+        pthread_mutex_lock(&arena.lock);
+        slot->next = arena.bin[slot->cls];
+        arena.bin[slot->cls] = slot;
+        pthread_mutex_unlock(&arena.lock);
+}
+
+/*
+  Release the payload of 'od' allocated with obj_data_alloc() or
+  obj_data_allocv().
+*/
+static void obj_data_free_payload(struct obj_data *od)
+{
+        if (od->f_arena)
+                arena_free(od->_data);
+        else    free(od->_data);
+}
+
+/*
+  Allocate the payload of 'od', 'size' bytes aligned at least to 8.
+*/
+static int obj_data_alloc_payload(struct obj_data *od, size_t size)
+{
+#ifndef SHMEM_OBJECTS
+        if (arena.f_enabled) {
+                od->_data = od->data = arena_alloc(size);
+                if (od->_data) {
+                        od->f_arena = 1;
+                        return 0;
+                }
+        }
+#endif
+        od->_data = od->data = malloc(size + 7);
+        if (!od->_data)
+                return -ENOMEM;
+        ALIGN_ADDR_QUAD_BYTES(od->data);
+
+        return 0;
+}
+
 /*
   Allocate space for an obj_data structure and the data.
 */
@@ -1291,17 +2886,15 @@ struct obj_data *obj_data_alloc(struct obj_descriptor *odsc)
 {
     struct obj_data *od = 0;
 
-	od = malloc(sizeof(*od));
+	od = mem_pool_alloc(&obj_data_pool);
 	if (!od)
 		return NULL;
 	memset(od, 0, sizeof(*od));
 
-	od->_data = od->data = malloc(obj_data_size(odsc) + 7);
-	if (!od->_data) {
-		free(od);
+	if (obj_data_alloc_payload(od, obj_data_size(odsc)) < 0) {
+		mem_pool_free(&obj_data_pool, od);
 		return NULL;
 	}
-	ALIGN_ADDR_QUAD_BYTES(od->data);
 	od->obj_desc = *odsc;
 
     return od;
@@ -1311,7 +2904,7 @@ struct obj_data *shmem_obj_data_alloc(struct obj_descriptor *odsc, int id)
 {
     struct obj_data *od = 0;
 
-    od = malloc(sizeof(*od));
+    od = mem_pool_alloc(&obj_data_pool);
     if (!od)
         return NULL;
     memset(od, 0, sizeof(*od));
@@ -1347,7 +2940,7 @@ struct obj_data *shmem_obj_data_alloc(struct obj_descriptor *odsc, int id)
     od->_data = od->data = ptr;
 
     if (!od->_data) {
-        free(od);
+        mem_pool_free(&obj_data_pool, od);
         return NULL;
     }
     //ALIGN_ADDR_QUAD_BYTES(od->data);
@@ -1363,17 +2956,15 @@ struct obj_data *obj_data_allocv(struct obj_descriptor *odsc)
 {
 	struct obj_data *od;
 
-	od = malloc(sizeof(*od));
+	od = mem_pool_alloc(&obj_data_pool);
 	if (!od)
 		return NULL;
 	memset(od, 0, sizeof(*od));
 
-	od->_data = od->data = malloc(obj_data_sizev(odsc) + 7);
-	if (!od->_data) {
-		free(od);
+	if (obj_data_alloc_payload(od, obj_data_sizev(odsc)) < 0) {
+		mem_pool_free(&obj_data_pool, od);
 		return NULL;
 	}
-	ALIGN_ADDR_QUAD_BYTES(od->data);
 	od->obj_desc = *odsc;
 
 	return od;
@@ -1387,7 +2978,7 @@ struct obj_data * obj_data_alloc_no_data(struct obj_descriptor *odsc, void *data
 {
         struct obj_data *od;
 
-        od = malloc(sizeof(*od));
+        od = mem_pool_alloc(&obj_data_pool);
         if (!od)
                 return NULL;
         memset(od, 0, sizeof(*od));
@@ -1435,11 +3026,11 @@ void obj_data_free_with_data(struct obj_data *od)
     if (od->_data) {
         uloga("'%s()': explicit data free on descriptor %s.\n", 
             __func__, od->obj_desc.name);
-        free(od->_data);
+        obj_data_free_payload(od);
     }
     else    free(od->data);
     #endif
-        free(od);
+        mem_pool_free(&obj_data_pool, od);
 
     
 }
@@ -1449,10 +3040,12 @@ void obj_data_free(struct obj_data *od)
     #ifdef SHMEM_OBJECTS
         od->_data = od->data = NULL;
     #endif
-    if (od->_data){
-		free(od->_data);
+    if (od->f_spilled)
+        munmap(od->data, obj_data_size(&od->obj_desc));
+    else if (od->_data){
+		obj_data_free_payload(od);
     }
-	free(od);
+	mem_pool_free(&obj_data_pool, od);
 }
 
 void convert_to_string(struct obj_descriptor *obj_desc, char *name){
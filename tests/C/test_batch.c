@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2009, NSF Cloud and Autonomic Computing Center, Rutgers University
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided
+ * that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, this list of conditions and
+ * the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+ * the following disclaimer in the documentation and/or other materials provided with the distribution.
+ * - Neither the name of the NSF Cloud and Autonomic Computing Center, Rutgers University, nor the names of its
+ * contributors may be used to endorse or promote products derived from this software without specific prior
+ * written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+  Round trip of the batch and non-blocking APIs: each process stores
+  its block of NUM_VARS variables with dspaces_put_batch(), then reads
+  the block of the next process back with dspaces_get_batch(), its own
+  block with dspaces_iget() and dspaces_test()/dspaces_wait()/
+  dspaces_waitall(), and checks the data and the return codes.
+
+  Usage: ./test_batch  (one application, any number of processes; run
+  with the servers of tests/C/dataspaces_server)
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "dataspaces.h"
+
+#include "mpi.h"
+
+#define NUM_VARS        3
+#define BLK             8       /* block edge, in elements */
+
+static int rank_, nproc_;
+static MPI_Comm gcomm_;
+
+static double value(int var, int owner, uint64_t i)
+{
+        return var * 1e6 + owner * 1e4 + i;
+}
+
+static void set_block(int owner, uint64_t *lb, uint64_t *ub)
+{
+        int i;
+
+        for (i = 0; i < 3; i++) {
+                lb[i] = 0;
+                ub[i] = BLK - 1;
+        }
+        lb[0] = owner * BLK;
+        ub[0] = lb[0] + BLK - 1;
+}
+
+/* Return the number of wrong elements in the block of 'owner'. */
+static int check_block(const double *data, int var, int owner)
+{
+        uint64_t i;
+        int bad = 0;
+
+        for (i = 0; i < BLK * BLK * BLK; i++)
+                if (data[i] != value(var, owner, i))
+                        bad++;
+
+        return bad;
+}
+
+static int put_blocks(unsigned int ver)
+{
+        const char *name[NUM_VARS];
+        char name_tab[NUM_VARS][32];
+        unsigned int ver_tab[NUM_VARS];
+        int size[NUM_VARS], ndim[NUM_VARS];
+        uint64_t lb_tab[NUM_VARS][3], ub_tab[NUM_VARS][3];
+        uint64_t *lb[NUM_VARS], *ub[NUM_VARS];
+        const void *data[NUM_VARS];
+        double *buf;
+        uint64_t i;
+        int v, err;
+
+        buf = malloc(sizeof(double) * NUM_VARS * BLK * BLK * BLK);
+        if (!buf)
+                return -ENOMEM;
+
+        for (v = 0; v < NUM_VARS; v++) {
+                sprintf(name_tab[v], "batch_%d", v);
+                name[v] = name_tab[v];
+                ver_tab[v] = ver;
+                size[v] = sizeof(double);
+                ndim[v] = 3;
+                set_block(rank_, lb_tab[v], ub_tab[v]);
+                lb[v] = lb_tab[v];
+                ub[v] = ub_tab[v];
+                for (i = 0; i < BLK * BLK * BLK; i++)
+                        buf[v * BLK * BLK * BLK + i] = value(v, rank_, i);
+                data[v] = buf + v * BLK * BLK * BLK;
+        }
+
+        err = dspaces_put_batch(NUM_VARS, name, ver_tab, size, ndim, lb, ub, data);
+        if (err == 0)
+                err = dspaces_put_sync();
+
+        free(buf);
+        return err;
+}
+
+static int get_blocks(unsigned int ver)
+{
+        struct dspaces_get_req *req[NUM_VARS];
+        const char *name[NUM_VARS];
+        char name_tab[NUM_VARS][32];
+        unsigned int ver_tab[NUM_VARS];
+        int size[NUM_VARS], ndim[NUM_VARS];
+        uint64_t lb_tab[NUM_VARS][3], ub_tab[NUM_VARS][3];
+        uint64_t *lb[NUM_VARS], *ub[NUM_VARS];
+        void *data[NUM_VARS];
+        double *buf;
+        int next = (rank_ + 1) % nproc_;
+        int v, try, flag, bad = 0, err, rc = 0;
+
+        buf = calloc(NUM_VARS * BLK * BLK * BLK, sizeof(double));
+        if (!buf)
+                return -ENOMEM;
+
+        for (v = 0; v < NUM_VARS; v++) {
+                sprintf(name_tab[v], "batch_%d", v);
+                name[v] = name_tab[v];
+                ver_tab[v] = ver;
+                size[v] = sizeof(double);
+                ndim[v] = 3;
+                set_block(next, lb_tab[v], ub_tab[v]);
+                lb[v] = lb_tab[v];
+                ub[v] = ub_tab[v];
+                data[v] = buf + v * BLK * BLK * BLK;
+        }
+
+        /* Batch get of the block of the next process; the servers may
+           still be indexing it. */
+        for (try = 0; try < 100; try++) {
+                err = dspaces_get_batch(NUM_VARS, name, ver_tab, size, ndim,
+                                        lb, ub, data);
+                if (err != -EAGAIN)
+                        break;
+                usleep(10000);
+        }
+        for (v = 0; v < NUM_VARS; v++)
+                bad += check_block(data[v], v, next);
+        if (err != 0 || bad != 0) {
+                uloga("%s(): rank %d dspaces_get_batch() rc %d, %d wrong "
+                      "elements.\n", __func__, rank_, err, bad);
+                rc = -EIO;
+        }
+
+        /* Non-blocking gets of our own block. */
+        memset(buf, 0, sizeof(double) * NUM_VARS * BLK * BLK * BLK);
+        for (v = 0; v < NUM_VARS; v++) {
+                set_block(rank_, lb[v], ub[v]);
+                err = dspaces_iget(name[v], ver, size[v], 3, lb[v], ub[v],
+                                   data[v], &req[v]);
+                if (err != 0) {
+                        uloga("%s(): rank %d dspaces_iget() rc %d.\n",
+                              __func__, rank_, err);
+                        rc = -EIO;
+                        req[v] = NULL;
+                }
+        }
+
+        flag = 0;
+        err = 0;
+        while (req[0] && !flag) {
+                err = dspaces_test(req[0], &flag);
+                if (err < 0)
+                        break;
+        }
+        if (err != 0) {
+                uloga("%s(): rank %d dspaces_test() rc %d.\n", __func__, rank_, err);
+                rc = -EIO;
+        }
+        if (req[1] && (err = dspaces_wait(req[1])) != 0) {
+                uloga("%s(): rank %d dspaces_wait() rc %d.\n", __func__, rank_, err);
+                rc = -EIO;
+        }
+        if (req[2] && (err = dspaces_waitall(NUM_VARS - 2, &req[2])) != 0) {
+                uloga("%s(): rank %d dspaces_waitall() rc %d.\n", __func__, rank_, err);
+                rc = -EIO;
+        }
+
+        bad = 0;
+        for (v = 0; v < NUM_VARS; v++)
+                bad += check_block(data[v], v, rank_);
+        if (bad != 0) {
+                uloga("%s(): rank %d dspaces_iget() %d wrong elements.\n",
+                      __func__, rank_, bad);
+                rc = -EIO;
+        }
+
+        /* A version that was never stored must fail. */
+        for (v = 0; v < NUM_VARS; v++)
+                ver_tab[v] = ver + 1;
+        err = dspaces_get_batch(NUM_VARS, name, ver_tab, size, ndim, lb, ub, data);
+        if (err == 0) {
+                uloga("%s(): rank %d dspaces_get_batch() of a missing version "
+                      "succeeded.\n", __func__, rank_);
+                rc = -EIO;
+        }
+
+        free(buf);
+        return rc;
+}
+
+int main(int argc, char **argv)
+{
+        uint64_t gdim[3];
+        char name[32];
+        int i, err, rc;
+
+        MPI_Init(&argc, &argv);
+        MPI_Comm_size(MPI_COMM_WORLD, &nproc_);
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank_);
+        gcomm_ = MPI_COMM_WORLD;
+
+        err = dspaces_init(nproc_, 1, &gcomm_, NULL);
+        if (err < 0) {
+                uloga("%s(): dspaces_init() failed with %d.\n", __func__, err);
+                MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+
+        gdim[0] = BLK * nproc_;
+        gdim[1] = gdim[2] = BLK;
+        for (i = 0; i < NUM_VARS; i++) {
+                sprintf(name, "batch_%d", i);
+                dspaces_define_gdim(name, 3, gdim);
+        }
+
+        err = put_blocks(1);
+        if (err != 0)
+                uloga("%s(): rank %d dspaces_put_batch() rc %d.\n", __func__, rank_, err);
+        MPI_Barrier(gcomm_);
+        if (err == 0)
+                err = get_blocks(1);
+
+        MPI_Allreduce(&err, &rc, 1, MPI_INT, MPI_MIN, gcomm_);
+        if (rank_ == 0) {
+                uloga("%s(): %s\n", __func__, rc == 0 ? "passed" : "FAILED");
+                dspaces_kill();
+        }
+
+        dspaces_finalize();
+        MPI_Finalize();
+        return rc == 0 ? 0 : 1;
+}